@@ -0,0 +1,413 @@
+
+#include "../src/editor.h"
+
+/* ------------------------------------ microbenchmarks ------------------------------------ */
+// Times the editor's hot paths over generated corpora. Links every object of the editor except
+// main.o and runs headless (no terminal, no swap files).
+//
+//   ./bench.out [--json] [--scale N] [filter]
+//
+// Prints ns/op and bytes allocated per op for each benchmark/corpus pair, or a JSON array of the
+// same numbers with --json. --scale multiplies the corpus sizes, filter only runs the benchmarks
+// whose name contains it. Allocations are counted by wrapping malloc/calloc/realloc at link time
+// (see the Makefile), so only calls made from the editor's own code are counted.
+
+struct state state;
+
+void error(const char* s){
+    perror(s);
+    exit(1);
+}
+
+/* ---- allocation counting ---- */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+// the loader allocates from several threads
+static _Atomic long alloc_bytes;
+static _Atomic long alloc_calls;
+
+void* __wrap_malloc(size_t size){
+    alloc_bytes += size;
+    ++alloc_calls;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size){
+    alloc_bytes += n * size;
+    ++alloc_calls;
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size){
+    alloc_bytes += size;
+    ++alloc_calls;
+    return __real_realloc(p, size);
+}
+
+/* ---- timing and reporting ---- */
+struct result {
+    const char* name;
+    const char* corpus;
+    long ops;
+    double ns_per_op;
+    double bytes_per_op;
+    double allocs_per_op;
+};
+
+#define MAX_RESULTS 128
+
+static struct result results[MAX_RESULTS];
+static int num_results;
+static const char* filter;
+static int scale = 1;
+
+static struct {
+    struct timespec start;
+    long bytes, calls;
+} timer;
+
+static void bench_start(){
+    timer.bytes = alloc_bytes;
+    timer.calls = alloc_calls;
+    clock_gettime(CLOCK_MONOTONIC, &timer.start);
+}
+
+static void bench_stop(const char* name, const char* corpus, long ops){
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (end.tv_sec - timer.start.tv_sec) * 1e9 + (end.tv_nsec - timer.start.tv_nsec);
+    if(ops < 1) ops = 1;
+    if(num_results == MAX_RESULTS) return;
+    results[num_results++] = (struct result){
+        .name = name, .corpus = corpus, .ops = ops,
+        .ns_per_op = ns / ops,
+        .bytes_per_op = (double)(alloc_bytes - timer.bytes) / ops,
+        .allocs_per_op = (double)(alloc_calls - timer.calls) / ops,
+    };
+    fprintf(stderr, "  %-18s %-12s done\n", name, corpus);
+}
+
+static int wanted(const char* name){
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void print_table(){
+    printf("%-18s %-12s %10s %14s %14s %12s\n", "benchmark", "corpus", "ops", "ns/op", "bytes/op", "allocs/op");
+    for(int i = 0; i < num_results; ++i){
+        struct result* r = &results[i];
+        printf("%-18s %-12s %10ld %14.1f %14.1f %12.2f\n",
+               r->name, r->corpus, r->ops, r->ns_per_op, r->bytes_per_op, r->allocs_per_op);
+    }
+}
+
+static void print_json(){
+    printf("[\n");
+    for(int i = 0; i < num_results; ++i){
+        struct result* r = &results[i];
+        printf("  {\"benchmark\": \"%s\", \"corpus\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.1f, "
+               "\"bytes_per_op\": %.1f, \"allocs_per_op\": %.2f}%s\n",
+               r->name, r->corpus, r->ops, r->ns_per_op, r->bytes_per_op, r->allocs_per_op,
+               i + 1 < num_results ? "," : "");
+    }
+    printf("]\n");
+}
+
+/* ---- corpora ---- */
+struct corpus {
+    const char* name;
+    char* path;     // the corpus written to a temporary file, for editor_open
+    char* text;
+    long len;
+    long lines;
+    const char* query; // something editor_find_callback has to look for, the generator plants it
+    long edits;        // how many single character edits to time, fewer on very long rows
+};
+
+static void corpus_add(struct abuf* ab, const char* s){
+    ab_append(ab, s, strlen(s));
+}
+
+// a big C file: keywords, strings, numbers and // comments on every few lines
+static void gen_c_source(struct abuf* ab, long lines){
+    char buf[256];
+    for(long i = 0; i < lines; ++i){
+        switch(i % 8){
+            case 0: snprintf(buf, sizeof(buf), "static int func_%ld(int a, char* b){\n", i); break;
+            case 1: snprintf(buf, sizeof(buf), "    int x = %ld; // counter %ld\n", i * 7, i); break;
+            case 2: snprintf(buf, sizeof(buf), "    if(x > 10 && b != NULL) return x + %ld;\n", i); break;
+            case 3: snprintf(buf, sizeof(buf), "    printf(\"value %%d of %ld\\n\", x);\n", i); break;
+            case 4: snprintf(buf, sizeof(buf), "    for(int j = 0; j < a; ++j) x += j * 3;\n"); break;
+            case 5: snprintf(buf, sizeof(buf), "    switch(x){ case 1: break; default: break; }\n"); break;
+            case 6: snprintf(buf, sizeof(buf), "    return x;\n"); break;
+            default: snprintf(buf, sizeof(buf), "}\n"); break;
+        }
+        corpus_add(ab, buf);
+    }
+}
+
+// few, very long lines
+static void gen_long_lines(struct abuf* ab, long lines){
+    for(long i = 0; i < lines; ++i){
+        for(int w = 0; w < 5000; ++w){
+            corpus_add(ab, (w % 7) ? "word " : "int 42 ");
+        }
+        corpus_add(ab, "\n");
+    }
+}
+
+// minified code: one enormous line per "line", the case long rows are chunked for (long-rows.c)
+static void gen_minified(struct abuf* ab, long lines){
+    for(long i = 0; i < lines; ++i){
+        for(int f = 0; f < 250000; ++f){
+            corpus_add(ab, (f % 5) ? "function f(a,b){return a+42;}" : "var s=\"a string\";/* c */");
+        }
+        corpus_add(ab, "\n");
+    }
+}
+
+// comment blocks that open again and again before they close, so the ml-comment state matters
+static void gen_comments(struct abuf* ab, long lines){
+    for(long i = 0; i < lines; ++i){
+        switch(i % 50){
+            case 0:  corpus_add(ab, "/* start of a block /* with /* openers inside\n"); break;
+            case 49: corpus_add(ab, "   end of the block */ int after = 1;\n"); break;
+            default: corpus_add(ab, "   /* still inside the same comment, \"not a string\" 123\n"); break;
+        }
+    }
+}
+
+// indentation made of tabs, and tabs in the middle of lines
+static void gen_tabs(struct abuf* ab, long lines){
+    for(long i = 0; i < lines; ++i){
+        for(int t = 0; t < 1 + (int)(i % 8); ++t) corpus_add(ab, "\t");
+        corpus_add(ab, "key\t=\tvalue\t\t# trailing\tcomment\n");
+    }
+}
+
+static void corpus_make(struct corpus* c, const char* name, void (*gen)(struct abuf*, long), long lines,
+                        const char* query, long edits){
+    struct abuf ab = { NULL, 0 };
+    gen(&ab, lines * scale);
+    c->name = name;
+    c->text = ab.b;
+    c->len = ab.len;
+    c->lines = lines * scale;
+    c->query = query;
+    c->edits = edits;
+
+    char tmpl[] = "/tmp/notepad-bench-XXXXXX";
+    int fd = mkstemp(tmpl);
+    if(fd == -1 || write(fd, c->text, c->len) != c->len) error("corpus");
+    close(fd);
+    c->path = strdup(tmpl);
+}
+
+static void corpus_free(struct corpus* c){
+    unlink(c->path);
+    free(c->path);
+    free(c->text);
+}
+
+/* ---- editor state ---- */
+static void reset_editor(){
+    editor_free_rows();
+    editor_free_stack(&state.undo);
+    editor_free_stack(&state.redo);
+    free(state.filename);
+    state.filename = NULL;
+    init_editor();
+}
+
+static void load(struct corpus* c){
+    reset_editor();
+    editor_open(c->path);
+}
+
+/* ---- benchmarks ---- */
+static void bench_open(struct corpus* c){
+    load(c); // warm up the page cache and the allocator
+    reset_editor();
+    bench_start();
+    editor_open(c->path);
+    bench_stop("open", c->name, 1);
+}
+
+static void bench_insert_row(struct corpus* c){
+    reset_editor();
+    bench_start();
+    const char* p = c->text;
+    const char* end = c->text + c->len;
+    while(p < end){
+        const char* nl = memchr(p, '\n', end - p);
+        if(nl == NULL) nl = end;
+        editor_insert_row(state.num_rows, (char*) p, nl - p);
+        p = nl + 1;
+    }
+    bench_stop("insert_row", c->name, c->lines);
+}
+
+static void bench_row_insert_char(struct corpus* c){
+    load(c);
+    const long ops = c->edits;
+    bench_start();
+    for(long i = 0; i < ops; ++i){
+        erow* row = &state.row[(i * 7919) % state.num_rows];
+        editor_row_insert_char(row, row->size / 2, 'x');
+    }
+    bench_stop("row_insert_char", c->name, ops);
+}
+
+static void bench_update_syntax(struct corpus* c){
+    load(c);
+    long ops = state.num_rows;
+    bench_start();
+    for(long i = 0; i < ops; ++i){
+        editor_update_syntax(&state.row[i]);
+    }
+    bench_stop("update_syntax", c->name, ops);
+
+    // opening a comment on the first line re-highlights everything below it, closing it again too
+    const long toggles = 10;
+    bench_start();
+    for(long i = 0; i < toggles; ++i){
+        editor_row_insert_span(&state.row[0], 0, "/*", 2);
+        editor_row_delete_span(&state.row[0], 0, 2);
+    }
+    bench_stop("comment_toggle", c->name, toggles * 2);
+}
+
+static void bench_draw_rows(struct corpus* c){
+    load(c);
+    state.screen_rows = 50;
+    state.screen_cols = 200;
+    const long frames = 1000;
+    bench_start();
+    for(long i = 0; i < frames; ++i){
+        state.rowoff = (i * 37) % (state.num_rows > 1 ? state.num_rows : 1);
+        state.coloff = (i % 4) * 10;
+        struct abuf ab = { NULL, 0 };
+        editor_draw_rows(&ab);
+        ab_free(&ab);
+    }
+    bench_stop("draw_rows", c->name, frames);
+    state.rowoff = state.coloff = 0;
+}
+
+// cursor column <-> byte conversions anywhere in a row, what editor_scroll does every frame
+static void bench_columns(struct corpus* c){
+    load(c);
+    const long lookups = 200000;
+    long sink = 0;
+    bench_start();
+    for(long i = 0; i < lookups; ++i){
+        erow* row = &state.row[(i * 7919) % state.num_rows];
+        int cx = row->size - (int)(i % 7);
+        if(cx < 0) cx = 0;
+        int rx = editor_row_cx_to_rx(row, cx);
+        sink += editor_row_rx_to_cx(row, rx);
+    }
+    bench_stop("columns", c->name, lookups);
+    if(sink < 0) printf("%ld\n", sink);
+}
+
+// random jumps and Ctrl-D with soft wrap on, each row's wrap points are computed once
+static void bench_scroll_wrap(struct corpus* c){
+    load(c);
+    state.screen_rows = 50;
+    state.screen_cols = 200;
+    state.wrap = 1;
+    const long jumps = 20000;
+    bench_start();
+    for(long i = 0; i < jumps; ++i){
+        state.cy = (i * 7919) % state.num_rows;
+        state.cx = 0;
+        editor_scroll();
+        editor_wrap_move(10);
+        editor_scroll();
+    }
+    bench_stop("scroll_wrap", c->name, jumps);
+    state.wrap = 0;
+    state.rowoff = state.segoff = 0;
+}
+
+static void bench_find(struct corpus* c){
+    load(c);
+    const long searches = 50;
+    char* query = strdup(c->query);
+    bench_start();
+    editor_find_callback(query, query[0]);
+    for(long i = 1; i < searches; ++i){
+        editor_find_callback(query, CTRL_KEY('n'));
+    }
+    editor_find_callback(query, '\r');
+    bench_stop("find", c->name, searches);
+    free(query);
+}
+
+static void bench_undo_redo(struct corpus* c){
+    load(c);
+    const long edits = c->edits / 4;
+    for(long i = 0; i < edits; ++i){
+        state.cy = (i * 7919) % state.num_rows;
+        state.cx = state.row[state.cy].size / 2;
+        editor_insert_char('x');
+    }
+    bench_start();
+    for(long i = 0; i < edits; ++i) editor_undo();
+    bench_stop("undo", c->name, edits);
+    bench_start();
+    for(long i = 0; i < edits; ++i) editor_redo();
+    bench_stop("redo", c->name, edits);
+}
+
+static const struct {
+    const char* name;
+    void (*run)(struct corpus*);
+} benchmarks[] = {
+    { "open", bench_open },
+    { "insert_row", bench_insert_row },
+    { "row_insert_char", bench_row_insert_char },
+    { "update_syntax", bench_update_syntax },
+    { "draw_rows", bench_draw_rows },
+    { "columns", bench_columns },
+    { "scroll_wrap", bench_scroll_wrap },
+    { "find", bench_find },
+    { "undo_redo", bench_undo_redo },
+};
+
+int main(int argc, char** argv){
+    int json = 0;
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--json") == 0){
+            json = 1;
+        }else if(strcmp(argv[i], "--scale") == 0 && i + 1 < argc){
+            scale = atoi(argv[++i]);
+            if(scale < 1) scale = 1;
+        }else{
+            filter = argv[i];
+        }
+    }
+
+    state.headless = 1;
+    init_editor();
+
+    struct corpus corpora[5];
+    corpus_make(&corpora[0], "c-source", gen_c_source, 50000, "return x;", 20000);
+    corpus_make(&corpora[1], "long-lines", gen_long_lines, 50, "int 42", 400);
+    corpus_make(&corpora[2], "comments", gen_comments, 20000, "after = 1", 20000);
+    corpus_make(&corpora[3], "tabs", gen_tabs, 20000, "# trailing", 20000);
+    corpus_make(&corpora[4], "minified", gen_minified, 1, "return a+42", 2000);
+
+    for(size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); ++b){
+        if(!wanted(benchmarks[b].name)) continue;
+        for(int k = 0; k < 5; ++k) benchmarks[b].run(&corpora[k]);
+    }
+
+    if(json) print_json(); else print_table();
+
+    reset_editor();
+    for(int k = 0; k < 5; ++k) corpus_free(&corpora[k]);
+    return 0;
+}
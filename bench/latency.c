@@ -0,0 +1,370 @@
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h> /* forkpty, link with -lutil */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ------------------------------------ keystroke latency ------------------------------------ */
+// End to end: runs notes.out on a pseudo-terminal, sends it keystrokes one at a time and times
+// how long each one takes until the redrawn screen has been written back. Every refresh ends by
+// showing the cursor again ("\x1b[?25h"), so that marks the end of the frame a stroke caused.
+//
+//   ./latency.out [--json] [--replay file] path/to/notes.out
+//
+// A stroke is whatever has to be sent before the editor draws again: one key when typing, "dd",
+// "3p", "gg" and so on in normal mode. The built-in scenarios run against a generated C file;
+// --replay runs a recorded stream instead, one stroke per line with <Esc>, <CR>, <BS>, <Tab>,
+// <lt> and <C-x> spelled out.
+
+#define ROWS 40
+#define COLS 120
+#define STROKE_TIMEOUT_MS 2000
+
+static const char FRAME_END[] = "\x1b[?25h";
+
+struct stroke {
+    char keys[32];
+    int len;
+};
+
+struct scenario {
+    const char* name;
+    struct stroke* strokes;
+    int num_strokes;
+    int cap;
+};
+
+struct result {
+    const char* name;
+    int strokes;
+    int timeouts;
+    double p50, p90, p99, max; // microseconds
+    double bytes_per_stroke;
+};
+
+static int json;
+
+/* ---- scenarios ---- */
+static void add_stroke(struct scenario* s, const char* keys, int len){
+    if(s->num_strokes == s->cap){
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->strokes = realloc(s->strokes, sizeof(struct stroke) * s->cap);
+    }
+    struct stroke* st = &s->strokes[s->num_strokes++];
+    if(len > (int) sizeof(st->keys)) len = sizeof(st->keys);
+    memcpy(st->keys, keys, len);
+    st->len = len;
+}
+
+static void add_keys(struct scenario* s, const char* keys){
+    add_stroke(s, keys, strlen(keys));
+}
+
+// every character of text is its own stroke, like typing it
+static void add_typing(struct scenario* s, const char* text){
+    for(const char* p = text; *p; ++p) add_stroke(s, p, 1);
+}
+
+static void build_scenarios(struct scenario* sc){
+    const char* sentence = "the quick brown fox jumps over the lazy dog; ";
+
+    sc[0].name = "typing";
+    add_keys(&sc[0], "o");
+    for(int i = 0; i < 10; ++i) add_typing(&sc[0], sentence);
+    add_keys(&sc[0], "\x1b");
+
+    sc[1].name = "dd-storm";
+    for(int i = 0; i < 300; ++i) add_keys(&sc[1], "dd");
+    for(int i = 0; i < 100; ++i) add_keys(&sc[1], "5dd");
+
+    sc[2].name = "search";
+    for(int i = 0; i < 20; ++i){
+        add_keys(&sc[2], "gg");
+        add_keys(&sc[2], "/");
+        add_typing(&sc[2], i % 2 ? "func_1999" : "return x");
+        add_keys(&sc[2], "\r");
+    }
+
+    sc[3].name = "paste";
+    add_keys(&sc[3], "gg");
+    add_keys(&sc[3], "10yy");
+    for(int i = 0; i < 200; ++i) add_keys(&sc[3], "p");
+    for(int i = 0; i < 50; ++i) add_keys(&sc[3], "50P");
+
+    sc[4].name = "scroll";
+    add_keys(&sc[4], "gg");
+    for(int i = 0; i < 500; ++i) add_keys(&sc[4], "j");
+    for(int i = 0; i < 100; ++i) add_keys(&sc[4], "\x04"); // ctrl-d
+    for(int i = 0; i < 100; ++i) add_keys(&sc[4], "\x15"); // ctrl-u
+}
+
+static const struct { const char* name; char key; } named_keys[] = {
+    { "<Esc>", '\x1b' },
+    { "<CR>",  '\r' },
+    { "<BS>",  127 },
+    { "<Tab>", '\t' },
+    { "<lt>",  '<' },
+};
+
+// one stroke per line, same key names as -s scripts plus <C-x>
+static int load_replay(struct scenario* s, const char* path){
+    FILE* f = fopen(path, "r");
+    if(f == NULL) return -1;
+    s->name = path;
+    char line[256];
+    while(fgets(line, sizeof(line), f)){
+        int n = strcspn(line, "\n");
+        char keys[32];
+        int len = 0;
+        for(int i = 0; i < n && len < (int) sizeof(keys); ){
+            int matched = 0;
+            if(line[i] == '<'){
+                if(n - i >= 5 && strncasecmp(line + i, "<C-", 3) == 0 && line[i+4] == '>'){
+                    keys[len++] = line[i+3] & 0x1f;
+                    i += 5;
+                    continue;
+                }
+                for(size_t k = 0; k < sizeof(named_keys) / sizeof(named_keys[0]); ++k){
+                    int kl = strlen(named_keys[k].name);
+                    if(n - i >= kl && strncasecmp(line + i, named_keys[k].name, kl) == 0){
+                        keys[len++] = named_keys[k].key;
+                        i += kl;
+                        matched = 1;
+                        break;
+                    }
+                }
+            }
+            if(!matched) keys[len++] = line[i++];
+        }
+        if(len > 0) add_stroke(s, keys, len);
+    }
+    fclose(f);
+    return 0;
+}
+
+/* ---- corpus ---- */
+static char* make_corpus(){
+    static char path[] = "/tmp/notepad-latency-XXXXXX.c";
+    int fd = mkstemps(path, 2);
+    if(fd == -1){
+        perror("mkstemps");
+        exit(1);
+    }
+    FILE* f = fdopen(fd, "w");
+    for(int i = 0; i < 20000; ++i){
+        fprintf(f, "static int func_%d(int a){ /* block %d */\n", i, i);
+        fprintf(f, "\tint x = %d; // counter\n", i * 7);
+        fprintf(f, "\tif(x > 10) return x + \"%d\"[0];\n", i);
+        fprintf(f, "\treturn x;\n}\n");
+    }
+    fclose(f);
+    return path;
+}
+
+/* ---- the editor on a pty ---- */
+static struct {
+    pid_t pid;
+    int fd;
+    char tail[sizeof(FRAME_END)]; // end of the previous read, a frame end can span two reads
+    int tail_len;
+} ed;
+
+static double now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Reads output until a frame has ended, up to timeout_ms. Returns the bytes read, or -1 on timeout.
+static long read_frame(int timeout_ms){
+    long bytes = 0;
+    double deadline = now_us() + timeout_ms * 1000.0;
+    char buf[65536 + sizeof(FRAME_END)];
+    while(1){
+        int left = (int)((deadline - now_us()) / 1000);
+        if(left < 0) return -1;
+        struct pollfd pfd = { .fd = ed.fd, .events = POLLIN };
+        if(poll(&pfd, 1, left) <= 0) return -1;
+        memcpy(buf, ed.tail, ed.tail_len);
+        ssize_t n = read(ed.fd, buf + ed.tail_len, 65536);
+        if(n <= 0) return -1;
+        bytes += n;
+        int total = ed.tail_len + n;
+        int found = memmem(buf, total, FRAME_END, sizeof(FRAME_END) - 1) != NULL;
+        ed.tail_len = total < (int) sizeof(FRAME_END) - 1 ? total : (int) sizeof(FRAME_END) - 1;
+        memcpy(ed.tail, buf + total - ed.tail_len, ed.tail_len);
+        if(found){
+            ed.tail_len = 0;
+            return bytes;
+        }
+    }
+}
+
+// throw away anything left over from the previous stroke (an extra status message redraw, ...)
+static void drain(){
+    char buf[65536];
+    struct pollfd pfd = { .fd = ed.fd, .events = POLLIN };
+    while(poll(&pfd, 1, 0) > 0 && read(ed.fd, buf, sizeof(buf)) > 0);
+    ed.tail_len = 0;
+}
+
+static void start_editor(const char* binary, const char* file){
+    struct winsize ws = { .ws_row = ROWS, .ws_col = COLS };
+    ed.pid = forkpty(&ed.fd, NULL, NULL, &ws);
+    if(ed.pid == -1){
+        perror("forkpty");
+        exit(1);
+    }
+    if(ed.pid == 0){
+        execl(binary, binary, file, (char*) NULL);
+        perror(binary);
+        _exit(127);
+    }
+    ed.tail_len = 0;
+    if(read_frame(10000) < 0){
+        fprintf(stderr, "%s did not draw its first frame\n", binary);
+        kill(ed.pid, SIGKILL);
+        exit(1);
+    }
+}
+
+static void stop_editor(const char* file){
+    // <esc>, then ctrl-c past the unsaved changes warning
+    const char* quit = "\x1b\x03\x03\x03\x03\x03";
+    for(const char* p = quit; *p; ++p){
+        if(write(ed.fd, p, 1) != 1) break;
+        drain();
+    }
+    for(int i = 0; i < 100; ++i){
+        if(waitpid(ed.pid, NULL, WNOHANG) == ed.pid) goto done;
+        usleep(10000);
+    }
+    kill(ed.pid, SIGKILL);
+    waitpid(ed.pid, NULL, 0);
+done:
+    close(ed.fd);
+    // the swap file is removed on a clean exit, but not if we had to kill it
+    char swp[512];
+    const char* base = strrchr(file, '/');
+    snprintf(swp, sizeof(swp), "%.*s.%s.swp", (int)(base ? base - file + 1 : 0), file, base ? base + 1 : file);
+    unlink(swp);
+}
+
+/* ---- measuring ---- */
+static int cmp_double(const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, int n, double p){
+    if(n == 0) return 0;
+    int i = (int)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static struct result run_scenario(const char* binary, const char* file, struct scenario* s){
+    struct result r = { .name = s->name };
+    double* lat = malloc(sizeof(double) * (s->num_strokes ? s->num_strokes : 1));
+    long bytes = 0;
+
+    start_editor(binary, file);
+    for(int i = 0; i < s->num_strokes; ++i){
+        drain();
+        double t0 = now_us();
+        if(write(ed.fd, s->strokes[i].keys, s->strokes[i].len) != s->strokes[i].len){
+            perror("write");
+            break;
+        }
+        long n = read_frame(STROKE_TIMEOUT_MS);
+        if(n < 0){
+            ++r.timeouts;
+            continue;
+        }
+        lat[r.strokes++] = now_us() - t0;
+        bytes += n;
+    }
+    stop_editor(file);
+
+    qsort(lat, r.strokes, sizeof(double), cmp_double);
+    r.p50 = percentile(lat, r.strokes, 0.50);
+    r.p90 = percentile(lat, r.strokes, 0.90);
+    r.p99 = percentile(lat, r.strokes, 0.99);
+    r.max = r.strokes ? lat[r.strokes - 1] : 0;
+    r.bytes_per_stroke = r.strokes ? (double) bytes / r.strokes : 0;
+    free(lat);
+    return r;
+}
+
+static void print_results(struct result* res, int n){
+    if(json){
+        printf("[\n");
+        for(int i = 0; i < n; ++i){
+            printf("  {\"scenario\": \"%s\", \"strokes\": %d, \"timeouts\": %d, \"p50_us\": %.1f, "
+                   "\"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"bytes_per_stroke\": %.1f}%s\n",
+                   res[i].name, res[i].strokes, res[i].timeouts, res[i].p50, res[i].p90, res[i].p99,
+                   res[i].max, res[i].bytes_per_stroke, i + 1 < n ? "," : "");
+        }
+        printf("]\n");
+        return;
+    }
+    printf("%-12s %8s %8s %10s %10s %10s %10s %12s\n",
+           "scenario", "strokes", "timeouts", "p50 us", "p90 us", "p99 us", "max us", "bytes/stroke");
+    for(int i = 0; i < n; ++i){
+        printf("%-12s %8d %8d %10.1f %10.1f %10.1f %10.1f %12.1f\n",
+               res[i].name, res[i].strokes, res[i].timeouts, res[i].p50, res[i].p90, res[i].p99,
+               res[i].max, res[i].bytes_per_stroke);
+    }
+}
+
+int main(int argc, char** argv){
+    const char* binary = NULL;
+    const char* replay = NULL;
+    for(int i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "--json") == 0){
+            json = 1;
+        }else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc){
+            replay = argv[++i];
+        }else{
+            binary = argv[i];
+        }
+    }
+    if(binary == NULL){
+        fprintf(stderr, "usage: %s [--json] [--replay file] path/to/notes.out\n", argv[0]);
+        return 1;
+    }
+
+    char* corpus = make_corpus();
+    struct scenario sc[5] = {0};
+    int num_scenarios;
+    if(replay){
+        if(load_replay(&sc[0], replay) == -1){
+            perror(replay);
+            unlink(corpus);
+            return 1;
+        }
+        num_scenarios = 1;
+    }else{
+        build_scenarios(sc);
+        num_scenarios = 5;
+    }
+
+    struct result res[5];
+    for(int i = 0; i < num_scenarios; ++i){
+        // nothing is ever saved, so every scenario starts from the same file
+        res[i] = run_scenario(binary, corpus, &sc[i]);
+        fprintf(stderr, "  %-12s done\n", sc[i].name);
+        free(sc[i].strokes);
+    }
+    print_results(res, num_scenarios);
+    unlink(corpus);
+    return 0;
+}
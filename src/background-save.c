@@ -0,0 +1,163 @@
+
+#include "editor.h"
+
+/* ------------------------------------ background saving ------------------------------------ */
+// :w takes a snapshot of the row table (shared payloads, no text is copied) and a writer thread
+// streams it to disk while editing continues. The main thread owns all reference counts, so the
+// snapshot is only released from editor_save_poll() once the writer has finished.
+
+#define SAVE_CHUNK (1 << 20) // bytes handed to each write() call
+
+static struct {
+    pthread_t thread;
+    int active;
+    struct line_slice* lines;
+    int num_lines;
+    char* filename;
+    long total;          // bytes the finished file will have
+    int dirty_at_start;  // state.dirty when the snapshot was taken
+    _Atomic long written;
+    _Atomic int done;
+    int err;             // errno of the failed call, 0 on success
+    int failures;        // saves that failed since startup
+} save;
+
+static void editor_save_release();
+
+static void* editor_save_worker(void* arg){
+    (void) arg;
+    save.err = 0;
+    char* chunk = malloc(SAVE_CHUNK);
+    // 0644 are standard permissions for text files
+    int fd = open(save.filename, O_RDWR | O_CREAT, 0644);
+    if(chunk == NULL || fd == -1 || ftruncate(fd, save.total) == -1){
+        save.err = errno;
+        goto done;
+    }
+
+    int used = 0;
+    for(int i = 0; i < save.num_lines; ++i){
+        const char* s = save.lines[i].chars;
+        int left = save.lines[i].size + 1; // + newline
+        while(left > 0){
+            if(used == SAVE_CHUNK){
+                if(write(fd, chunk, used) != used){ save.err = errno; goto done; }
+                save.written += used;
+                used = 0;
+            }
+            int n = left;
+            if(n > SAVE_CHUNK - used) n = SAVE_CHUNK - used;
+            // the newline is not part of the payload, so add it on the last piece
+            if(n == left){
+                memcpy(chunk + used, s, n - 1);
+                chunk[used + n - 1] = '\n';
+            }else{
+                memcpy(chunk + used, s, n);
+                s += n;
+            }
+            used += n;
+            left -= n;
+        }
+    }
+    if(used > 0 && write(fd, chunk, used) != used){
+        save.err = errno;
+        goto done;
+    }
+    save.written += used;
+
+done:
+    if(fd != -1) close(fd);
+    free(chunk);
+    save.done = 1;
+    return NULL;
+}
+
+// snapshot the current rows and start writing them in the background
+void editor_save_start(){
+    if(save.active){
+        editor_set_status_msg("Save already in progress");
+        return;
+    }
+
+    editor_cold_thaw_all(); // the snapshot shares every row's text
+    save.lines = mem_alloc(MEM_SAVE, sizeof(struct line_slice) * state.num_rows);
+    save.num_lines = state.num_rows;
+    save.total = 0;
+    for(int i = 0; i < state.num_rows; ++i){
+        save.lines[i].chars = line_share(state.row[i].chars);
+        save.lines[i].size = state.row[i].size;
+        save.total += state.row[i].size + 1;
+    }
+    save.filename = strdup(state.filename);
+    save.dirty_at_start = state.dirty;
+    save.written = 0;
+    save.done = 0;
+
+    save.active = 1;
+    editor_journal_mark_save();
+    int rc = pthread_create(&save.thread, NULL, editor_save_worker, NULL);
+    if(rc != 0){
+        save.err = rc;
+        editor_save_release();
+        return;
+    }
+    editor_set_status_msg("Saving %s...", save.filename);
+}
+
+int editor_save_in_progress(){
+    return save.active;
+}
+
+// percentage of the current save that is on disk, -1 if nothing is being saved
+int editor_save_progress(){
+    if(!save.active) return -1;
+    if(save.total == 0) return 100;
+    return (int)(save.written * 100 / save.total);
+}
+
+// drop the snapshot and report how the save went, the writer must already be joined
+static void editor_save_release(){
+    for(int i = 0; i < save.num_lines; ++i){
+        line_release(save.lines[i].chars);
+    }
+    mem_free(MEM_SAVE, save.lines, sizeof(struct line_slice) * save.num_lines);
+    save.lines = NULL;
+    save.active = 0;
+
+    if(save.err){
+        ++save.failures;
+        editor_set_status_msg("Failed to save. Error: %s", strerror(save.err));
+        if(state.headless) fprintf(stderr, "%s: %s\n", save.filename, strerror(save.err));
+    }else if(state.dirty == save.dirty_at_start){
+        editor_set_status_msg("%ld bytes written to disk", save.total);
+        state.dirty = 0;
+        ++state.changes; // the [+] goes away
+        editor_journal_saved();
+    }else{
+        // rows were edited while the snapshot was being written, so the buffer is still modified
+        editor_journal_saved();
+        editor_set_status_msg("%ld bytes written to disk (buffer changed during save)", save.total);
+    }
+    editor_watch_file(save.filename); // what is on disk now is ours, see file-watch.c
+    free(save.filename);
+    save.filename = NULL;
+}
+
+// finish up once the writer is done. Returns 1 if a save completed during this call.
+int editor_save_poll(){
+    if(!save.active || !save.done) return 0;
+    pthread_join(save.thread, NULL);
+    editor_save_release();
+    return 1;
+}
+
+// block until the current save (if any) is on disk, used before exiting
+void editor_save_finish(){
+    if(!save.active) return;
+    pthread_join(save.thread, NULL);
+    editor_save_release();
+}
+
+int editor_save_failures(){
+    return save.failures;
+}
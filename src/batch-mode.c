@@ -0,0 +1,146 @@
+
+#include "editor.h"
+#include <strings.h> /* strncasecmp */
+
+/* ------------------------------------ batch mode ------------------------------------ */
+// notes.out -s script file... runs the keys in script against every file, exactly as if they were
+// typed in the editor (so ":w" saves, "dd" deletes a line, ...), but without a terminal: nothing
+// is drawn and no swap file is written. The editor state is global, so every file gets its own
+// forked worker process, and up to one worker per CPU runs at a time.
+//
+// Script syntax: keys as typed, with a newline standing for <enter>. <Esc>, <CR>, <BS>, <Tab>
+// and <lt> (a literal '<') can be spelled out. If the script runs out in the middle of a
+// command, the command is cancelled as if <esc> had been pressed.
+
+#define BATCH_MAX_WORKERS 64
+
+static const struct { const char* name; char key; } batch_keys[] = {
+    { "<Esc>", '\x1b' },
+    { "<CR>",  '\r' },
+    { "<BS>",  BACKSPACE },
+    { "<Tab>", '\t' },
+    { "<lt>",  '<' },
+};
+
+// turn the script text into the keys it stands for, in place. Returns the number of keys.
+static int batch_parse_script(char* s, int len){
+    int out = 0;
+    for(int i = 0; i < len; ){
+        if(s[i] == '\n'){
+            s[out++] = '\r';
+            ++i;
+            continue;
+        }
+        int matched = 0;
+        if(s[i] == '<'){
+            for(size_t k = 0; k < sizeof(batch_keys) / sizeof(batch_keys[0]); ++k){
+                int n = strlen(batch_keys[k].name);
+                if(len - i >= n && strncasecmp(s + i, batch_keys[k].name, n) == 0){
+                    s[out++] = batch_keys[k].key;
+                    i += n;
+                    matched = 1;
+                    break;
+                }
+            }
+        }
+        if(!matched) s[out++] = s[i++];
+    }
+    return out;
+}
+
+static char* batch_load_script(const char* path, int* len){
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return NULL;
+    struct stat st;
+    char* buf = NULL;
+    if(fstat(fd, &st) == 0 && (buf = malloc(st.st_size + 1))){
+        if(read(fd, buf, st.st_size) != st.st_size){
+            free(buf);
+            buf = NULL;
+        }else{
+            *len = batch_parse_script(buf, st.st_size);
+        }
+    }
+    close(fd);
+    return buf;
+}
+
+// runs in the worker: open, play the script, wait for any :w to land. Returns the exit status.
+static int batch_edit_file(char* filename, const char* keys, int len){
+    if(access(filename, R_OK) == -1){
+        perror(filename);
+        return 1;
+    }
+    init_editor();
+    atexit(end_editor); // a :q in the script exits from the middle of editor_run_keys
+    editor_open(filename);
+    editor_run_keys(keys, len);
+    editor_save_finish();
+    return editor_save_failures() ? 1 : 0;
+}
+
+// Returns 0 if every file was processed and saved without errors, 1 otherwise.
+int editor_batch(const char* script_path, char** files, int num_files){
+    state.headless = 1;
+    int len = 0;
+    char* keys = batch_load_script(script_path, &len);
+    if(keys == NULL){
+        perror(script_path);
+        return 1;
+    }
+
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if(workers > BATCH_MAX_WORKERS) workers = BATCH_MAX_WORKERS;
+    if(workers > num_files) workers = num_files;
+    if(workers < 1) workers = 1;
+
+    pid_t pids[BATCH_MAX_WORKERS];
+    int file_of[BATCH_MAX_WORKERS]; // which file the worker in each slot is editing
+    int running = 0, next = 0, failed = 0;
+
+    while(next < num_files || running > 0){
+        if(next < num_files && running < workers){
+            pid_t pid = fork();
+            if(pid == 0){
+                exit(batch_edit_file(files[next], keys, len));
+            }
+            if(pid > 0){
+                pids[running] = pid;
+                file_of[running] = next++;
+                ++running;
+                continue;
+            }
+            if(running == 0){
+                perror("fork");
+                failed += num_files - next;
+                break;
+            }
+            // out of processes, wait for a worker to finish and try again
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if(pid == -1){
+            perror("wait");
+            break;
+        }
+        for(int k = 0; k < running; ++k){
+            if(pids[k] != pid) continue;
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+                if(WIFSIGNALED(status)){
+                    fprintf(stderr, "%s: worker killed by signal %d\n", files[file_of[k]], WTERMSIG(status));
+                }
+                ++failed;
+            }
+            // keep the slots packed
+            --running;
+            pids[k] = pids[running];
+            file_of[k] = file_of[running];
+            break;
+        }
+    }
+
+    free(keys);
+    if(failed) fprintf(stderr, "%d of %d files failed\n", failed, num_files);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,330 @@
+
+#include "editor.h"
+
+/* ------------------------------------ buffers ------------------------------------ */
+// Several files can be open at once: :e file, :bn, :bp and :ls. The current buffer lives in state
+// like the one file always did, so nothing else has to know about buffers. Switching stashes
+// state's per-file fields (rows, cursor and scroll position, undo and redo, dirty, the swap-file
+// journal) into the old buffer and moves the new one's into state, a few struct copies however
+// big the files are.
+//
+// A buffer is only read the first time it is shown, so `notes.out *.c` reads one file up front.
+// The BUFFERS_HOT most recently shown buffers (and any a window shows) keep their render and hl,
+// the others drop everything built from their text and have their payloads shrunk to fit, and
+// are rendered and highlighted again when they are shown next. Registers, macros and . are shared by all buffers.
+
+#define BUFFERS_HOT 4
+
+struct buffer {
+    // only meaningful while the buffer is not the current one, state has them then
+    char* filename;
+    erow* row;
+    int num_rows, row_cap;
+    int cx, cy, rowoff, coloff, segoff;
+    struct stack undo, redo;
+    int dirty;
+    long changes;
+    struct journal* journal;
+
+    int loaded; // read from disk (or a new file) yet
+    int hot;    // rows have their render and hl
+    long last_used;
+};
+
+static struct {
+    struct buffer* list;
+    int len, cap;
+    int current;
+    long clock;  // bumped on every switch, for last_used
+    int listing; // the :ls panel is shown until the next key
+} buffers;
+
+// the file opened before there was a buffer list becomes the first buffer
+static void buffers_adopt(){
+    if(buffers.len > 0) return;
+    buffers.cap = 8;
+    buffers.list = calloc(buffers.cap, sizeof(struct buffer));
+    if(buffers.list == NULL) error("calloc");
+    buffers.list[0].loaded = 1;
+    buffers.list[0].hot = 1;
+    buffers.list[0].last_used = ++buffers.clock;
+    buffers.len = 1;
+    buffers.current = 0;
+}
+
+static int buffer_add(const char* filename){
+    buffers_adopt();
+    if(buffers.len == buffers.cap){
+        buffers.cap *= 2;
+        buffers.list = realloc(buffers.list, sizeof(struct buffer) * buffers.cap);
+        if(buffers.list == NULL) error("realloc");
+    }
+    struct buffer* b = &buffers.list[buffers.len];
+    memset(b, 0, sizeof(*b));
+    b->filename = strdup(filename);
+    if(b->filename == NULL) error("strdup");
+    return buffers.len++;
+}
+
+// files given after the first one on the command line, nothing is read until they are shown
+void editor_buffers_add(char** files, int n){
+    for(int i = 0; i < n; ++i) buffer_add(files[i]);
+}
+
+static const char* buffer_name(int i){
+    const char* name = i == buffers.current ? state.filename : buffers.list[i].filename;
+    return name ? name : "[No Name]";
+}
+
+// move the current file out of state into b, leaving state empty
+static void buffer_stash(struct buffer* b){
+    editor_cold_thaw_all(); // only the current buffer has frozen rows, see cold-rows.c
+    b->filename = state.filename;
+    b->row = state.row;
+    b->num_rows = state.num_rows;
+    b->row_cap = state.row_cap;
+    b->cx = state.cx;
+    b->cy = state.cy;
+    b->rowoff = state.rowoff;
+    b->coloff = state.coloff;
+    b->segoff = state.segoff;
+    b->undo = state.undo;
+    b->redo = state.redo;
+    b->dirty = state.dirty;
+    b->changes = state.changes;
+    b->journal = editor_journal_detach();
+
+    state.filename = NULL;
+    state.row = NULL;
+    state.num_rows = state.row_cap = 0;
+    state.cx = state.cy = state.rx = 0;
+    state.rowoff = state.coloff = state.segoff = 0;
+    state.dirty = 0;
+    state.changes = 0;
+}
+
+// render and highlight every row of the current buffer again, after buffer_demote
+static void buffer_warm(){
+    int in_comment = 0;
+    for(int i = 0; i < state.num_rows; ++i){
+        erow* row = &state.row[i];
+        editor_update_render(row);
+        in_comment = editor_highlight_row(row, in_comment);
+        row->hl_open_comment = in_comment;
+    }
+}
+
+static void buffer_unstash(struct buffer* b){
+    state.filename = b->filename;
+    state.row = b->row;
+    state.num_rows = b->num_rows;
+    state.row_cap = b->row_cap;
+    state.cx = b->cx;
+    state.cy = b->cy;
+    state.rowoff = b->rowoff;
+    state.coloff = b->coloff;
+    state.segoff = b->segoff;
+    state.undo = b->undo;
+    state.redo = b->redo;
+    state.dirty = b->dirty;
+    state.changes = b->changes;
+    editor_journal_attach(b->journal);
+    b->filename = NULL;
+    b->row = NULL;
+    b->journal = NULL;
+    if(!b->hot){
+        buffer_warm();
+        b->hot = 1;
+    }
+    editor_watch_check(); // the file may have changed while the buffer was in the background
+}
+
+// first time b is shown: read its file into the (empty) state. A file that doesn't exist yet
+// gives an empty buffer that :w creates.
+static void buffer_load(struct buffer* b){
+    state.filename = b->filename;
+    b->filename = NULL;
+    editor_init_undo_redo_stacks();
+    if(editor_load_file(state.filename) == -1){
+        if(errno == ENOENT) editor_set_status_msg("\"%s\" [New File]", state.filename);
+        else editor_set_status_msg("Can't open %s: %s", state.filename, strerror(errno));
+    }
+    if(!state.headless) editor_journal_open(state.filename); // may recover changes, see swap-journal.c
+    editor_watch_file(state.filename);
+    b->loaded = 1;
+    b->hot = 1;
+}
+
+// drop what b's rows have built from their text, see editor_drop_row_cache
+static void buffer_demote(struct buffer* b){
+    for(int i = 0; i < b->num_rows; ++i){
+        erow* row = &b->row[i];
+        editor_drop_row_cache(row);
+        row->chars = line_compact(row->chars, row->size);
+    }
+    b->hot = 0;
+}
+
+// keep at most BUFFERS_HOT buffers hot, demoting the ones shown longest ago that no window shows
+static void buffers_demote_cold(){
+    int hot = 0;
+    for(int i = 0; i < buffers.len; ++i) hot += buffers.list[i].loaded && buffers.list[i].hot;
+    while(hot > BUFFERS_HOT){
+        int lru = -1;
+        for(int i = 0; i < buffers.len; ++i){
+            struct buffer* b = &buffers.list[i];
+            if(i == buffers.current || !b->loaded || !b->hot || editor_window_shows(i)) continue;
+            if(lru == -1 || b->last_used < buffers.list[lru].last_used) lru = i;
+        }
+        if(lru == -1) break;
+        buffer_demote(&buffers.list[lru]);
+        --hot;
+    }
+}
+
+static void buffer_switch(int to){
+    state.statusmsg[0] = '\0';
+    if(to != buffers.current){
+        editor_save_finish(); // a running save is still reading the current buffer's rows
+        buffer_stash(&buffers.list[buffers.current]);
+        buffers.current = to;
+        struct buffer* b = &buffers.list[to];
+        if(b->loaded) buffer_unstash(b);
+        else buffer_load(b);
+        b->last_used = ++buffers.clock;
+        buffers_demote_cold();
+    }
+    state.mode = NORMAL_MODE;
+    // loading can leave a message of its own (new file, recovered swap file), keep that one
+    if(state.statusmsg[0] == '\0'){
+        editor_set_status_msg("\"%s\" %d lines [%d/%d]", buffer_name(to), state.num_rows, to + 1, buffers.len);
+    }
+}
+
+int editor_buffer_current(){
+    return buffers.current;
+}
+
+// make buffer idx the current one, for a window that shows it (see windows.c)
+void editor_buffer_show(int idx){
+    if(idx != buffers.current && idx < buffers.len) buffer_switch(idx);
+}
+
+// Swap the text of buffer idx (rows, name, dirty) with the current one's in state, so a window
+// showing it can be drawn. Calling it again swaps them back, nothing is edited in between.
+void editor_buffer_exchange(int idx){
+    if(idx == buffers.current || idx >= buffers.len) return;
+    struct buffer* b = &buffers.list[idx];
+    char* filename = state.filename;
+    erow* row = state.row;
+    int num_rows = state.num_rows, row_cap = state.row_cap, dirty = state.dirty;
+    state.filename = b->filename;
+    state.row = b->row;
+    state.num_rows = b->num_rows;
+    state.row_cap = b->row_cap;
+    state.dirty = b->dirty;
+    b->filename = filename;
+    b->row = row;
+    b->num_rows = num_rows;
+    b->row_cap = row_cap;
+    b->dirty = dirty;
+}
+
+// state.changes of buffer idx, what a window showing it compares to redraw only when it changed
+long editor_buffer_changes(int idx){
+    return idx == buffers.current || idx >= buffers.len ? state.changes : buffers.list[idx].changes;
+}
+
+// :e file, switches to the buffer for file, adding one if there is none yet
+void editor_buffer_edit(const char* filename){
+    while(*filename == ' ') ++filename;
+    if(*filename == '\0'){
+        editor_set_status_msg("usage: :e file");
+        return;
+    }
+    buffers_adopt();
+    for(int i = 0; i < buffers.len; ++i){
+        const char* name = i == buffers.current ? state.filename : buffers.list[i].filename;
+        if(name && strcmp(name, filename) == 0){
+            buffer_switch(i);
+            return;
+        }
+    }
+    buffer_switch(buffer_add(filename));
+}
+
+// :bn (dir 1) and :bp (dir -1)
+void editor_buffer_next(int dir){
+    buffers_adopt();
+    if(buffers.len < 2){
+        editor_set_status_msg("only one buffer");
+        return;
+    }
+    buffer_switch((buffers.current + dir + buffers.len) % buffers.len);
+}
+
+// :ls shows the buffer list until the next key
+void editor_buffer_list(){
+    buffers_adopt();
+    buffers.listing = 1;
+    editor_set_status_msg("%d buffers, %% current, + modified, - not read yet", buffers.len);
+}
+
+int editor_buffer_listing(){
+    return buffers.listing;
+}
+
+void editor_buffer_list_hide(){
+    buffers.listing = 0;
+}
+
+// one line per buffer, below the perf and mem panels if they are shown
+void editor_draw_buffer_list(struct abuf* ab){
+    int line = 1;
+    if(editor_perf_overlay()) line = 7;
+    if(editor_mem_overlay()) line += MEM_NUM_TAGS + 3;
+    int room = state.screen_rows - line;
+    for(int i = 0; i < buffers.len && room > 0; ++i, --room){
+        struct buffer* b = &buffers.list[i];
+        int current = i == buffers.current;
+        int dirty = current ? state.dirty : b->loaded && b->dirty;
+        if(room == 1 && i + 1 < buffers.len){
+            editor_draw_overlay_line(ab, line, " ... %d more ", buffers.len - i);
+            break;
+        }
+        if(b->loaded || current){
+            editor_draw_overlay_line(ab, line++, " %c%c %3d %-36.36s %7d lines ", current ? '%' : ' ',
+                                     dirty ? '+' : ' ', i + 1, buffer_name(i), current ? state.num_rows : b->num_rows);
+        }else{
+            editor_draw_overlay_line(ab, line++, " %c%c %3d %-36.36s %13s ", '-', ' ', i + 1, buffer_name(i), "");
+        }
+    }
+}
+
+// buffers other than the current one with unsaved changes
+int editor_buffers_modified(){
+    int n = 0;
+    for(int i = 0; i < buffers.len; ++i){
+        if(i != buffers.current && buffers.list[i].loaded && buffers.list[i].dirty) ++n;
+    }
+    return n;
+}
+
+// everything but the current buffer, which end_editor frees from state as before
+void editor_free_buffers(){
+    for(int i = 0; i < buffers.len; ++i){
+        struct buffer* b = &buffers.list[i];
+        if(i == buffers.current) continue;
+        if(b->loaded){
+            for(int r = 0; r < b->num_rows; ++r) editor_free_row(&b->row[r]);
+            mem_free(MEM_ROWS, b->row, sizeof(erow) * b->row_cap);
+            editor_free_stack(&b->undo);
+            editor_free_stack(&b->redo);
+            editor_journal_discard(b->journal, 1); // quitting on purpose, like the current one
+        }
+        free(b->filename);
+    }
+    free(buffers.list);
+    buffers.list = NULL;
+    buffers.len = buffers.cap = 0;
+}
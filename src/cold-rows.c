@@ -0,0 +1,264 @@
+
+#include "editor.h"
+#include <malloc.h> /* malloc_trim */
+
+/* ------------------------------------ cold rows ------------------------------------ */
+// Most of a big log is never looked at again once it has scrolled by, but every row keeps its
+// chars, render, hl and column checkpoints. While the editor waits for a key, rows nobody has
+// drawn or edited for COLD_AFTER seconds are frozen COLD_BLOCK at a time: their chars, render, hl
+// and cols are packed one after the other and compressed into one cold_block (see lz-codec.c),
+// and the separate allocations are freed. size, rsize and col_count stay in the erow, so moving
+// around and counting don't need the text.
+//
+// A frozen row has cold set and chars, render, hl and cols NULL. editor_row_touch thaws a row
+// before anything reads it: drawing, soft wrap, searching and the syntax cascade call it per row,
+// and editor_cold_key thaws the rows next to the cursor before every key. A command that reaches
+// further thaws just the rows it reads: undo its entry's rows, yanks and deletes theirs
+// (editor_cold_thaw_rows), jumps the row they land on. Only :commands thaw everything. The last
+// block thawed from is kept decompressed, so drawing a screenful costs one decompression.
+//
+// Only the current buffer is ever frozen (buffers are thawed when they are put away), never while
+// the pager is shown, and never in -s mode. Empty rows, chunked rows and rows whose text is
+// shared with undo, registers or a save are left alone.
+
+#define COLD_BLOCK 64      // rows per compressed block
+#define COLD_AFTER 10      // seconds a row has to go unseen to be frozen
+#define COLD_IDLE_MS 500   // how long after a key the sweep starts
+#define COLD_STEP_MS 4     // the sweep looks for a key this often
+#define COLD_NEAR 1000     // rows this close to the cursor are never frozen
+#define COLD_REACH 16      // no motion without a count moves the cursor further (^D is 10 rows)
+
+struct cold_block {
+    int refs;   // rows still frozen in it
+    int size;   // bytes once decompressed
+    int packed; // bytes of data
+    char data[];
+};
+
+static struct {
+    long frozen;          // rows frozen in the current buffer
+    int next;             // where the sweep carries on
+    long long last_key;   // editor_perf_now() of the last key
+    long long pass_start; // when the sweep last started at row 0
+    int settled;          // a whole pass found nothing new, wait for a key
+
+    struct cold_block* open; // the block unpacked holds
+    char* unpacked;
+    int unpacked_cap;
+    char* scratch; // rows packed for compressing, and what they compress to
+    int scratch_cap;
+} cold;
+
+static int cold_now(){
+    return editor_perf_now() / 1000000000LL;
+}
+
+static char* cold_grow(char** buf, int* cap, int n){
+    if(n > *cap){
+        *buf = realloc(*buf, n);
+        if(*buf == NULL) error("realloc");
+        *cap = n;
+    }
+    return *buf;
+}
+
+static void cold_block_release(struct cold_block* b){
+    if(--b->refs > 0) return;
+    if(cold.open == b) cold.open = NULL;
+    mem_free(MEM_COLD, b, sizeof(struct cold_block) + b->packed);
+}
+
+static const char* cold_unpack(struct cold_block* b){
+    if(cold.open != b){
+        cold_grow(&cold.unpacked, &cold.unpacked_cap, b->size);
+        if(lz_decompress(b->data, b->packed, cold.unpacked, b->size) != b->size) error("cold rows");
+        cold.open = b;
+    }
+    return cold.unpacked;
+}
+
+static void cold_thaw(erow* row){
+    struct cold_block* b = row->cold;
+    const char* p = cold_unpack(b) + row->cold_at;
+    row->chars = line_intern(p, row->size); // back into the pool, see line-storage.c
+    p += row->size;
+    row->render = mem_alloc(MEM_RENDER, row->rsize + 1);
+    row->hl = mem_alloc(MEM_HL, row->rsize);
+    if(row->render == NULL || (row->hl == NULL && row->rsize > 0)) error("malloc");
+    memcpy(row->render, p, row->rsize);
+    row->render[row->rsize] = '\0';
+    p += row->rsize;
+    memcpy(row->hl, p, row->rsize);
+    p += row->rsize;
+    if(row->col_count > 0){
+        row->cols = mem_alloc(MEM_RENDER, sizeof(struct row_pos) * row->col_count);
+        if(row->cols == NULL) error("malloc");
+        memcpy(row->cols, p, sizeof(struct row_pos) * row->col_count);
+    }
+    row->cold = NULL;
+    row->seen = cold_now(); // or the next sweep freezes it straight away again
+    --cold.frozen;
+    cold_block_release(b);
+}
+
+// called before anything reads a row's text or render: thaws it and marks it as seen just now
+void editor_row_touch(erow* row){
+    if(row->cold) cold_thaw(row);
+    row->seen = cold_now();
+}
+
+// a row that is being freed doesn't need its text back
+void editor_cold_forget(erow* row){
+    if(row->cold == NULL) return;
+    --cold.frozen;
+    cold_block_release(row->cold);
+    row->cold = NULL;
+    row->rsize = row->col_count = 0;
+}
+
+static void cold_thaw_range(int from, int to){
+    if(from < 0) from = 0;
+    if(to > state.num_rows) to = state.num_rows;
+    for(int i = from; i < to && cold.frozen > 0; ++i){
+        if(state.row[i].cold) cold_thaw(&state.row[i]);
+    }
+}
+
+// rows [at, at+n), before a command reads them
+void editor_cold_thaw_rows(int at, int n){
+    if(cold.frozen > 0 && n > 0) cold_thaw_range(at, n < state.num_rows - at ? at + n : state.num_rows);
+}
+
+// every row of the current buffer, before something that may read any of them
+void editor_cold_thaw_all(){
+    cold_thaw_range(0, state.num_rows);
+    cold.next = 0;
+    cold.settled = 0;
+}
+
+// w and e go past empty rows to the next one with text, b to the one before
+static void cold_thaw_word(int dir){
+    int i = state.cy + dir;
+    while(i >= 0 && i < state.num_rows && state.row[i].size == 0) i += dir;
+    if(i >= 0 && i < state.num_rows && state.row[i].cold) cold_thaw(&state.row[i]);
+}
+
+// Before every key (see editor_process_key), and again with the key after a count: the rows no
+// further than COLD_REACH from the cursor, which is as far as a motion without a count looks.
+// 3w can pass a row per word.
+void editor_cold_key(int c, int count){
+    cold.last_key = editor_perf_now();
+    cold.settled = 0;
+    if(cold.frozen == 0) return;
+    int word = state.mode == NORMAL_MODE && (c == 'w' || c == 'b' || c == 'e');
+    int reach = COLD_REACH + (word ? (count < state.num_rows ? count : state.num_rows) : 0);
+    cold_thaw_range(state.cy - reach, state.cy + reach + 1);
+    if(word) cold_thaw_word(c == 'b' ? -1 : 1);
+}
+
+// something other than a key changed the rows (a followed file grew), sweep again
+void editor_cold_wake(){
+    cold.settled = 0;
+}
+
+static int cold_row_fits(const erow* row, int old){
+    return !row->cold && row->seen <= old && row->size > 0 && !row->chunks && row->render
+        && row->hl && !line_is_shared(row->chars);
+}
+
+// freeze rows [from, to), which all fit
+static void cold_freeze(int from, int to){
+    int raw = 0;
+    for(int i = from; i < to; ++i){
+        erow* row = &state.row[i];
+        raw += row->size + 2 * row->rsize + sizeof(struct row_pos) * row->col_count;
+    }
+    char* buf = cold_grow(&cold.scratch, &cold.scratch_cap, raw + lz_bound(raw));
+    char* p = buf;
+    for(int i = from; i < to; ++i){
+        erow* row = &state.row[i];
+        memcpy(p, row->chars, row->size);
+        p += row->size;
+        memcpy(p, row->render, row->rsize);
+        p += row->rsize;
+        memcpy(p, row->hl, row->rsize);
+        p += row->rsize;
+        if(row->col_count > 0) memcpy(p, row->cols, sizeof(struct row_pos) * row->col_count);
+        p += sizeof(struct row_pos) * row->col_count;
+    }
+    int packed = lz_compress(buf, raw, buf + raw);
+    if(packed > raw - raw / 4){
+        // doesn't compress, leave the rows be for another COLD_AFTER
+        for(int i = from; i < to; ++i) state.row[i].seen = cold_now();
+        return;
+    }
+    struct cold_block* b = mem_alloc(MEM_COLD, sizeof(struct cold_block) + packed);
+    if(b == NULL) error("malloc");
+    b->refs = to - from;
+    b->size = raw;
+    b->packed = packed;
+    memcpy(b->data, buf + raw, packed);
+
+    int at = 0;
+    for(int i = from; i < to; ++i){
+        erow* row = &state.row[i];
+        int rsize = row->rsize, col_count = row->col_count;
+        editor_drop_row_cache(row);
+        line_release(row->chars);
+        row->chars = NULL;
+        row->rsize = rsize;
+        row->col_count = col_count;
+        row->cold = b;
+        row->cold_at = at;
+        at += row->size + 2 * rsize + sizeof(struct row_pos) * col_count;
+    }
+    cold.frozen += to - from;
+}
+
+// ms until the sweep wants to run, 0 if it does now, -1 if there is nothing for it to do
+int editor_cold_timeout(){
+    if(state.headless || cold.settled || state.num_rows <= COLD_BLOCK || editor_pager_active()
+       || editor_save_in_progress()) return -1;
+    long long at = cold.last_key + COLD_IDLE_MS * 1000000LL;
+    if(cold.next == 0 && cold.pass_start + COLD_AFTER * 1000000000LL > at){
+        at = cold.pass_start + COLD_AFTER * 1000000000LL; // rows seen during the last pass need time to age
+    }
+    long long now = editor_perf_now();
+    return at <= now ? 0 : (at - now) / 1000000 + 1;
+}
+
+// Freeze what can be frozen for about COLD_STEP_MS, carrying on where the last step stopped.
+// editor_wait_for_input calls it when editor_cold_timeout says so and no key is waiting.
+void editor_cold_sweep(){
+    long long start = editor_perf_now();
+    if(cold.next == 0) cold.pass_start = start;
+    int old = start / 1000000000LL - COLD_AFTER;
+    int near_lo = state.cy - COLD_NEAR, near_hi = state.cy + COLD_NEAR;
+    int i = cold.next;
+    while(i < state.num_rows && editor_perf_now() - start < COLD_STEP_MS * 1000000LL){
+        if(i >= near_lo && i <= near_hi){
+            i = near_hi + 1;
+            continue;
+        }
+        int end = i;
+        while(end < state.num_rows && end - i < COLD_BLOCK && (end < near_lo || end > near_hi)
+              && cold_row_fits(&state.row[end], old)) ++end;
+        if(end - i >= COLD_BLOCK / 4) cold_freeze(i, end); // a few rows alone aren't worth a block
+        i = end > i ? end : i + 1;
+    }
+    cold.next = i < state.num_rows ? i : 0;
+    if(cold.next == 0){
+        // rows that were seen before the key that started this pass are as old as they get
+        if(cold.pass_start - cold.last_key > (COLD_AFTER + 1) * 1000000000LL) cold.settled = 1;
+        // hand back what the freed rows left behind, the point of all this is a smaller process
+        malloc_trim(0);
+    }
+}
+
+void editor_free_cold(){
+    free(cold.unpacked);
+    free(cold.scratch);
+    cold.unpacked = cold.scratch = NULL;
+    cold.unpacked_cap = cold.scratch_cap = 0;
+    cold.open = NULL;
+}
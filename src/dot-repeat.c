@@ -0,0 +1,137 @@
+
+#include "editor.h"
+
+/* ------------------------------------ . repeat ------------------------------------ */
+// The last change is kept as the keys of its normal mode command (without the count) followed by
+// whatever was typed in insert mode afterwards, e.g. "cw" + "hello". . runs the command again,
+// feeding it the rest of its keys from memory, and then puts the inserted text back with one span
+// insert per run of plain characters instead of one editor_insert_char per key.
+
+struct change {
+    char* keys;
+    int len;
+    int cap;
+    int cmd_len; // keys[0..cmd_len) is the command, the rest was typed in insert mode
+    int count;
+};
+
+enum { CAPTURE_NONE = 0, CAPTURE_COMMAND, CAPTURE_INSERT };
+
+static struct change last, pending;
+static int capturing = CAPTURE_NONE;
+static int dirty_before;
+static int repeating; // set while . runs, so it doesn't overwrite what it is repeating
+
+static const char* feed; // rest of the command keys while . runs it
+static int feed_len;
+
+static void change_append(struct change* ch, int c){
+    if(ch->len == ch->cap){
+        ch->cap = ch->cap ? ch->cap * 2 : 32;
+        ch->keys = realloc(ch->keys, ch->cap);
+    }
+    ch->keys[ch->len++] = c;
+}
+
+// start capturing a normal mode command, c is its first key
+void editor_change_begin(int c, int count){
+    if(repeating) return;
+    pending.len = 0;
+    pending.count = count;
+    change_append(&pending, c);
+    capturing = CAPTURE_COMMAND;
+    dirty_before = state.dirty;
+}
+
+static void change_keep(){
+    struct change tmp = last;
+    last = pending;
+    pending = tmp;
+    capturing = CAPTURE_NONE;
+}
+
+// the normal mode commands that edit text, the only ones . repeats: not :w, :e!, ^W or undo,
+// which can change the buffer too
+static int change_command(int c){
+    return c && strchr("cdDxrpPoOiaIA", c) != NULL;
+}
+
+// The command is done: keep it if it changed the buffer, or keep capturing if it left us in
+// insert mode.
+void editor_change_end(int c){
+    if(repeating || capturing != CAPTURE_COMMAND) return;
+    if(!change_command(c)){
+        capturing = CAPTURE_NONE;
+        return;
+    }
+    if(state.mode == INSERT_MODE){
+        pending.cmd_len = pending.len;
+        capturing = CAPTURE_INSERT;
+        return;
+    }
+    if(state.dirty != dirty_before){
+        pending.cmd_len = pending.len;
+        change_keep();
+        return;
+    }
+    capturing = CAPTURE_NONE;
+}
+
+// <esc> left insert mode, the text typed since the command belongs to the change
+void editor_change_insert_done(){
+    if(capturing != CAPTURE_INSERT) return;
+    --pending.len; // the <esc> itself
+    change_keep();
+}
+
+// called by editor_read_key for every key, typed or replayed
+void editor_change_record_key(int c){
+    if(capturing && !repeating) change_append(&pending, c);
+}
+
+int editor_change_next_key(){
+    if(feed_len <= 0) return -1;
+    --feed_len;
+    return (unsigned char) *feed++;
+}
+
+// replay what was typed in insert mode, plain text goes in one span at a time
+static void change_insert_keys(const char* keys, int len){
+    int i = 0;
+    while(i < len){
+        int j = i;
+        while(j < len && (keys[j] == '\t' || !iscntrl((unsigned char) keys[j]))) ++j;
+        editor_insert_text(keys + i, j - i);
+        if(j < len) read_insert_mode((unsigned char) keys[j++]); // <enter>, backspace
+        i = j;
+    }
+}
+
+// . and N. (the count replaces the one the change was made with)
+void editor_repeat_change(int count){
+    if(last.len == 0){
+        editor_set_status_msg("No previous change");
+        return;
+    }
+    repeating = 1;
+    int grouped = editor_undo_group_begin(); // cw + text is undone in one step, like the original
+
+    feed = last.keys + 1;
+    feed_len = last.cmd_len - 1;
+    editor_normal_command((unsigned char) last.keys[0], count ? count : last.count);
+    feed_len = 0; // in case the command read fewer keys this time
+
+    if(state.mode == INSERT_MODE){
+        change_insert_keys(last.keys + last.cmd_len, last.len - last.cmd_len);
+        state.mode = NORMAL_MODE;
+    }
+
+    if(grouped) editor_undo_group_end();
+    repeating = 0;
+}
+
+void editor_free_changes(){
+    free(last.keys);
+    free(pending.keys);
+    last = pending = (struct change){0};
+}
@@ -11,14 +11,26 @@ void init_editor(){
     state.rx = 0;
     state.rowoff = 0;
     state.coloff = 0;
+    state.segoff = 0;
+    state.screen_top = 0;
+    state.screen_left = 0;
     state.num_rows = 0;
     state.row = NULL;
+    state.row_cap = 0;
     state.undoing = 0;
+    state.undo_group = 0;
     state.dirty = 0;
+    state.changes = 0;
     state.filename = NULL;
     state.statusmsg[0] = '\0';
     state.statusmsg_time = 0;
-    if(get_window_size(&state.screen_rows, &state.screen_cols) == -1) error("get_window_size");
+    if(state.headless){
+        // nothing is drawn, but scrolling and the page motions still want a screen size
+        state.screen_rows = 24;
+        state.screen_cols = 80;
+    }else if(get_window_size(&state.screen_rows, &state.screen_cols) == -1){
+        error("get_window_size");
+    }
     state.screen_rows -= 2; // room for status bar and msg
 
     editor_init_undo_redo_stacks();
@@ -26,14 +38,24 @@ void init_editor(){
 
 void end_editor(){
     //fprintf(stderr, "Freeing all memory\n");
-    for(int i=0;i<state.num_rows;++i){
-        editor_free_row(state.row+i);
-    }
+    editor_save_finish(); // don't exit halfway through writing the file
+    editor_free_windows();
+    editor_free_watches();
+    editor_free_buffers(); // the ones in the background, the current one is in state
+    editor_journal_close(1); // quitting on purpose, nothing to recover
+    editor_free_registers();
+    editor_free_macros();
+    editor_free_changes();
+    editor_free_pager();
+    editor_free_rows();
+    editor_free_cold();
+    editor_free_wrap();
     if(state.filename != NULL){
         free(state.filename);
         state.filename = NULL;
     }
     editor_free_stack(&state.undo);
+    editor_free_stack(&state.redo);
 }
 
 
@@ -47,7 +69,20 @@ void editor_insert_char(char c){
     if(!state.undoing) editor_push_to_stack(&state.undo, &state.row[state.cy], MODIFY_ROW);
     editor_row_insert_char(&state.row[state.cy], state.cx, c);
     ++state.cx;
-    state.dirty = 1;
+    ++state.dirty;
+}
+
+// inserts len characters at the cursor as one edit, used when a change is repeated with .
+void editor_insert_text(const char* s, int len){
+    if(len <= 0) return;
+    if(state.cy == state.num_rows){
+        editor_insert_row(state.num_rows, "", 0);
+    }
+
+    if(!state.undoing) editor_push_to_stack(&state.undo, &state.row[state.cy], MODIFY_ROW);
+    editor_row_insert_span(&state.row[state.cy], state.cx, s, len);
+    state.cx += len;
+    ++state.dirty;
 }
 
 // handles newline characters by creating a new row, possibly splitting the current row.
@@ -65,13 +100,11 @@ void editor_insert_newline(){
         editor_insert_row(state.cy + 1, &row->chars[state.cx], row->size - state.cx);
         row = &state.row[state.cy];     // This memory location has been "realloced" so we have to redefine the ptr
                                         // because it may have moved the memory entirely
-        row->size = state.cx; // the new top portion will have size of cx, where it breaks
-        row->chars[row->size] = '\0';
-        editor_update_row(row);
+        editor_row_truncate(row, state.cx); // the new top portion will have size of cx, where it breaks
     }
     ++state.cy; // move to lower row, note that the size and content has been handled from editor_insert_row(..)
     state.cx = 0; // goto start of the new line
-    state.dirty = 1;
+    ++state.dirty;
 }
 
 // Adjusts cursor positions, delegates to row deletion functions
@@ -82,8 +115,9 @@ void editor_delete_char(){
         // technically the cursor deletes the character BEHIND the currently highlighted one
         // If we used 'x' in vim, though, it would delete the CURRENT character at cx.
         if(!state.undoing) editor_push_to_stack(&state.undo, curr, MODIFY_ROW);
-        editor_row_delete_char(curr, state.cx-1);
-        --state.cx;
+        int prev = utf8_prev(curr->chars, state.cx); // all the bytes of a multibyte character
+        editor_row_delete_span(curr, prev, state.cx - prev);
+        state.cx = prev;
     }else if(state.cy > 0){
         // then we are at the start of the line, and not at the beginning of file
 
@@ -102,20 +136,62 @@ void editor_delete_char(){
 
         --state.cy;
     }
-    state.dirty = 1;
+    ++state.dirty;
 }
 
 
-void editor_delete_word() {
+// Deletes len characters from the cursor onwards as one edit: one move, one re-render, one undo entry.
+void editor_delete_span(int column, int len){
+    if (state.cy >= state.num_rows) return;
+    erow* row = &state.row[state.cy];
+    if (column < 0 || column >= row->size || len <= 0) return;
+    if(!state.undoing) editor_push_to_stack(&state.undo, row, MODIFY_ROW);
+    editor_row_delete_span(row, column, len);
+    ++state.dirty;
+}
+
+// dw, 3dw: find where the count-th word ends, then delete up to there in one span
+void editor_delete_words(int count) {
+    if (state.cy >= state.num_rows) return;
     char* p = state.row[state.cy].chars;
     int i = state.cx;
     int size = state.row[state.cy].size;
-    while (i < size && !is_separator(p[i]) && !isspace(p[i])) ++i;
+    int w;
+    for (w = 0; w < count && i < size; ++w) {
+        if (w > 0) while (i < size && (is_separator(p[i]) || isspace(p[i]))) ++i;
+        while (i < size && !is_separator(p[i]) && !isspace(p[i])) ++i;
+    }
 
-    int num_characters = i-state.cx;
-    state.cx = i;
+    editor_delete_span(state.cx, i - state.cx);
+}
 
-    for(i=0; i<num_characters; ++i){
-        editor_delete_char();
+// shift rows [row_num, row_num+n) one tab stop right (direction > 0) or left, as one undo entry
+void editor_indent_rows(int row_num, int n, int direction){
+    if(row_num < 0 || n <= 0 || row_num + n > state.num_rows) return;
+    if(!state.undoing) editor_push_row_copies_to_stack(&state.undo, row_num, n, MODIFY_ROWS);
+    int i;
+    for(i=row_num; i<row_num+n; ++i){
+        erow* row = &state.row[i];
+        if(direction > 0){
+            if(row->size > 0) editor_row_insert_span(row, 0, "\t", 1); // leave empty lines alone
+        }else{
+            // a leading tab, or up to a tab stop worth of spaces
+            int width = 0;
+            if(row->size > 0 && row->chars[0] == '\t'){
+                width = 1;
+            }else{
+                while(width < TAB_STOP && width < row->size && row->chars[width] == ' ') ++width;
+            }
+            editor_row_delete_span(row, 0, width);
+        }
     }
+    ++state.dirty;
+}
+
+// delete whole lines as an operator: they go into the selected register first (shared, not copied)
+void editor_delete_lines(int row_num, int n){
+    if(row_num < 0 || row_num >= state.num_rows || n <= 0) return;
+    if(n > state.num_rows - row_num) n = state.num_rows - row_num;
+    editor_register_store(row_num, n);
+    editor_delete_rows(row_num, n);
 }
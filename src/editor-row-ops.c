@@ -3,55 +3,69 @@
 
 /* ------------------------------------ row operations ------------------------------------ */
 // Example: moving cursor forward TAB_STOP spaces when placed in the middle of a tab.
+// Screen column of the character at cx, going from the nearest checkpoint (see utf8.c).
 int editor_row_cx_to_rx(erow* row, int cx){
-    int rx = 0;
-    int i;
-    for(i=0; i<cx; ++i){
-        // find how many spaces until the end of the current tabstop, even if we are in the middle
-        if(row->chars[i] == '\t')
-            rx += (TAB_STOP - 1) - (rx % TAB_STOP);
-        ++rx;
-    }
-    return rx;
+    return editor_row_pos(row, POS_CX, cx).rx;
 }
 
-// Used for locating the cx when we have the render x-position during searching.
+// Used for locating the cx when we have the screen column, e.g. moving through wrapped lines.
 int editor_row_rx_to_cx(erow* row, int rx){
-    int curr_rx = 0;
-    int cx;
-    for(cx = 0; cx < row->size; ++cx){
-        if(row->chars[cx] == '\t'){
-            curr_rx += (TAB_STOP - 1) - (curr_rx % TAB_STOP);
-        }
-        ++curr_rx;
-        if(curr_rx > rx) return cx;
-    }
-    return cx; // just in case the parameters were out of bounds
+    return editor_row_pos(row, POS_RX, rx).cx;
 }
 
 // move row->chars into the "render" characters, adjusting for tabs
-void editor_update_row(erow* row){
-    int tabs = 0;
-    int i, j;
-    for (j = 0; j < row->size; ++j){
-        if (row->chars[j] == '\t') ++tabs;
+void editor_update_render(erow* row){
+    line_cache_detach(row); // an identical row's render isn't ours to free, see line-storage.c
+    if(editor_row_wants_chunks(row)){
+        // a very long row renders into chunks instead, see long-rows.c
+        mem_free(MEM_RENDER, row->render, row->rsize + 1);
+        mem_free(MEM_HL, row->hl, row->rsize);
+        mem_free(MEM_RENDER, row->cols, sizeof(struct row_pos) * row->col_count);
+        row->render = NULL;
+        row->hl = NULL;
+        row->cols = NULL;
+        row->col_count = 0;
+        editor_chunk_row(row);
+        row->wrap_cols = 0;
+        return;
     }
-    free(row->render);
-    // tabs will take up a maximum of 8 characters
-    // row->size already counts 1, so do tabs*7
-    row->render = malloc(row->size + tabs*(TAB_STOP-1) + 1);
-
-    for(i=0, j=0;j<row->size;++j){
-        if (row->chars[j] == '\t') {
-            row->render[i++] = ' ';
-            while (i % TAB_STOP != 0) row->render[i++] = ' ';
-        } else {
-            row->render[i++] = row->chars[j];
-        }
+    if(row->chunks) editor_unchunk_row(row); // shrunk back under the limit
+    if(line_cache_adopt(row)){
+        row->wrap_cols = 0;
+        return;
     }
-    row->render[i] = '\0';
-    row->rsize = i;
 
+    // also refreshes the column checkpoints, and says how long render will be
+    int width = editor_update_columns(row);
+    if (row->render) mem_free(MEM_RENDER, row->render, row->rsize + 1);
+    // hl is always rsize long (see editor_highlight_row), so it follows the new width
+    if (row->hl && width != row->rsize) row->hl = mem_realloc(MEM_HL, row->hl, row->rsize, width);
+    row->render = mem_alloc(MEM_RENDER, width + 1);
+    if (row->render == NULL) error("malloc");
+
+    struct row_pos start = { 0, 0, 0 };
+    editor_render_span(row, start, row->size, row->render);
+    row->render[width] = '\0';
+    row->rsize = width;
+    row->wrap_cols = 0; // wrap points are recomputed when the row is next drawn wrapped
+}
+
+// render the size bytes of row->chars from start into out, which gets the render from start.bx on
+void editor_render_span(const erow* row, struct row_pos start, int size, char* out){
+    // tabs stop at screen columns, so a tab after a wide character is narrower
+    struct row_pos p = start;
+    while (p.cx < start.cx + size) {
+        struct row_pos next = p;
+        editor_row_step(row, &next);
+        if (row->chars[p.cx] == '\t') memset(out + p.bx - start.bx, ' ', next.bx - p.bx);
+        else memcpy(out + p.bx - start.bx, row->chars + p.cx, next.cx - p.cx);
+        p = next;
+    }
+}
+
+void editor_update_row(erow* row){
+    ++state.changes;
+    editor_update_render(row);
     // after updating the render characters, update the syntax that is based on render
     editor_update_syntax(row);
 }
@@ -60,11 +74,10 @@ void editor_update_row(erow* row){
 void editor_insert_row(int row_num, char* line, size_t len){
     if(row_num < 0 || row_num > state.num_rows) return;
 
-    // allocate space for a new row
-    state.row = realloc(state.row, sizeof(erow) * (state.num_rows + 1));
+    editor_reserve_rows(state.num_rows + 1);
 
     int i;
-    // note that state.row now has +1 allocated, so i is not out of bounds
+    // note that state.row now has room for +1, so i is not out of bounds
     for(i=state.num_rows; i > row_num; --i){
         state.row[i] = state.row[i-1];
         ++state.row[i].idx; // adjust index
@@ -73,92 +86,284 @@ void editor_insert_row(int row_num, char* line, size_t len){
     state.row[row_num].idx = row_num;
 
     state.row[row_num].size = len;
-    state.row[row_num].chars = malloc(len + 1); // room for null char
-    memcpy(state.row[row_num].chars, line, len);
-    state.row[row_num].chars[len] = '\0';
+    state.row[row_num].chars = line_intern(line, len); // shared with identical rows, see line-storage.c
 
     state.row[row_num].rsize = 0;
     state.row[row_num].render = NULL;
     state.row[row_num].hl = NULL;
+    state.row[row_num].cols = NULL;
+    state.row[row_num].col_count = 0;
+    state.row[row_num].wrap = NULL;
+    state.row[row_num].wrap_count = 0;
+    state.row[row_num].chunks = NULL;
+    state.row[row_num].num_chunks = 0;
+    state.row[row_num].cold = NULL;
+    state.row[row_num].seen = 0;
     state.row[row_num].hl_open_comment = 0;
     editor_update_row(&state.row[row_num]); // update the render characters in state
 
     ++state.num_rows;
+    editor_journal_insert_row(row_num, line, len);
+}
+
+// make room for n rows in state.row. The table grows geometrically, so inserting rows one at a
+// time doesn't move the whole table every time.
+void editor_reserve_rows(int n){
+    if(n <= state.row_cap) return;
+    int cap = state.row_cap * 2;
+    if(cap < n) cap = n;
+    if(cap < 16) cap = 16;
+    state.row = mem_realloc(MEM_ROWS, state.row, sizeof(erow) * state.row_cap, sizeof(erow) * cap);
+    if(state.row == NULL) error("realloc");
+    state.row_cap = cap;
 }
 
 // freeing memory of a given row, when the row is deleted
 void editor_free_row(erow* row){
     if(row){
-        if(row->render) free(row->render);
-        if(row->chars) free(row->chars);
-        if(row->hl) free(row->hl);
+        editor_cold_forget(row); // a frozen row has nothing else to free, see cold-rows.c
+        editor_drop_row_cache(row);
+        line_release(row->chars); // payload may still be used by undo or a save in progress
     }
 }
 
+// free everything built from row->chars (render, hl, checkpoints, wrap points, chunks), the
+// text stays. editor_update_render and a highlight bring it back.
+void editor_drop_row_cache(erow* row){
+    line_cache_detach(row);
+    mem_free(MEM_RENDER, row->render, row->rsize + 1);
+    mem_free(MEM_HL, row->hl, row->rsize);
+    mem_free(MEM_RENDER, row->cols, sizeof(struct row_pos) * row->col_count);
+    mem_free(MEM_WRAP, row->wrap, sizeof(struct row_pos) * row->wrap_count);
+    editor_unchunk_row(row);
+    row->render = NULL;
+    row->hl = NULL;
+    row->cols = NULL;
+    row->col_count = 0;
+    row->wrap = NULL;
+    row->wrap_count = 0;
+    row->wrap_cols = 0;
+    row->rsize = 0;
+}
+
+static void editor_retag(int tag, int undo, long n){
+    if(undo) mem_retag(tag, MEM_UNDO, n);
+    else mem_retag(MEM_UNDO, tag, n);
+}
+
+// While a row sits in an undo entry (see undo-redo.c) the render, hl, checkpoints, wrap points and
+// chunks it has of its own count as undo in :mem, undo is 0 when it goes back into the table.
+// A render and hl shared through the line pool belong to the payload and are left alone.
+void editor_retag_row_cache(erow* row, int undo){
+    if(!line_cache_shared(row)){
+        if(row->render) editor_retag(MEM_RENDER, undo, row->rsize + 1);
+        if(row->hl) editor_retag(MEM_HL, undo, row->rsize);
+        editor_retag(MEM_RENDER, undo, sizeof(struct row_pos) * row->col_count);
+    }
+    editor_retag(MEM_WRAP, undo, sizeof(struct row_pos) * row->wrap_count);
+    for(int k = 0; k < row->num_chunks; ++k){
+        struct row_chunk* c = &row->chunks[k];
+        int len = c->end.bx - c->start.bx;
+        editor_retag(MEM_RENDER, undo, len + 1 + sizeof(struct row_pos) * c->col_count);
+        editor_retag(MEM_HL, undo, len);
+    }
+    if(row->chunks) editor_retag(MEM_RENDER, undo, sizeof(struct row_chunk) * row->num_chunks);
+}
+
+// free every row and the row table itself
+void editor_free_rows(){
+    for(int i = 0; i < state.num_rows; ++i) editor_free_row(&state.row[i]);
+    mem_free(MEM_ROWS, state.row, sizeof(erow) * state.row_cap);
+    state.row = NULL;
+    state.row_cap = 0;
+    state.num_rows = 0;
+}
+
 // when backspace on an empty row
 void editor_delete_row(int row_num){
-    if (row_num < 0 || row_num >= state.num_rows) return;
-    if(!state.undoing) editor_push_to_stack(&state.undo, &state.row[state.cy], DELETE_ROW);
-    // free the memory
-    editor_free_row(&state.row[row_num]);
+    editor_delete_rows(row_num, 1);
+}
+
+// Remove rows [row_num, row_num+n) with a single move of the rows below them. The removed rows
+// are handed to one undo entry as they are, so undoing puts them back without re-rendering.
+void editor_delete_rows(int row_num, int n){
+    if (row_num < 0 || row_num >= state.num_rows || n <= 0) return;
+    if (n > state.num_rows - row_num) n = state.num_rows - row_num;
 
-    // remove the row from the array
     int i;
-    for(i=row_num; i<state.num_rows-1; ++i){
-        // all attributes should be copied,
-        // ptrs will be copied and it should be fine
-        state.row[i] = state.row[i+1];
-        --state.row[i].idx; // update index of the remaining rows
+    if(!state.undoing){
+        editor_push_rows_to_stack(&state.undo, row_num, &state.row[row_num], n, DELETE_ROW);
+    }else{
+        // free the memory
+        for(i=0; i<n; ++i) editor_free_row(&state.row[row_num + i]);
     }
-    // clear the ending row
-    state.row[i].size = 0;
-    state.row[i].rsize = 0;
-    state.row[i].chars = NULL;
-    state.row[i].render = NULL;
-    --state.num_rows;
-    state.dirty = 1;
+    editor_remove_rows(row_num, n);
 }
 
-// simply inserts character into char array. Doesn't have to worry about where the cursor is
-void editor_row_insert_char(erow* row, int column, char c){
-    if(column < 0 || column > row->size) column = row->size;
-    // add room for new character and null-byte
-    row->chars = realloc(row->chars, row->size + 2);
+// Take rows [row_num, row_num+n) out of the table with one move, without freeing them: the caller
+// has already freed them or moved them somewhere else (an undo or redo entry).
+void editor_remove_rows(int row_num, int n){
+    editor_journal_delete_rows(row_num, n);
 
-    ++row->size;
+    // remove the rows from the array
+    memmove(&state.row[row_num], &state.row[row_num + n], sizeof(erow) * (state.num_rows - row_num - n));
+    state.num_rows -= n;
     int i;
-    // ripple through and carry all chars to the end
-    for(i=column; i<row->size; ++i){
-        char temp = row->chars[i];
-        row->chars[i] = c;
-        c = temp;
+    for(i=row_num; i<state.num_rows; ++i){
+        state.row[i].idx = i; // update index of the remaining rows
     }
-    row->chars[i] = '\0';
-    editor_update_row(row);
+
+    // the row now below the seam may have been highlighted inside a comment that was just removed
+    if(row_num < state.num_rows) editor_update_syntax(&state.row[row_num]);
+    ++state.dirty;
+    ++state.changes;
 }
 
-// backspace on a non-empty line: append the contents of current line to the end of previous line
-void editor_row_append_string(erow* row, char* s, size_t len){
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
+// Move rows [row_num, row_num+n) by delta rows (negative is up) with one rotate of the row table:
+// the rows being jumped over are set aside, the block moves in one go and they fill the gap.
+void editor_move_rows(int row_num, int n, int delta){
+    if(n <= 0 || delta == 0 || row_num + delta < 0 || row_num + n + delta > state.num_rows) return;
+    int k = delta > 0 ? delta : -delta;
+    int lo = delta > 0 ? row_num : row_num - k; // the rows [lo, lo+n+k) change places
+    erow* jumped = mem_alloc(MEM_ROWS, sizeof(erow) * k);
+    if(jumped == NULL) error("malloc");
+    if(delta > 0){
+        memcpy(jumped, &state.row[row_num + n], sizeof(erow) * k);
+        memmove(&state.row[row_num + k], &state.row[row_num], sizeof(erow) * n);
+        memcpy(&state.row[lo], jumped, sizeof(erow) * k);
+    }else{
+        memcpy(jumped, &state.row[lo], sizeof(erow) * k);
+        memmove(&state.row[lo], &state.row[row_num], sizeof(erow) * n);
+        memcpy(&state.row[lo + n], jumped, sizeof(erow) * k);
+    }
+    mem_free(MEM_ROWS, jumped, sizeof(erow) * k);
+
+    int i;
+    for(i=lo; i<lo+n+k; ++i){
+        state.row[i].idx = i;
+    }
+    editor_journal_move_rows(row_num, n, delta);
+    if(!state.undoing){
+        editor_push_rows_to_stack(&state.undo, row_num + delta, NULL, n, MOVE_ROWS)->moved_by = delta;
+    }
+
+    // rows keep their highlighting, only the three seams can have a different comment state above them
+    editor_update_syntax(&state.row[lo]);
+    editor_update_syntax(&state.row[delta > 0 ? lo + k : lo + n]);
+    if(lo + n + k < state.num_rows) editor_update_syntax(&state.row[lo + n + k]);
+    ++state.dirty;
+    ++state.changes;
+}
+
+// Put already built rows back at row_num with a single move (used by undo), taking ownership of them.
+void editor_insert_rows(int row_num, erow* rows, int n){
+    if(row_num < 0 || row_num > state.num_rows || n <= 0) return;
+    editor_reserve_rows(state.num_rows + n);
+    memmove(&state.row[row_num + n], &state.row[row_num], sizeof(erow) * (state.num_rows - row_num));
+    memcpy(&state.row[row_num], rows, sizeof(erow) * n);
+    state.num_rows += n;
+
+    int i;
+    for(i=row_num; i<state.num_rows; ++i){
+        state.row[i].idx = i;
+    }
+    for(i=row_num; i<row_num + n; ++i){
+        editor_journal_insert_row(i, state.row[i].chars, state.row[i].size);
+    }
+
+    // fix up both seams, highlighting only cascades further if the comment state changed
+    editor_update_syntax(&state.row[row_num]);
+    if(row_num + n < state.num_rows) editor_update_syntax(&state.row[row_num + n]);
+    ++state.dirty;
+    ++state.changes;
+}
+
+// insert len bytes of s at column with one move of the tail and one re-render
+void editor_row_insert_span(erow* row, int column, const char* s, int len){
+    if(column < 0 || column > row->size) column = row->size;
+    if(len <= 0) return;
+    editor_journal_insert_text(row, column, s, len);
+    // add room for the new characters and null-byte
+    line_cache_detach(row); // before the text stops matching the shared render
+    row->chars = line_writable(row->chars, row->size, row->size + len + 1);
+
+    memmove(&row->chars[column + len], &row->chars[column], row->size - column);
+    memcpy(&row->chars[column], s, len);
     row->size += len;
     row->chars[row->size] = '\0';
-    editor_update_row(row);
+    editor_update_row_span(row, column, 0, len);
+}
+
+// remove len characters starting at column with one move of the tail and one re-render
+void editor_row_delete_span(erow* row, int column, int len){
+    if(column < 0 || column >= row->size || len <= 0) return;
+    if(len > row->size - column) len = row->size - column;
+    editor_journal_delete_text(row, column, len);
+    line_cache_detach(row); // before the text stops matching the shared render
+    row->chars = line_writable(row->chars, row->size, row->size + 1);
+
+    memmove(&row->chars[column], &row->chars[column + len], row->size - column - len);
+    row->size -= len;
+    row->chars[row->size] = '\0';
+    editor_update_row_span(row, column, len, 0);
+}
+
+// simply inserts character into char array. Doesn't have to worry about where the cursor is
+void editor_row_insert_char(erow* row, int column, char c){
+    editor_row_insert_span(row, column, &c, 1);
+}
+
+// backspace on a non-empty line: append the contents of current line to the end of previous line
+void editor_row_append_string(erow* row, char* s, size_t len){
+    editor_row_insert_span(row, row->size, s, len);
 }
 
 // simply removes character from char array in row
 void editor_row_delete_char(erow* row, int column){
-    if(column < 0 || column  >= row->size) return;
+    editor_row_delete_span(row, column, 1);
+}
 
+// cut the row off after its first len characters
+void editor_row_truncate(erow* row, int len){
+    if(len < 0 || len >= row->size) return;
+    editor_journal_truncate_row(row, len);
+    line_cache_detach(row); // before the text stops matching the shared render
+    row->chars = line_writable(row->chars, row->size, row->size + 1);
+    int removed = row->size - len;
+    row->size = len;
+    row->chars[len] = '\0';
+    editor_update_row_span(row, len, removed, 0);
+}
+
+// Insert rows that share the payloads of lines (e.g. a register) at row_num. The rows are rendered
+// and highlighted in one pass and placed with one move, and the whole block is one undo entry.
+void editor_insert_lines(int row_num, struct line_slice* lines, int n){
+    if(row_num < 0 || row_num > state.num_rows || n <= 0) return;
+    erow* rows = mem_alloc(MEM_ROWS, sizeof(erow) * n);
+    if(rows == NULL) error("malloc");
+    int in_comment = row_num > 0 && state.row[row_num - 1].hl_open_comment;
     int i;
-    // ripple through and carry all chars after column back one space
-    for(i=column; i<row->size-1; ++i){
-        row->chars[i] = row->chars[i+1];
+    for(i=0; i<n; ++i){
+        erow* row = &rows[i];
+        row->idx = row_num + i;
+        row->size = lines[i].size;
+        row->chars = line_share(lines[i].chars);
+        row->rsize = 0;
+        row->render = NULL;
+        row->hl = NULL;
+        row->cols = NULL;
+        row->col_count = 0;
+        row->wrap = NULL;
+        row->wrap_count = 0;
+        row->chunks = NULL;
+        row->num_chunks = 0;
+        row->cold = NULL;
+        row->seen = 0;
+        editor_update_render(row);
+        in_comment = editor_highlight_row(row, in_comment);
+        row->hl_open_comment = in_comment;
     }
-    // get rid of final leftover char with null byte
-    row->chars[i] = '\0';
-    --row->size;
-    editor_update_row(row);
+    if(!state.undoing) editor_push_rows_to_stack(&state.undo, row_num, NULL, n, INSERT_ROWS);
+    editor_insert_rows(row_num, rows, n);
+    mem_free(MEM_ROWS, rows, sizeof(erow) * n);
 }
-
-
@@ -13,6 +13,11 @@
 #include <fcntl.h> /* for saving to disk */
 #include <time.h> /* for saving to disk */
 #include <errno.h> /* errno, EAGAIN */
+#include <stdint.h> /* uint8_t */
+#include <pthread.h> /* background save writer */
+#include <poll.h> /* waiting on input while a save runs */
+#include <sys/stat.h> /* swap file checks */
+#include <sys/wait.h> /* batch mode workers */
 
 /* ------------------------------------ defines ------------------------------------ */
 // for 'q', ascii value is 113, and ctrl-q is 17
@@ -61,6 +66,36 @@ enum UNDO_ACTION{
     MERGE_ROW_UP,
     SPLIT_ROW_DOWN,
     NEWLINE_ABOVE,
+    MODIFY_ROWS, // block holds text copies of rows [row.idx, row.idx + block_rows)
+    MOVE_ROWS,   // rows [row.idx, row.idx + block_rows) were moved by moved_by rows
+    INSERT_ROWS, // rows [row.idx, row.idx + block_rows) were put there, on redo block holds them
+};
+
+// what the profiler times, see profiling.c
+enum perf_phase{
+    PERF_INPUT = 0,
+    PERF_SYNTAX,
+    PERF_DRAW,
+    PERF_WRITE,
+    PERF_NUM_PHASES
+};
+
+// what the allocations are counted under, see memory-accounting.c
+enum mem_tag{
+    MEM_LINES = 0, // line payloads (chars)
+    MEM_ROWS,      // the state.row table
+    MEM_RENDER,
+    MEM_HL,
+    MEM_UNDO,
+    MEM_REGISTERS,
+    MEM_SEARCH,
+    MEM_SCREEN,    // the append buffer
+    MEM_SAVE,      // snapshot handed to the save thread
+    MEM_WRAP,      // soft wrap points and the screen line index
+    MEM_PAGER,     // the pager's line index and the rows it keeps out of the window
+    MEM_COLD,      // compressed blocks of rows, see cold-rows.c
+    MEM_POOL,      // the table of shared lines and the render and hl they share
+    MEM_NUM_TAGS
 };
 
 // append buffer: what is written on every refresh
@@ -69,6 +104,36 @@ struct abuf {
     int len;
 };
 
+// where row positions are given, see utf8.c
+enum pos_coord{
+    POS_CX = 0, // byte in chars
+    POS_BX,     // byte in render
+    POS_RX      // screen column
+};
+
+struct row_pos {
+    int cx, bx, rx;
+};
+
+// highlighter state where a piece of a row ends, see editor_highlight_span
+struct hl_state {
+    int in_comment;   // inside /* */
+    int in_string;    // the quote that opened the string, or 0
+    int line_comment; // after //, the rest of the row is a comment
+};
+
+// part of a very long row, with its own render and hl, see long-rows.c
+struct row_chunk {
+    struct row_pos start, end; // where it starts and ends in the row
+    char* render;              // end.bx - start.bx bytes and a '\0'
+    uint8_t* hl;
+    struct row_pos* cols; // checkpoints like erow's, but relative to start
+    int col_count;
+    int tabs;    // if it has any, its render depends on start.rx
+    int hl_done; // hl is up to date for hl_in
+    struct hl_state hl_in, hl_out;
+};
+
 // editor row
 typedef struct erow {
     int idx; // for multi-line comments, knowing what index the row is
@@ -80,12 +145,42 @@ typedef struct erow {
 
     // uint8_t is unsiged char, 1 byte
     uint8_t* hl; // what color to apply to each character in render (from editor_highlight enum)
+
+    // a checkpoint every few dozen bytes, so column lookups don't walk from the start of the row
+    struct row_pos* cols;
+    int col_count;
+    int seen; // when the row was last drawn or edited, in seconds, see cold-rows.c
+
+    // soft wrap: where the 2nd, 3rd, ... screen line of the row start, valid while wrap_cols is
+    // the screen width (0 after an edit), see soft-wrap.c
+    struct row_pos* wrap;
+    int wrap_count;
+    int wrap_cols;
+
+    // rows over a few hundred KB keep render, hl and cols per chunk instead (they are NULL then,
+    // rsize is still the whole render), see long-rows.c
+    struct row_chunk* chunks;
+    int num_chunks;
+
+    // rows nobody has looked at for a while are compressed, see cold-rows.c
+    int cold_at;             // where the row starts in its block once unpacked
+    struct cold_block* cold; // set while frozen, chars, render, hl and cols are NULL then
 } erow;
 
+// a (shared) reference to a row's payload, see line-storage.c
+struct line_slice {
+    char* chars;
+    int size;
+};
+
 typedef struct stack_entry {
     erow row;
+    erow* block;    // DELETE_ROW: the removed rows (row.idx is where they started)
+    int block_rows;
+    int moved_by;
     int cx, cy;
     int action; // enum UNDO_ACTION
+    int group;  // entries with the same non-zero group are undone as one step
 } stack_entry;
 
 struct stack {
@@ -101,14 +196,22 @@ struct state {
     int rx;     // index for render field, used for adjusting for tabs
     int rowoff; // row offset for vertical scrolling
     int coloff; // col offset for horizontal scrolling
+    int segoff; // with wrap on: the screen line of row[rowoff] at the top of the screen
+    int wrap;   // soft wrap long rows instead of scrolling sideways (:wrap)
     int screen_rows;
     int screen_cols;
+    int screen_top, screen_left; // where the text area starts on the terminal, see windows.c
     int num_rows;
     struct stack undo;
     struct stack redo;
     int undoing; // flag to not add anything to undo stack if 1
+    int undo_group; // non-zero while a macro plays, its entries are undone/redone together
+    int visual_anchor; // row where visual-line mode started, the selection runs to cy
     erow* row;
-    int dirty;  // flag for if current file has been modified
+    int row_cap; // rows state.row has room for
+    int dirty;  // number of modifications since the last save, 0 if the file is unmodified
+    long changes; // bumped whenever the rows, their hl or the name and [+] shown for them change, see windows.c
+    int headless; // -s: keys come from a script, there is no terminal to draw to
     char* filename;
     char statusmsg[80]; // 79 characters, 1 null byte
     time_t statusmsg_time;
@@ -126,25 +229,49 @@ void disable_raw();
 void enable_raw();
 int editor_row_cx_to_rx(erow* row, int cx);
 int editor_row_rx_to_cx(erow* row, int rx);
+void editor_update_render(erow* row);
+void editor_render_span(const erow* row, struct row_pos start, int size, char* out);
 void editor_update_row(erow* row);
 void editor_insert_row(int row_num, char* line, size_t len);
+void editor_reserve_rows(int n);
 void editor_free_row(erow* row);
+void editor_drop_row_cache(erow* row);
+void editor_retag_row_cache(erow* row, int undo);
+void editor_free_rows();
 void editor_delete_row(int row_num);
+void editor_delete_rows(int row_num, int n);
+void editor_remove_rows(int row_num, int n);
+void editor_insert_rows(int row_num, erow* rows, int n);
+void editor_move_rows(int row_num, int n, int delta);
+void editor_insert_lines(int row_num, struct line_slice* lines, int n);
+void editor_delete_lines(int row_num, int n);
+void editor_indent_rows(int row_num, int n, int direction);
+void editor_row_insert_span(erow* row, int column, const char* s, int len);
+void editor_row_delete_span(erow* row, int column, int len);
 void editor_row_insert_char(erow* row, int column, char c);
 void editor_row_append_string(erow* row, char* s, size_t len);
 void editor_row_delete_char(erow* row, int column);
+void editor_row_truncate(erow* row, int len);
 void editor_insert_char(char c);
 void editor_insert_newline();
 void editor_delete_char();
-void editor_delete_word();
-//int editor_read_key();
+void editor_delete_words(int count);
+void editor_delete_span(int column, int len);
+void editor_insert_text(const char* s, int len);
+int editor_read_key();
 void init_editor();
 char* editor_rows_to_string(int* buflen);
 void editor_open(char* filename);
+int editor_load_file(const char* filename);
+int editor_load_range(const char* filename, off_t from, off_t to, off_t* tail);
+long editor_count_newlines(const char* p, size_t len);
+int editor_build_rows(erow* rows, const char* buf, size_t len, size_t max_line);
 void editor_save();
+void editor_wait_for_input();
 char* editor_prompt(char* prompt, void (*callback)(char*, int));
 void move_cursor(int c);
 void editor_keypress_handler();
+void editor_process_key(int c);
 void editor_find_callback(char* query, int key);
 void editor_find();
 void ab_append(struct abuf* ab, const char* s, int len);
@@ -156,6 +283,8 @@ void editor_draw_msg_bar(struct abuf* ab);
 void editor_set_status_msg(const char* fmt, ...);
 void editor_refresh_screen();
 
+int editor_highlight_row(erow* row, int in_comment);
+void editor_highlight_span(const char* render, uint8_t* hl, int len, struct hl_state* st);
 void editor_update_syntax(erow* row);
 int editor_syntax_to_color(uint8_t hl);
 int is_separator(int c);
@@ -168,10 +297,16 @@ void editor_delete_to_eol();
 
 // VIM:
 void read_normal_mode(int c);
+void editor_normal_command(int c, int count);
 void read_insert_mode(int c);
 void read_visual_line_mode(int c);
+void editor_visual_range(int* lo, int* hi);
 void read_command_mode();
 
+int read_count(int c, int* next);
+void move_cursor_count(int c, int count);
+void editor_goto_line(int line);
+
 void move_previous_word();
 void move_next_word();
 void move_end_next_word();
@@ -187,11 +322,220 @@ erow editor_copy_row(const erow* src);
 void editor_split_row(int row_idx);
 void editor_merge_row_below(int row_idx);
 void editor_push_to_stack(struct stack* s, erow* row, int action);
+stack_entry* editor_push_rows_to_stack(struct stack* s, int at, erow* rows, int n, int action);
+stack_entry* editor_push_row_copies_to_stack(struct stack* s, int at, int n, int action);
 void editor_undo();
 void editor_redo();
+int editor_undo_group_begin();
+void editor_undo_group_end();
 void editor_init_undo_redo_stacks();
 void editor_free_stack(struct stack* s);
 void editor_free_stack_entry(stack_entry* entry);
+long editor_undo_memory();
+
+// LINES:
+char* line_alloc(int cap);
+char* line_new(const char* s, int len);
+char* line_share(char* chars);
+void line_release(char* chars);
+int line_is_shared(const char* chars);
+void line_undo_hold(char* chars);
+void line_undo_unhold(char* chars);
+char* line_writable(char* chars, int len, int cap);
+char* line_compact(char* chars, int len);
+char* line_intern(const char* s, int len);
+int line_intern_row(erow* row, int in_comment);
+void line_cache_detach(erow* row);
+int line_cache_shared(const erow* row);
+void line_cache_unshare(erow* row);
+int line_cache_adopt(erow* row);
+int line_cache_highlighted(const erow* row, int in_comment);
+void line_cache_donate(erow* row, int in_comment, int out_comment);
+
+// REGISTERS:
+int editor_select_register(int name);
+void editor_register_store(int row_num, int n);
+void editor_yank_rows(int row_num, int n);
+void editor_put(int below, int count);
+void editor_free_registers();
+
+// MACROS:
+void editor_macro_record(int name);
+void editor_macro_stop();
+int editor_macro_recording();
+int editor_macro_replaying();
+int editor_macro_next_key();
+void editor_macro_record_key(int c);
+void editor_macro_play(int name, int count);
+void editor_run_keys(const char* keys, int len);
+void editor_free_macros();
+
+// BATCH MODE:
+int editor_batch(const char* script_path, char** files, int num_files);
+
+// REPEAT:
+void editor_change_begin(int c, int count);
+void editor_change_end(int c);
+void editor_change_insert_done();
+void editor_change_record_key(int c);
+int editor_change_next_key();
+void editor_repeat_change(int count);
+void editor_free_changes();
+
+// PROFILING:
+long long editor_perf_now();
+void editor_perf_record(int phase, long long start, long value);
+void editor_perf_count_rows(int n);
+void editor_perf_count_allocs(long n);
+void editor_perf_end_frame(long bytes);
+int editor_perf_overlay();
+void editor_draw_perf_overlay(struct abuf* ab);
+void editor_perf_command(const char* args);
+void editor_draw_overlay_line(struct abuf* ab, int line, const char* fmt, ...);
+
+// MEMORY:
+void* mem_alloc(int tag, size_t n);
+void* mem_realloc(int tag, void* p, size_t old_n, size_t new_n);
+void mem_free(int tag, void* p, size_t n);
+void mem_retag(int from, int to, long n);
+struct mem_batch {
+    long live[MEM_NUM_TAGS];
+    long allocs;
+};
+void mem_batch_begin(struct mem_batch* b);
+void mem_batch_end();
+void mem_batch_flush(struct mem_batch* b);
+long mem_live(int tag);
+long mem_peak(int tag);
+long mem_total_live();
+long mem_total_peak();
+const char* mem_name(int tag);
+int editor_mem_overlay();
+void editor_draw_mem_overlay(struct abuf* ab);
+void editor_mem_command();
+
+// UTF-8:
+int utf8_decode(const char* s, int len, int* cp);
+int utf8_width(int cp);
+int utf8_next(const char* s, int len, int i);
+int utf8_prev(const char* s, int i);
+int editor_row_step(const erow* row, struct row_pos* p);
+struct row_pos editor_row_pos(const erow* row, int coord, int value);
+int editor_row_snap_cx(const erow* row, int cx);
+int editor_update_columns(erow* row);
+struct row_pos editor_build_columns(const erow* row, struct row_pos start, int size,
+                                    struct row_pos** cols, int* count);
+
+// LONG ROWS:
+int editor_row_wants_chunks(const erow* row);
+void editor_chunk_row(erow* row);
+void editor_unchunk_row(erow* row);
+void editor_update_row_span(erow* row, int at, int removed, int inserted);
+int editor_highlight_chunks(erow* row, int in_comment);
+int editor_chunk_at(const erow* row, int coord, int value);
+int editor_row_render_at(const erow* row, int bx, char** render, uint8_t** hl);
+int editor_row_find(const erow* row, const char* query);
+
+// SOFT WRAP:
+void editor_wrap_scroll();
+int editor_wrap_line(int i, int* row, int* start, int* len);
+void editor_wrap_cursor(int* y, int* x);
+void editor_wrap_move(int n);
+void editor_wrap_toggle();
+void editor_free_wrap();
+
+// BUFFERS:
+void editor_buffers_add(char** files, int n);
+void editor_buffer_edit(const char* filename);
+void editor_buffer_next(int dir);
+void editor_buffer_list();
+int editor_buffer_listing();
+void editor_buffer_list_hide();
+void editor_draw_buffer_list(struct abuf* ab);
+int editor_buffers_modified();
+void editor_free_buffers();
+int editor_buffer_current();
+void editor_buffer_show(int idx);
+void editor_buffer_exchange(int idx);
+long editor_buffer_changes(int idx);
+
+// WINDOWS:
+int editor_windows_split();
+void editor_window_split(int vertical, const char* filename);
+void editor_window_close();
+void editor_window_only();
+void editor_window_command(int c);
+int editor_window_shows(int buffer);
+void editor_draw_windows(struct abuf* ab);
+void editor_windows_overlaid(int shown);
+void editor_free_windows();
+
+// PAGER:
+int editor_pager_active();
+int editor_pager_too_big(const char* filename);
+void editor_pager_open(const char* filename);
+void editor_pager_slide();
+void editor_pager_goto(long line);
+void editor_pager_find();
+int editor_pager_allows(int c, int count);
+int editor_pager_refuses(const char* query);
+int editor_pager_indexing();
+void editor_pager_position(long* line, long* lines);
+void editor_free_pager();
+
+// COLD ROWS:
+void editor_row_touch(erow* row);
+void editor_cold_forget(erow* row);
+void editor_cold_thaw_rows(int at, int n);
+void editor_cold_thaw_all();
+void editor_cold_key(int c, int count);
+void editor_cold_wake();
+int editor_cold_timeout();
+void editor_cold_sweep();
+void editor_free_cold();
+
+// LZ CODEC:
+int lz_bound(int n);
+int lz_compress(const char* src, int n, char* dst);
+int lz_decompress(const char* src, int n, char* dst, int cap);
+
+// FILE WATCH:
+void editor_watch_file(const char* filename);
+int editor_watch_fd();
+int editor_watch_poll();
+void editor_watch_check();
+void editor_reload();
+void editor_follow_toggle();
+int editor_following();
+int editor_watch_timeout();
+void editor_free_watches();
+
+// BACKGROUND SAVE:
+void editor_save_start();
+int editor_save_in_progress();
+int editor_save_progress();
+int editor_save_poll();
+void editor_save_finish();
+int editor_save_failures();
+
+// SWAP JOURNAL:
+void editor_journal_open(const char* filename);
+void editor_journal_close(int remove);
+struct journal* editor_journal_detach();
+void editor_journal_attach(struct journal* j);
+void editor_journal_discard(struct journal* j, int remove);
+void editor_journal_insert_row(int idx, const char* s, int len);
+void editor_journal_delete_rows(int idx, int n);
+void editor_journal_insert_text(erow* row, int col, const char* s, int len);
+void editor_journal_delete_text(erow* row, int col, int n);
+void editor_journal_truncate_row(erow* row, int len);
+void editor_journal_set_row(int idx);
+void editor_journal_move_rows(int idx, int n, int delta);
+void editor_journal_sync();
+int editor_journal_pending();
+void editor_journal_mark_save();
+void editor_journal_saved();
+void editor_journal_compact();
 
 
 #endif
@@ -0,0 +1,279 @@
+
+#define _GNU_SOURCE // memrchr
+#include "editor.h"
+
+/* ------------------------------------ parallel file loading ------------------------------------ */
+// editor_open reads the whole file with large pread()s and builds its rows on several threads:
+//   1. every thread reads its slice of the file and counts the newlines in it (SSE2 when available)
+//   2. the counts give each slice its first row index, so state.row is sized once up front
+//   3. every thread builds chars/render/hl for the rows that end inside its slice, assuming the
+//      slice does not start inside a /* comment */
+//   4. the main thread walks the slice seams and re-highlights rows where that assumption was wrong
+//   5. the main thread puts the rows in the line pool, so repeated lines are stored once
+// The rows are appended to whatever is loaded already, which is also how tail-follow (file-watch.c)
+// adds the bytes a log has grown by: editor_load_range reads just those, no rescan of the file.
+
+#define LOADER_MAX_THREADS 16
+#define LOADER_MIN_SLICE (4 << 20) // don't bother with threads for less than this per slice
+#define LOADER_READ_BLOCK (8 << 20)
+#define LOADER_POOL_SAMPLE 4096 // rows looked at before deciding the file doesn't repeat itself
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct load_slice {
+    const char* buf;   // whole range
+    size_t file_size;  // of the range
+    off_t from;        // where the range starts in the file
+    int fd;
+    size_t lo, hi;     // byte range [lo, hi) this slice is responsible for
+    long newlines;     // newlines inside [lo, hi)
+    long first_row;    // index into state.row of the first row ending in this slice
+    long num_rows;
+    int err;
+    struct mem_batch mem; // what building the rows allocated, counted once the slice is done
+};
+
+// count '\n' in [p, p+len), 16 bytes at a time
+long editor_count_newlines(const char* p, size_t len){
+    long count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for(; i + 16 <= len; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)));
+    }
+#endif
+    for(; i < len; ++i){
+        count += (p[i] == '\n');
+    }
+    return count;
+}
+
+static void* load_count_worker(void* arg){
+    struct load_slice* s = arg;
+    char* dst = (char*) s->buf;
+    size_t off = s->lo;
+    while(off < s->hi){
+        size_t want = s->hi - off;
+        if(want > LOADER_READ_BLOCK) want = LOADER_READ_BLOCK;
+        ssize_t n = pread(s->fd, dst + off, want, s->from + off);
+        if(n <= 0){
+            s->err = n == 0 ? EIO : errno;
+            return NULL;
+        }
+        off += n;
+    }
+    s->newlines = editor_count_newlines(s->buf + s->lo, s->hi - s->lo);
+    return NULL;
+}
+
+// fill in one row the same way editor_insert_row would, without touching its neighbours
+static void load_row(erow* row, long idx, const char* line, size_t len){
+    // get rid of any trailing carriage returns, the newline is already excluded
+    while(len > 0 && line[len-1] == '\r') --len;
+    row->idx = idx;
+    row->size = len;
+    row->chars = line_new(line, len);
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->cols = NULL;
+    row->col_count = 0;
+    row->wrap = NULL;
+    row->wrap_count = 0;
+    row->chunks = NULL;
+    row->num_chunks = 0;
+    row->cold = NULL;
+    row->seen = 0;
+    editor_update_render(row);
+}
+
+static void* load_build_worker(void* arg){
+    struct load_slice* s = arg;
+    const char* buf = s->buf;
+    mem_batch_begin(&s->mem);
+
+    // our first row starts right after the last newline before the slice
+    size_t start = 0;
+    if(s->lo > 0){
+        const char* prev = memrchr(buf, '\n', s->lo);
+        start = prev ? (size_t)(prev - buf) + 1 : 0;
+    }
+
+    // glibc's memchr is vectorized as well, so finding each line end is a SIMD scan
+    long r = 0;
+    int in_comment = 0;
+    const char* p = buf + start;
+    const char* end = buf + s->hi;
+    while(p < end){
+        const char* nl = memchr(p, '\n', end - p);
+        if(nl == NULL){
+            // only the last slice can end on a line without a newline
+            if(s->hi != s->file_size) break;
+            nl = end;
+        }
+        erow* row = &state.row[s->first_row + r];
+        load_row(row, s->first_row + r, p, nl - p);
+        in_comment = editor_highlight_row(row, in_comment);
+        row->hl_open_comment = in_comment;
+        ++r;
+        p = nl + 1;
+    }
+    s->num_rows = r;
+    mem_batch_end();
+    return NULL;
+}
+
+// Build the rows for the lines in [buf, buf+len) into rows, which has room for all of them, the
+// last one even without a newline. Highlighted as if the first one didn't start inside a comment.
+// Returns how many there were. The pager (pager.c) decides where they go itself. A line longer
+// than max_line only gets its first max_line bytes built, with a note of how much is left out,
+// and the rest of it is never looked at.
+int editor_build_rows(erow* rows, const char* buf, size_t len, size_t max_line){
+    int r = 0, in_comment = 0;
+    const char* p = buf;
+    const char* end = buf + len;
+    while(p < end){
+        size_t room = end - p;
+        const char* nl = memchr(p, '\n', room < max_line + 1 ? room : max_line + 1);
+        if(nl == NULL && room > max_line){
+            // only the last line can be this long: the ones before it end where it starts
+            size_t keep = max_line;
+            while(keep > 0 && (p[keep] & 0xC0) == 0x80) --keep; // not in the middle of a character
+            char* cut = malloc(keep + 64);
+            if(cut == NULL) error("malloc");
+            memcpy(cut, p, keep);
+            int note = snprintf(cut + keep, 64, " [%zu more bytes not shown]", room - keep);
+            load_row(&rows[r], r, cut, keep + note);
+            free(cut);
+            nl = end;
+        }else{
+            if(nl == NULL) nl = end;
+            load_row(&rows[r], r, p, nl - p);
+        }
+        in_comment = editor_highlight_row(&rows[r], in_comment);
+        rows[r].hl_open_comment = in_comment;
+        ++r;
+        p = nl + 1;
+    }
+    return r;
+}
+
+// The first row of every slice was highlighted as if it started outside a comment. Fix that up
+// where it isn't true, stopping as soon as a row ends in the same state it had before.
+static void load_fix_seams(struct load_slice* slices, int n){
+    for(int k = 1; k < n; ++k){
+        long i = slices[k].first_row;
+        if(i == 0 || slices[k].num_rows == 0) continue;
+        int in_comment = state.row[i-1].hl_open_comment;
+        if(!in_comment) continue; // what the slice assumed
+        long end = i + slices[k].num_rows;
+        for(; i < end; ++i){
+            int was = state.row[i].hl_open_comment;
+            in_comment = editor_highlight_row(&state.row[i], in_comment);
+            state.row[i].hl_open_comment = in_comment;
+            if(in_comment == was) break;
+        }
+    }
+}
+
+// Appends the lines in bytes [from, from+size) of fd as rows, the last one even if it has no
+// newline yet. Returns 0 on success, -1 with errno set otherwise. *tail (if given) is where the
+// last line starts when it has no newline, from+size when it has one.
+static int load_range(int fd, off_t from, size_t size, off_t* tail){
+    char* buf = malloc(size ? size : 1);
+    if(buf == NULL){
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > LOADER_MAX_THREADS) n = LOADER_MAX_THREADS;
+    if(n > (long)(size / LOADER_MIN_SLICE)) n = size / LOADER_MIN_SLICE;
+    if(n < 1) n = 1;
+
+    struct load_slice slices[LOADER_MAX_THREADS];
+    pthread_t threads[LOADER_MAX_THREADS];
+    for(int k = 0; k < n; ++k){
+        slices[k] = (struct load_slice){ .buf = buf, .file_size = size, .from = from, .fd = fd,
+                                         .lo = size / n * k, .hi = (k == n-1) ? size : size / n * (k+1) };
+    }
+
+    // 1. read and count
+    for(int k = 1; k < n; ++k) pthread_create(&threads[k], NULL, load_count_worker, &slices[k]);
+    load_count_worker(&slices[0]);
+    for(int k = 1; k < n; ++k) pthread_join(threads[k], NULL);
+    for(int k = 0; k < n; ++k){
+        if(slices[k].err){
+            free(buf);
+            errno = slices[k].err;
+            return -1;
+        }
+    }
+
+    // 2. size the row table once
+    long base = state.num_rows;
+    long total = base;
+    for(int k = 0; k < n; ++k){
+        slices[k].first_row = total;
+        total += slices[k].newlines;
+    }
+    if(size > 0 && buf[size-1] != '\n') ++total; // last line has no newline
+    editor_reserve_rows(total);
+
+    // 3. build rows
+    for(int k = 1; k < n; ++k) pthread_create(&threads[k], NULL, load_build_worker, &slices[k]);
+    load_build_worker(&slices[0]);
+    for(int k = 1; k < n; ++k) pthread_join(threads[k], NULL);
+    for(int k = 0; k < n; ++k) mem_batch_flush(&slices[k].mem);
+    state.num_rows = total;
+
+    // 4. stitch the comment state across slices, including whatever was loaded before us
+    if(base > 0 && state.row[base-1].hl_open_comment && total > base){
+        editor_update_syntax(&state.row[base]);
+    }
+    load_fix_seams(slices, n);
+
+    // 5. rows with the same text share one payload (and render and hl), see line-storage.c. When
+    //    hardly any of the first rows have a twin the rest are left alone, a file of distinct lines
+    //    would only pay for the pool
+    long twins = 0;
+    for(long i = base; i < total; ++i){
+        if(i - base == LOADER_POOL_SAMPLE && twins * 8 < LOADER_POOL_SAMPLE) break;
+        twins += line_intern_row(&state.row[i], i > 0 ? state.row[i-1].hl_open_comment : 0);
+    }
+
+    ++state.changes;
+    if(tail){
+        const char* nl = memrchr(buf, '\n', size);
+        *tail = (size == 0 || buf[size-1] == '\n') ? from + (off_t) size : nl ? from + (nl - buf) + 1 : from;
+    }
+    free(buf);
+    return 0;
+}
+
+// Loads filename into the (empty) row table. Returns 0 on success, -1 with errno set otherwise.
+int editor_load_file(const char* filename){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1) return -1;
+    struct stat st;
+    int ret = fstat(fd, &st) == -1 ? -1 : load_range(fd, 0, st.st_size, NULL);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ret;
+}
+
+// Appends the lines in bytes [from, to) of filename as rows, see load_range
+int editor_load_range(const char* filename, off_t from, off_t to, off_t* tail){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1) return -1;
+    int ret = load_range(fd, from, to - from, tail);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ret;
+}
@@ -0,0 +1,537 @@
+
+#define _GNU_SOURCE // memrchr
+#include "editor.h"
+#include <sys/inotify.h> /* noticing files change on disk */
+#include <libgen.h> /* dirname, basename */
+
+/* ------------------------------------ file watching ------------------------------------ */
+// Open files are watched with inotify, so a file rewritten by something else (a build, log
+// rotation, git checkout) is noticed while waiting for a key instead of when :w overwrites it.
+// The directory is watched rather than the file, since rotation and most tools replace the file
+// with a new one. An event only says "look again": the file is stat'd and compared with what
+// it was when it was read or saved, so our own saves (and the swap file next to it) are ignored.
+//
+// A changed file is reloaded in place when the buffer has no unsaved changes, otherwise there is
+// a warning and :e! reloads it. Reloading doesn't rebuild the buffer: every line is hashed, lines
+// that appear exactly once on both sides anchor a diff (like patience diff), and only the rows
+// between anchors that really differ are replaced. Everything else keeps its render and hl, the
+// cursor stays on its line and the reload is one undo step on top of the existing history.
+//
+// :follow (or notes.out +F file) tails a growing file like less +F. A followed file that only got
+// longer isn't diffed at all: the new bytes are read and appended as rows by the loader, and the
+// view stays at the bottom as long as the cursor is on the last row (G to get back there). A log
+// can grow much faster than the screen can be redrawn, so appending goes FOLLOW_CHUNK bytes at a
+// time and the screen is redrawn at most every FOLLOW_FRAME_MS, with keys handled in between.
+
+#define WATCH_SETTLE_MS 20      // a file counts as written once it has been quiet this long
+#define WATCH_SETTLE_MAX_MS 200 // or when it has been written to for this long
+#define FOLLOW_CHUNK (1 << 20) // most bytes appended before looking at the keyboard again
+#define FOLLOW_FRAME_MS 50     // redraw a followed file at most this often
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM)
+
+struct watched {
+    char* path; // as the buffer names it
+    char* name; // the last part of path, what events are reported for
+    int wd;     // watch on the directory it is in
+    struct stat seen;  // the file as it was read or last saved
+    struct stat known; // the last change we told the user about and didn't reload
+    int missing;       // it was gone last time we looked
+    int follow;        // :follow, appended bytes become rows
+    off_t tail;        // followed: where the last row starts in the file if it has no newline yet
+};
+
+static struct {
+    int fd; // -1 until the first file is watched, or if inotify isn't available
+    struct watched* files;
+    int len, cap;
+} watch = { .fd = -1 };
+
+static struct {
+    int behind;       // the followed file has more bytes than were appended so far
+    int undrawn;      // rows were appended since the screen was last drawn for it
+    long long drawn;  // when that was, editor_perf_now()
+} follow;
+
+static int same_file(const struct stat* a, const struct stat* b){
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static struct watched* watch_find(const char* path){
+    if(path == NULL) return NULL;
+    for(int i = 0; i < watch.len; ++i){
+        if(strcmp(watch.files[i].path, path) == 0) return &watch.files[i];
+    }
+    return NULL;
+}
+
+// Start watching filename, or remember how it looks now if it is watched already. Called once a
+// file has been read and after every save.
+void editor_watch_file(const char* filename){
+    if(state.headless || filename == NULL) return;
+    if(watch.fd == -1){
+        watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(watch.fd == -1) return; // no inotify, changes go unnoticed like before
+    }
+    struct watched* w = watch_find(filename);
+    if(w == NULL){
+        char* copy = strdup(filename);
+        if(copy == NULL) error("strdup");
+        int wd = inotify_add_watch(watch.fd, dirname(copy), WATCH_MASK); // the same wd for the same directory
+        free(copy);
+        if(wd == -1) return;
+        if(watch.len == watch.cap){
+            watch.cap = watch.cap ? watch.cap * 2 : 8;
+            watch.files = realloc(watch.files, sizeof(struct watched) * watch.cap);
+            if(watch.files == NULL) error("realloc");
+        }
+        w = &watch.files[watch.len++];
+        memset(w, 0, sizeof(*w));
+        w->path = strdup(filename);
+        copy = strdup(filename);
+        if(w->path == NULL || copy == NULL) error("strdup");
+        w->name = strdup(basename(copy));
+        free(copy);
+        if(w->name == NULL) error("strdup");
+        w->wd = wd;
+    }
+    w->missing = stat(filename, &w->seen) == -1;
+    w->known = w->seen;
+    w->tail = w->seen.st_size; // a save ends on a newline
+}
+
+// fd to poll for changes next to stdin, -1 if nothing is watched
+int editor_watch_fd(){
+    return watch.fd;
+}
+
+/* ---------------------------------------- reloading ---------------------------------------- */
+struct line_ref {
+    unsigned long hash;
+    int idx;
+};
+
+// a run of old rows [old, old+old_len) that becomes new lines [new, new+new_len)
+struct hunk {
+    int old, old_len;
+    int new, new_len;
+};
+
+static unsigned long line_hash(const char* s, int len){
+    unsigned long h = 14695981039346656037UL; // FNV-1a
+    for(int i = 0; i < len; ++i){
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static int line_ref_cmp(const void* a, const void* b){
+    const struct line_ref* x = a;
+    const struct line_ref* y = b;
+    if(x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->idx - y->idx;
+}
+
+// an old row and a new line that are the same, and unique on both sides
+struct match {
+    int old, new;
+};
+
+static int match_cmp(const void* a, const void* b){
+    return ((const struct match*) a)->old - ((const struct match*) b)->old;
+}
+
+static int same_line(int row, const struct line_slice* line){
+    return state.row[row].size == line->size && memcmp(state.row[row].chars, line->chars, line->size) == 0;
+}
+
+static void hunk_add(struct hunk** hunks, int* n, int* cap, int o0, int o1, int n0, int n1,
+                     const struct line_slice* lines){
+    // the lines right next to an anchor are often the same on both sides
+    while(o0 < o1 && n0 < n1 && same_line(o0, &lines[n0])){ ++o0; ++n0; }
+    while(o0 < o1 && n0 < n1 && same_line(o1 - 1, &lines[n1 - 1])){ --o1; --n1; }
+    if(o0 == o1 && n0 == n1) return;
+    if(*n == *cap){
+        *cap = *cap ? *cap * 2 : 16;
+        *hunks = realloc(*hunks, sizeof(struct hunk) * *cap);
+        if(*hunks == NULL) error("realloc");
+    }
+    (*hunks)[(*n)++] = (struct hunk){ o0, o1 - o0, n0, n1 - n0 };
+}
+
+// The rows [o0, o1) are to become lines [n0, n1), append the hunks that does it. Lines that are
+// unique on both sides are matched up, the longest run of matches that is in order on both
+// sides is kept, and the rows between two of them are a hunk.
+static void diff_lines(const struct line_slice* lines, int o0, int o1, int n0, int n1,
+                       struct hunk** hunks, int* n, int* cap){
+    int on = o1 - o0, nn = n1 - n0;
+    struct line_ref* a = malloc(sizeof(struct line_ref) * (on + 1));
+    struct line_ref* b = malloc(sizeof(struct line_ref) * (nn + 1));
+    struct match* match = malloc(sizeof(struct match) * (on + 1));
+    // the longest increasing run of new lines through the matches
+    int* tails = malloc(sizeof(int) * (on + 1));
+    int* prev = malloc(sizeof(int) * (on + 1));
+    if(!a || !b || !match || !tails || !prev) error("malloc");
+
+    for(int i = 0; i < on; ++i) a[i] = (struct line_ref){ line_hash(state.row[o0 + i].chars, state.row[o0 + i].size), o0 + i };
+    for(int j = 0; j < nn; ++j) b[j] = (struct line_ref){ line_hash(lines[n0 + j].chars, lines[n0 + j].size), n0 + j };
+    qsort(a, on, sizeof(struct line_ref), line_ref_cmp);
+    qsort(b, nn, sizeof(struct line_ref), line_ref_cmp);
+
+    // both lists are sorted by hash, walk them together for hashes that occur once in each
+    int m = 0;
+    for(int i = 0, j = 0; i < on && j < nn;){
+        if(a[i].hash != b[j].hash){
+            if(a[i].hash < b[j].hash) ++i;
+            else ++j;
+            continue;
+        }
+        int i2 = i, j2 = j;
+        while(i2 < on && a[i2].hash == a[i].hash) ++i2;
+        while(j2 < nn && b[j2].hash == b[j].hash) ++j2;
+        if(i2 - i == 1 && j2 - j == 1 && same_line(a[i].idx, &lines[b[j].idx])){
+            match[m++] = (struct match){ a[i].idx, b[j].idx };
+        }
+        i = i2;
+        j = j2;
+    }
+    qsort(match, m, sizeof(struct match), match_cmp); // in old row order
+
+    // longest increasing run of new lines (patience sorting): tails[len] ends the best run of len+1
+    int len = 0;
+    for(int k = 0; k < m; ++k){
+        int lo = 0, hi = len;
+        while(lo < hi){
+            int mid = (lo + hi) / 2;
+            if(match[tails[mid]].new < match[k].new) lo = mid + 1;
+            else hi = mid;
+        }
+        prev[k] = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = k;
+        if(lo == len) ++len;
+    }
+    // walk the run back, marking its matches in tails (reused as a flag per match)
+    int k = len > 0 ? tails[len - 1] : -1;
+    for(int i = 0; i < m; ++i) tails[i] = 0;
+    for(; k >= 0; k = prev[k]) tails[k] = 1;
+
+    int po = o0, pn = n0;
+    for(int i = 0; i < m; ++i){
+        if(!tails[i]) continue;
+        hunk_add(hunks, n, cap, po, match[i].old, pn, match[i].new, lines);
+        po = match[i].old + 1;
+        pn = match[i].new + 1;
+    }
+    hunk_add(hunks, n, cap, po, o1, pn, n1, lines);
+
+    free(a);
+    free(b);
+    free(match);
+    free(tails);
+    free(prev);
+}
+
+// where row r of the old text is in the new one
+static int map_row(const struct hunk* hunks, int n, int r){
+    int delta = 0;
+    for(int i = 0; i < n && hunks[i].old <= r; ++i){
+        if(r < hunks[i].old + hunks[i].old_len){
+            int into = r - hunks[i].old;
+            if(into >= hunks[i].new_len) into = hunks[i].new_len > 0 ? hunks[i].new_len - 1 : 0;
+            return hunks[i].new + into;
+        }
+        delta += hunks[i].new_len - hunks[i].old_len;
+    }
+    return r + delta;
+}
+
+// split buf into lines the way the loader does (no newline, no trailing \r), pointing into buf
+static struct line_slice* split_lines(char* buf, long size, int* count){
+    long n = 0;
+    for(long i = 0; i < size; ++i) n += buf[i] == '\n';
+    if(size > 0 && buf[size - 1] != '\n') ++n;
+    struct line_slice* lines = malloc(sizeof(struct line_slice) * (n + 1));
+    if(lines == NULL) error("malloc");
+    long at = 0;
+    for(long k = 0; k < n; ++k){
+        char* nl = memchr(buf + at, '\n', size - at);
+        long end = nl ? nl - buf : size;
+        long len = end - at;
+        while(len > 0 && buf[at + len - 1] == '\r') --len;
+        lines[k].chars = buf + at;
+        lines[k].size = len;
+        at = end + 1;
+    }
+    *count = n;
+    return lines;
+}
+
+// the whole file, and in *st how it looked when it was read
+static char* read_file(const char* filename, long* size, struct stat* st){
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1) return NULL;
+    char* buf = NULL;
+    if(fstat(fd, st) == 0 && (buf = malloc(st->st_size + 1))){
+        long got = 0, n;
+        while(got < st->st_size && (n = read(fd, buf + got, st->st_size - got)) > 0) got += n;
+        *size = got; // a file still being written may be shorter by now
+    }
+    close(fd);
+    return buf;
+}
+
+// Make the current buffer what its file holds now, changing only rows that differ. Returns the
+// number of rows replaced or added, -1 if the file can't be read.
+static int reload_current(struct watched* w){
+    long size = 0;
+    struct stat st;
+    char* buf = read_file(state.filename, &size, &st);
+    if(buf == NULL) return -1;
+    editor_cold_thaw_all(); // rows are compared with the file
+    // what was read, not what the file is by the time we are done: a writer that is still going
+    // gets noticed again
+    if(w){
+        w->seen = w->known = st;
+        w->missing = 0;
+    }
+    int num_lines;
+    struct line_slice* lines = split_lines(buf, size, &num_lines);
+
+    // the same at both ends, the common case by far, then diff whatever is left in the middle
+    int o0 = 0, o1 = state.num_rows, n0 = 0, n1 = num_lines;
+    while(o0 < o1 && n0 < n1 && same_line(o0, &lines[n0])){ ++o0; ++n0; }
+    while(o0 < o1 && n0 < n1 && same_line(o1 - 1, &lines[n1 - 1])){ --o1; --n1; }
+    struct hunk* hunks = NULL;
+    int n = 0, cap = 0;
+    if(o0 < o1 && n0 < n1) diff_lines(lines, o0, o1, n0, n1, &hunks, &n, &cap);
+    else hunk_add(&hunks, &n, &cap, o0, o1, n0, n1, lines);
+
+    int cy = map_row(hunks, n, state.cy), rowoff = map_row(hunks, n, state.rowoff);
+    int anchor = map_row(hunks, n, state.visual_anchor);
+
+    // bottom up, so the row numbers of the hunks above stay right. One undo (and redo) step for all of it
+    int grouped = editor_undo_group_begin();
+    int changed = 0;
+    for(int i = n - 1; i >= 0; --i){
+        struct hunk* h = &hunks[i];
+        editor_delete_rows(h->old, h->old_len);
+        if(h->new_len > 0){
+            struct line_slice* payloads = malloc(sizeof(struct line_slice) * h->new_len);
+            if(payloads == NULL) error("malloc");
+            for(int k = 0; k < h->new_len; ++k){
+                payloads[k].chars = line_intern(lines[h->new + k].chars, lines[h->new + k].size);
+                payloads[k].size = lines[h->new + k].size;
+            }
+            editor_insert_lines(h->old, payloads, h->new_len);
+            for(int k = 0; k < h->new_len; ++k) line_release(payloads[k].chars); // the rows have them
+            free(payloads);
+        }
+        changed += h->new_len;
+    }
+    if(grouped) editor_undo_group_end();
+
+    state.cy = cy >= state.num_rows && state.num_rows > 0 ? state.num_rows - 1 : cy;
+    state.cx = state.cy < state.num_rows ? editor_row_snap_cx(&state.row[state.cy], state.cx) : 0;
+    state.rowoff = rowoff > state.cy ? state.cy : rowoff;
+    state.visual_anchor = anchor >= state.num_rows && state.num_rows > 0 ? state.num_rows - 1 : anchor;
+    state.dirty = 0;
+    // the swap file starts over from the file as it is now
+    editor_journal_mark_save();
+    editor_journal_saved();
+
+    free(hunks);
+    free(lines);
+    free(buf);
+    return changed;
+}
+
+// :e!, reload the current file even with unsaved changes (u brings them back, Ctrl-R reloads again)
+void editor_reload(){
+    if(state.filename == NULL){
+        editor_set_status_msg("no file name");
+        return;
+    }
+    editor_save_finish();
+    if(watch_find(state.filename) == NULL) editor_watch_file(state.filename);
+    int changed = reload_current(watch_find(state.filename));
+    if(changed < 0){
+        editor_set_status_msg("Can't read %s: %s", state.filename, strerror(errno));
+        return;
+    }
+    editor_set_status_msg("\"%s\" reloaded, %d lines changed", state.filename, changed);
+}
+
+/* ---------------------------------------- following ---------------------------------------- */
+// The file only got longer: load its new bytes as rows. The rows are the file as it was, nothing
+// the user changed, so this is neither an undo step nor in the swap file, and dirty stays 0. The
+// swap file starts over from the longer file, or recovery would refuse to replay over it.
+static void follow_append(struct watched* w, const struct stat* st){
+    off_t from = w->seen.st_size, to = st->st_size;
+    if(to - from > FOLLOW_CHUNK) to = from + FOLLOW_CHUNK;
+    int pinned = state.cy >= state.num_rows - 1;
+    // a last row without its newline is read again with the rest of its line
+    if(w->tail < from && state.num_rows > 0){
+        editor_free_row(&state.row[--state.num_rows]);
+        from = w->tail;
+    }
+    off_t tail;
+    if(editor_load_range(state.filename, from, to, &tail) == -1){
+        w->follow = 0; // shorter than it said, or gone: look at it the normal way next time
+        editor_set_status_msg("\"%s\" can't be followed: %s", state.filename, strerror(errno));
+        return;
+    }
+    w->seen = w->known = *st;
+    w->seen.st_size = w->known.st_size = to; // what the rows hold, the rest is next
+    w->tail = tail;
+    editor_journal_mark_save();
+    editor_journal_saved();
+    follow.behind = to < st->st_size;
+    follow.undrawn = 1;
+    editor_cold_wake(); // the new rows are cold once they have scrolled by
+    if(pinned && state.num_rows > 0){
+        state.cy = state.num_rows - 1;
+        state.cx = 0;
+    }
+}
+
+// :follow, start or stop appending what the current file grows by
+void editor_follow_toggle(){
+    struct watched* w = watch_find(state.filename);
+    if(w && w->follow){
+        w->follow = 0;
+        editor_set_status_msg("stopped following \"%s\"", state.filename);
+        return;
+    }
+    if(w == NULL || state.dirty){
+        editor_set_status_msg(w ? "can't follow a modified buffer, :w or :e! first" : "no file to follow");
+        return;
+    }
+    editor_watch_check(); // start from what the file is now
+    // where the last row starts, if the file doesn't end on a newline: look back for the one before it
+    int fd = open(state.filename, O_RDONLY);
+    if(fd == -1) return;
+    char buf[4096];
+    off_t end = w->seen.st_size;
+    w->tail = end;
+    if(end > 0 && pread(fd, buf, 1, end - 1) == 1 && buf[0] != '\n'){
+        w->tail = 0;
+        while(end > 0){
+            off_t at = end > (off_t) sizeof(buf) ? end - sizeof(buf) : 0;
+            ssize_t n = pread(fd, buf, end - at, at);
+            if(n <= 0) break;
+            char* nl = memrchr(buf, '\n', n);
+            if(nl){
+                w->tail = at + (nl - buf) + 1;
+                break;
+            }
+            end = at;
+        }
+    }
+    close(fd);
+    w->follow = 1;
+    if(state.num_rows > 0) state.cy = state.num_rows - 1;
+    state.cx = 0;
+    editor_set_status_msg("following \"%s\", :follow to stop", state.filename);
+}
+
+int editor_following(){
+    struct watched* w = watch_find(state.filename);
+    return w && w->follow;
+}
+
+// 1 if a followed file's new rows are due to be drawn, holding them back to one frame per FOLLOW_FRAME_MS
+static int follow_frame(){
+    long long now = editor_perf_now();
+    if(!follow.undrawn || now - follow.drawn < FOLLOW_FRAME_MS * 1000000LL) return 0;
+    follow.undrawn = 0;
+    follow.drawn = now;
+    return 1;
+}
+
+// How long the input loop may wait for a key or an event: 0 while a followed file still has bytes
+// to append, until the next frame while appended rows aren't drawn yet, otherwise forever (-1)
+int editor_watch_timeout(){
+    if(!editor_following()) return -1;
+    if(follow.behind) return 0;
+    if(!follow.undrawn) return -1;
+    long long left = FOLLOW_FRAME_MS - (editor_perf_now() - follow.drawn) / 1000000LL;
+    return left > 0 ? left : 0;
+}
+
+// Has the current buffer's file changed since it was read or saved? Reload it if the buffer is
+// unmodified, warn once otherwise. Also called when a buffer becomes current.
+void editor_watch_check(){
+    struct watched* w = watch_find(state.filename);
+    if(w == NULL || editor_save_in_progress()) return; // our own save is writing it
+    struct stat st;
+    if(stat(state.filename, &st) == -1){
+        if(!w->missing) editor_set_status_msg("\"%s\" was deleted on disk", state.filename);
+        w->missing = 1;
+        return;
+    }
+    if(same_file(&st, &w->seen) || (!w->missing && same_file(&st, &w->known))) return;
+    if(w->follow && !state.dirty && !w->missing && st.st_dev == w->seen.st_dev && st.st_ino == w->seen.st_ino &&
+       st.st_size > w->seen.st_size){
+        follow_append(w, &st);
+        return;
+    }
+    w->missing = 0;
+    w->known = st;
+    if(state.dirty){
+        editor_set_status_msg("\"%s\" changed on disk, :e! to reload it", state.filename);
+        return;
+    }
+    editor_reload();
+}
+
+// read the events that are queued, 1 if any of them was about the current buffer's file
+static int watch_drain(){
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct watched* w = watch_find(state.filename);
+    int current = 0;
+    ssize_t len;
+    while((len = read(watch.fd, buf, sizeof(buf))) > 0){
+        for(char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len){
+            struct inotify_event* ev = (struct inotify_event*) p;
+            if(ev->mask & IN_Q_OVERFLOW) current = 1; // events were dropped, look anyway
+            else if(w && ev->wd == w->wd && ev->len && strcmp(ev->name, w->name) == 0) current = 1;
+        }
+    }
+    return current;
+}
+
+// Read what inotify has for us, returns 1 if the screen may have to be redrawn. Other buffers
+// are looked at when they are shown again.
+int editor_watch_poll(){
+    int current = watch_drain();
+    if(editor_following()){
+        // no settling: appending doesn't care if the writer is done
+        if(current || follow.behind){
+            follow.behind = 0;
+            editor_watch_check(); // sets behind again if there is more than FOLLOW_CHUNK
+        }
+        return follow_frame();
+    }
+    if(!current) return 0;
+    // most writers truncate first and write after, give them a moment to finish (but not forever,
+    // a log that is written to all the time is reloaded as it goes)
+    struct pollfd pfd = { .fd = watch.fd, .events = POLLIN };
+    for(int waited = 0; waited < WATCH_SETTLE_MAX_MS && poll(&pfd, 1, WATCH_SETTLE_MS) > 0; waited += WATCH_SETTLE_MS){
+        watch_drain();
+    }
+    editor_watch_check();
+    return 1;
+}
+
+void editor_free_watches(){
+    for(int i = 0; i < watch.len; ++i){
+        free(watch.files[i].path);
+        free(watch.files[i].name);
+    }
+    free(watch.files);
+    watch.files = NULL;
+    watch.len = watch.cap = 0;
+    if(watch.fd != -1) close(watch.fd);
+    watch.fd = -1;
+}
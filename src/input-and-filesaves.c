@@ -15,8 +15,7 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)){
         editor_set_status_msg(prompt, buf);
         editor_refresh_screen();
 
-        char c;
-        if(read(STDIN_FILENO, &c, 1) == -1) error("read");
+        int c = editor_read_key();
 
         if(c == BACKSPACE){
             //backspace
@@ -51,16 +50,48 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)){
 }
 
 
+// read 1 byte from STDIN (blocking). Every key press in every mode goes through here.
+int editor_read_key(){
+    // a repeated change, then a running macro supply their keys before anything typed
+    int key = editor_change_next_key();
+    if(key != -1) return key;
+    key = editor_macro_next_key();
+    if(key == -1 && state.headless){
+        // the script ran out in the middle of a command, cancel it
+        key = '\x1b';
+    }else if(key == -1){
+        unsigned char c;
+        int bytes_read;
+        while((bytes_read = read(STDIN_FILENO, &c, 1)) != 1){
+            if(bytes_read == -1 && errno != EAGAIN) error("read");
+        }
+        editor_macro_record_key(c);
+        key = c;
+    }
+    editor_change_record_key(key);
+    return key;
+}
+
 // read 1 byte from STDIN, store in address of int c (char). Handles all keybind specifications.
-void editor_keypress_handler(){
-    static int quit_times = QUIT_TIMES;
+static int quit_times = QUIT_TIMES;
 
-    char c;
-    if(read(STDIN_FILENO, &c, 1) == -1) error("read");
+void editor_keypress_handler(){
+    editor_wait_for_input();
+    int c = editor_read_key();
+    long long start = editor_perf_now();
+    editor_process_key(c);
+    editor_perf_record(PERF_INPUT, start, 0);
+}
 
+// everything a key does, also used to play back macros without going through the screen
+void editor_process_key(int c){
+    editor_buffer_list_hide(); // :ls is shown until the next key
+    editor_cold_key(c, 0); // thaws the rows the key may read, see cold-rows.c
     // if <esc>, then move to normal mode
     if(c == '\x1b'){
-        if(state.mode == VISUAL_MODE){
+        if(state.mode == INSERT_MODE){
+            editor_change_insert_done(); // the insert is part of the change . repeats
+        }else if(state.mode == VISUAL_MODE){
             read_visual_line_mode(c); // visual mode handles recoloring lines
         }
         state.mode = NORMAL_MODE;
@@ -72,6 +103,11 @@ void editor_keypress_handler(){
             editor_set_status_msg("WARNING!!! File has unsaved changes, press CTRL-c %d more times to quit without saving.", quit_times);
             --quit_times;
             return;
+        }else if(editor_buffers_modified() && quit_times > 0){
+            editor_set_status_msg("WARNING!!! %d other buffers are modified, press CTRL-c %d more times to quit.",
+                                  editor_buffers_modified(), quit_times);
+            --quit_times;
+            return;
         }
         exit(0);
     }
@@ -133,28 +169,13 @@ void editor_open(char* filename){
     state.filename = (char*) malloc(len + 1);
     strcpy(state.filename, filename); // includes null-byte
 
-    FILE* fp = fopen(filename, "r");
-    if (!fp) error("fopen");
-
-    char* line = NULL;
-    size_t linecap = 0;
-    ssize_t length;
-    // using getline() because we don't know how much memory to allocate per line
-    while((length = getline(&line, &linecap, fp)) != -1){
-        if (length == -1) error("getline");
-
-        // get rid of any trailing whitespace by reducing length
-        while(length > 0 &&
-             (line[length-1] == '\n' ||
-              line[length-1]=='\r')){
-            --length;
-        }
-
-        editor_insert_row(state.num_rows, line, length);
-    }
+    // rows are built on several threads, see file-loader.c
+    if(editor_load_file(filename) == -1) error("open");
 
-    free(line);
-    fclose(fp);
+    // start journaling edits, replaying the swap file first if we crashed last time.
+    // A -s run is over in moments and must not touch the user's swap files.
+    if(!state.headless) editor_journal_open(filename);
+    editor_watch_file(filename); // notice it changing on disk, see file-watch.c
 }
 
 // Save file, if file doesn't exist, prompts for new file creation
@@ -165,26 +186,47 @@ void editor_save(){
             editor_set_status_msg("Save cancelled");
             return;
         }
+        ++state.changes; // the name windows show for it
     }
 
-    int len;
-    char *buf = editor_rows_to_string(&len);
-    // 0644 are standard permissions for text files
-    int fd = open(state.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                editor_set_status_msg("%d bytes written to disk", len);
-                state.dirty = 0;
-                return;
-            }
-        }
-        close(fd);
-    }
-    free(buf);
-    editor_set_status_msg("Failed to save. Error: %s", strerror(errno));
+    // rows are snapshotted and written on another thread, see background-save.c
+    editor_save_start();
+    if(state.headless) editor_save_finish(); // a script expects :w to be done when it moves on
 }
 
+// Blocks until a key is ready on STDIN. While a save is running the screen is redrawn every
+// 100 ms so the status bar can show its progress, and the save is finished off when it is done.
+// Journaled edits are synced to the swap file once the user stops typing for a moment, and a
+// file that changes on disk meanwhile is reloaded (or warned about) right away.
+void editor_wait_for_input(){
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    if(editor_journal_pending() && poll(&pfd, 1, 200) == 0){
+        editor_journal_sync();
+    }
+    while(editor_save_in_progress()){
+        if(poll(&pfd, 1, 100) > 0) break;
+        editor_save_poll();
+        editor_refresh_screen();
+    }
+    if(editor_save_poll()) editor_refresh_screen();
+    // the same for the pager's line count, the status bar shows how far it got
+    if(editor_pager_indexing() >= 0){
+        while(editor_pager_indexing() >= 0){
+            if(poll(&pfd, 1, 100) > 0) break;
+            editor_refresh_screen();
+        }
+        editor_refresh_screen();
+    }
 
+    struct pollfd fds[2] = { pfd, { .fd = editor_watch_fd(), .events = POLLIN } };
+    // a followed file can ask to be looked at again before anything happens, see file-watch.c,
+    // and rows nobody has looked at for a while are compressed in the meantime, see cold-rows.c
+    while(1){
+        int timeout = editor_watch_timeout(), cold = editor_cold_timeout();
+        if(fds[1].fd == -1 && cold == -1) break; // nothing to do but read the key
+        if(timeout == -1 || (cold != -1 && cold < timeout)) timeout = cold;
+        if(poll(fds, 2, timeout) < 0 || fds[0].revents) break;
+        if(editor_cold_timeout() == 0) editor_cold_sweep();
+        if(editor_watch_poll()) editor_refresh_screen();
+    }
+}
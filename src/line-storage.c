@@ -0,0 +1,361 @@
+
+#include "editor.h"
+
+/* ------------------------------------ line payloads ------------------------------------ */
+// Every erow.chars points just past one of these headers. The payload can be shared by several
+// owners (rows, undo entries, save snapshots) and is copied lazily, the first time one of them
+// wants to write to it. Reference counts are only ever touched from the main thread.
+struct line_header {
+    int refs;
+    int undo_refs; // how many of refs are undo entries, see line_undo_hold
+    int cap : 31; // bytes available after the header, including room for the null byte
+    unsigned pooled : 1; // in the pool below, the text can't change while it is
+    struct line_cache* cache; // render and hl the rows holding a pooled payload share
+};
+
+#define LINE_HEADER(p) ((struct line_header*)(p) - 1)
+
+// the tag a payload's bytes are counted under, undo once nothing but undo entries hold it
+static int line_tag(const struct line_header* h){
+    return h->undo_refs > 0 && h->undo_refs == h->refs ? MEM_UNDO : MEM_LINES;
+}
+
+static long line_bytes(const struct line_header* h){
+    return sizeof(struct line_header) + h->cap;
+}
+
+static void pool_remove(struct line_header* h);
+
+// allocate an empty payload that can hold cap bytes (null byte included)
+char* line_alloc(int cap){
+    if(cap < 1) cap = 1;
+    struct line_header* h = mem_alloc(MEM_LINES, sizeof(struct line_header) + cap);
+    if(h == NULL) error("malloc");
+    h->refs = 1;
+    h->undo_refs = 0;
+    h->cap = cap;
+    h->pooled = 0;
+    h->cache = NULL;
+    char* p = (char*)(h + 1);
+    p[0] = '\0';
+    return p;
+}
+
+// new payload holding a copy of s[0..len)
+char* line_new(const char* s, int len){
+    char* p = line_alloc(len + 1);
+    if(len > 0) memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+// take another reference to an existing payload, nothing is copied
+char* line_share(char* chars){
+    if(chars == NULL) return NULL;
+    struct line_header* h = LINE_HEADER(chars);
+    int tag = line_tag(h);
+    ++h->refs;
+    mem_retag(tag, line_tag(h), line_bytes(h));
+    return chars;
+}
+
+// drop a reference, freeing the payload once nobody is using it
+void line_release(char* chars){
+    if(chars == NULL) return;
+    struct line_header* h = LINE_HEADER(chars);
+    int tag = line_tag(h);
+    if(--h->refs > 0){
+        mem_retag(tag, line_tag(h), line_bytes(h));
+        return;
+    }
+    if(h->pooled) pool_remove(h);
+    mem_free(tag, h, line_bytes(h));
+}
+
+int line_is_shared(const char* chars){
+    return chars && LINE_HEADER(chars)->refs > 1;
+}
+
+// One of the references to chars now belongs to an undo entry (see undo-redo.c). Once undo
+// entries are all that hold a payload, :mem counts it as undo.
+void line_undo_hold(char* chars){
+    if(chars == NULL) return;
+    struct line_header* h = LINE_HEADER(chars);
+    int tag = line_tag(h);
+    ++h->undo_refs;
+    mem_retag(tag, line_tag(h), line_bytes(h));
+}
+
+// the undo entry's reference goes back to a row, or is about to be released
+void line_undo_unhold(char* chars){
+    if(chars == NULL) return;
+    struct line_header* h = LINE_HEADER(chars);
+    int tag = line_tag(h);
+    --h->undo_refs;
+    mem_retag(tag, line_tag(h), line_bytes(h));
+}
+
+// Called before modifying a payload in place. Returns a payload that is owned only by the caller
+// and has room for at least cap bytes, keeping the first len bytes (plus null byte) of chars.
+// A shared payload is copied and our reference to it dropped, so other owners never see the change.
+// A row has to let go of a shared render and hl first, see line_cache_detach.
+char* line_writable(char* chars, int len, int cap){
+    if(chars == NULL) return line_alloc(cap);
+    if(cap < len + 1) cap = len + 1;
+
+    struct line_header* h = LINE_HEADER(chars);
+    if(h->refs > 1){
+        char* copy = line_alloc(cap);
+        memcpy(copy, chars, len);
+        copy[len] = '\0';
+        int tag = line_tag(h);
+        --h->refs;
+        mem_retag(tag, line_tag(h), line_bytes(h));
+        return copy;
+    }
+    if(h->pooled) pool_remove(h); // the only owner, but the text is about to stop matching its hash
+    if(h->cap < cap){
+        // grow geometrically so repeated single character inserts stay cheap
+        int new_cap = h->cap * 2;
+        if(new_cap < cap) new_cap = cap;
+        h = mem_realloc(line_tag(h), h, line_bytes(h), sizeof(struct line_header) + new_cap);
+        if(h == NULL) error("realloc");
+        h->cap = new_cap;
+    }
+    return (char*)(h + 1);
+}
+
+// Give back the room an unshared payload has past its len bytes (line_writable grows them
+// geometrically). Used on buffers that are put away, see buffers.c. Shared payloads are left alone,
+// and pooled ones are exactly their size already.
+char* line_compact(char* chars, int len){
+    if(chars == NULL) return NULL;
+    struct line_header* h = LINE_HEADER(chars);
+    if(h->refs > 1 || h->pooled || h->cap <= len + 1) return chars;
+    struct line_header* small = mem_realloc(line_tag(h), h, line_bytes(h), sizeof(struct line_header) + len + 1);
+    if(small == NULL) return chars; // keeping the bigger block is fine
+    small->cap = len + 1;
+    return (char*)(small + 1);
+}
+
+/* ------------------------------------ line pool ------------------------------------ */
+// Logs and generated files repeat the same lines over and over. Rows are made with line_intern,
+// which hands out the payload an identical line already has, so a file takes memory for the
+// lines that differ. A pooled payload holds exactly its text, which never changes while it is in
+// the pool: line_writable copies a shared one as it always has, and takes the last owner's out of
+// the pool before writing to it.
+//
+// Once a pooled payload has a second owner, the first row highlighted from it gives its render,
+// hl and cols to a line_cache, and every other row with that text and the same comment state
+// going in uses those instead of building its own. Shared ones are never written to or freed by
+// a row: editor_update_render and editor_drop_row_cache let go of them (line_cache_detach), the
+// syntax highlighter and search make a copy first (line_cache_unshare), and the edits in
+// editor-row-ops.c let go of them before the text changes. The cache is freed with the payload.
+//
+// The pool is an open addressing table of headers keyed by a hash of the text.
+
+#define POOL_MIN_CAP 1024
+
+struct line_cache {
+    char* render;
+    uint8_t* hl;
+    struct row_pos* cols;
+    int rsize, col_count;
+    int in_comment, out_comment; // the comment state hl starts and ends in
+};
+
+static struct {
+    struct line_header** slots;
+    int cap; // a power of two
+    int len;
+} pool;
+
+static uint32_t pool_hash(const char* s, int len){
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (uint64_t) len;
+    uint64_t v;
+    for(; len >= 8; s += 8, len -= 8){
+        memcpy(&v, s, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    v = 0;
+    memcpy(&v, s, len);
+    h = (h ^ v) * 0xff51afd7ed558ccdull;
+    return h ^ (h >> 29);
+}
+
+static int pool_home(const struct line_header* h){
+    return pool_hash((const char*)(h + 1), h->cap - 1) & (pool.cap - 1);
+}
+
+// the pooled payload holding s[0..len), NULL if there is none
+static struct line_header* pool_find(const char* s, int len, uint32_t hash){
+    if(pool.cap == 0) return NULL;
+    for(int i = hash & (pool.cap - 1); pool.slots[i]; i = (i + 1) & (pool.cap - 1)){
+        struct line_header* h = pool.slots[i];
+        if(h->cap == len + 1 && memcmp(h + 1, s, len) == 0) return h;
+    }
+    return NULL;
+}
+
+static void pool_place(struct line_header* h, int home){
+    int i = home;
+    while(pool.slots[i]) i = (i + 1) & (pool.cap - 1);
+    pool.slots[i] = h;
+}
+
+static void pool_insert(struct line_header* h, uint32_t hash){
+    if((pool.len + 1) * 10 > pool.cap * 7){
+        struct line_header** old = pool.slots;
+        int old_cap = pool.cap;
+        pool.cap = old_cap ? old_cap * 2 : POOL_MIN_CAP;
+        pool.slots = mem_alloc(MEM_POOL, sizeof(struct line_header*) * pool.cap);
+        if(pool.slots == NULL) error("malloc");
+        memset(pool.slots, 0, sizeof(struct line_header*) * pool.cap);
+        for(int i = 0; i < old_cap; ++i){
+            if(old[i]) pool_place(old[i], pool_home(old[i]));
+        }
+        mem_free(MEM_POOL, old, sizeof(struct line_header*) * old_cap);
+    }
+    pool_place(h, hash & (pool.cap - 1));
+    h->pooled = 1;
+    ++pool.len;
+}
+
+static void cache_free(struct line_header* h){
+    struct line_cache* c = h->cache;
+    if(c == NULL) return;
+    mem_free(MEM_RENDER, c->render, c->rsize + 1);
+    mem_free(MEM_HL, c->hl, c->rsize);
+    mem_free(MEM_RENDER, c->cols, sizeof(struct row_pos) * c->col_count);
+    mem_free(MEM_POOL, c, sizeof(struct line_cache));
+    h->cache = NULL;
+}
+
+// take h out of the table, moving back the entries after it that would no longer be found
+static void pool_remove(struct line_header* h){
+    int mask = pool.cap - 1;
+    int i = pool_home(h);
+    while(pool.slots[i] != h) i = (i + 1) & mask;
+    pool.slots[i] = NULL;
+    for(int j = (i + 1) & mask; pool.slots[j]; j = (j + 1) & mask){
+        int home = pool_home(pool.slots[j]);
+        // the entry at j can fill the hole at i if its home isn't in (i, j]
+        if((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)){
+            pool.slots[i] = pool.slots[j];
+            pool.slots[j] = NULL;
+            i = j;
+        }
+    }
+    h->pooled = 0;
+    cache_free(h);
+    --pool.len;
+    if(pool.len == 0){
+        mem_free(MEM_POOL, pool.slots, sizeof(struct line_header*) * pool.cap);
+        pool.slots = NULL;
+        pool.cap = 0;
+    }
+}
+
+// a payload holding a copy of s[0..len), the one an identical line already has if there is one
+char* line_intern(const char* s, int len){
+    uint32_t hash = pool_hash(s, len);
+    struct line_header* h = pool_find(s, len, hash);
+    if(h) return line_share((char*)(h + 1));
+    char* p = line_new(s, len);
+    pool_insert(LINE_HEADER(p), hash);
+    return p;
+}
+
+// the cache row's render, hl and cols are, NULL if they are its own
+static struct line_cache* row_cache(const erow* row){
+    if(row->chars == NULL || row->render == NULL) return NULL;
+    struct line_cache* c = LINE_HEADER(row->chars)->cache;
+    return c && c->render == row->render ? c : NULL;
+}
+
+int line_cache_shared(const erow* row){
+    return row_cache(row) != NULL;
+}
+
+// stop using a shared render, hl and cols, without freeing them
+void line_cache_detach(erow* row){
+    if(row_cache(row) == NULL) return;
+    row->render = NULL;
+    row->hl = NULL;
+    row->cols = NULL;
+    row->rsize = 0;
+    row->col_count = 0;
+}
+
+// give row its own copy of a shared render, hl and cols, before writing to them
+void line_cache_unshare(erow* row){
+    struct line_cache* c = row_cache(row);
+    if(c == NULL) return;
+    row->render = mem_alloc(MEM_RENDER, c->rsize + 1);
+    row->hl = mem_alloc(MEM_HL, c->rsize);
+    if(row->render == NULL || (row->hl == NULL && c->rsize > 0)) error("malloc");
+    memcpy(row->render, c->render, c->rsize + 1);
+    memcpy(row->hl, c->hl, c->rsize);
+    if(c->col_count > 0){
+        row->cols = mem_alloc(MEM_RENDER, sizeof(struct row_pos) * c->col_count);
+        if(row->cols == NULL) error("malloc");
+        memcpy(row->cols, c->cols, sizeof(struct row_pos) * c->col_count);
+    }
+}
+
+// Use the render and cols an identical row made, instead of rendering. Returns 0 if there are none.
+int line_cache_adopt(erow* row){
+    if(row->chars == NULL || row->chunks) return 0;
+    struct line_cache* c = LINE_HEADER(row->chars)->cache;
+    if(c == NULL) return 0;
+    if(row->render == c->render) return 1;
+    mem_free(MEM_RENDER, row->render, row->rsize + 1);
+    mem_free(MEM_HL, row->hl, row->rsize);
+    mem_free(MEM_RENDER, row->cols, sizeof(struct row_pos) * row->col_count);
+    row->render = c->render;
+    row->hl = c->hl;
+    row->cols = c->cols;
+    row->rsize = c->rsize;
+    row->col_count = c->col_count;
+    return 1;
+}
+
+// The comment state a row using a shared hl ends in, when it starts in in_comment like the
+// shared one did. -1 if the row has to be highlighted itself.
+int line_cache_highlighted(const erow* row, int in_comment){
+    struct line_cache* c = row_cache(row);
+    return c && c->in_comment == in_comment ? c->out_comment : -1;
+}
+
+// A row was just highlighted from a pooled payload that has other owners: its render, hl and
+// cols become the ones the others share.
+void line_cache_donate(erow* row, int in_comment, int out_comment){
+    if(row->chars == NULL || row->chunks || row->render == NULL || row->hl == NULL) return;
+    struct line_header* h = LINE_HEADER(row->chars);
+    if(!h->pooled || h->refs < 2 || h->cache) return;
+    struct line_cache* c = mem_alloc(MEM_POOL, sizeof(struct line_cache));
+    if(c == NULL) error("malloc");
+    *c = (struct line_cache){ row->render, row->hl, row->cols, row->rsize, row->col_count, in_comment, out_comment };
+    h->cache = c;
+}
+
+// Put a row the loader built (see file-loader.c) in the pool: it gives up its payload for the one
+// an identical line has, and its render and hl too when the comment state going in is the same.
+// Returns 1 if there was such a line.
+int line_intern_row(erow* row, int in_comment){
+    struct line_header* own = LINE_HEADER(row->chars);
+    if(row->chunks || own->pooled || own->cap != row->size + 1) return 0;
+    uint32_t hash = pool_hash(row->chars, row->size);
+    struct line_header* h = pool_find(row->chars, row->size, hash);
+    if(h == NULL){
+        // the first of its kind, loaded payloads are exactly their size
+        pool_insert(own, hash);
+        return 0;
+    }
+    line_release(row->chars);
+    row->chars = line_share((char*)(h + 1));
+    if(h->cache && h->cache->in_comment == in_comment) line_cache_adopt(row);
+    else line_cache_donate(row, in_comment, row->hl_open_comment);
+    return 1;
+}
@@ -0,0 +1,267 @@
+
+#include "editor.h"
+
+/* ------------------------------------ long rows ------------------------------------ */
+// One huge line (minified javascript, a JSON dump) would make every keystroke rebuild its whole
+// render and hl. Rows over LONG_ROW_MIN bytes are split into chunks of about CHUNK_SIZE bytes of
+// chars instead, each with its own render, hl and column checkpoints:
+// - an edit re-renders the chunks it touched, the ones after it only have their positions moved
+// - highlighting goes chunk by chunk and skips every chunk that starts in the same state as before
+// - drawing and column lookups only look at the chunks they need
+// chars stays one buffer, the chunks are only about what is built from it.
+//
+// Chunks end after a blank, ';', ',' or a bracket when there is one close by, so keywords, numbers,
+// comment markers and escapes are never cut in two and a chunk highlights the same as the row would.
+
+#define LONG_ROW_MIN (64 * 1024)
+#define CHUNK_SIZE (8 * 1024)
+#define CHUNK_SLACK 1024 // how far past CHUNK_SIZE to look for a good place to end a chunk
+
+// rows stay chunked down to half the limit, so editing around it doesn't rebuild them every time
+int editor_row_wants_chunks(const erow* row){
+    return row->size >= LONG_ROW_MIN || (row->chunks && row->size >= LONG_ROW_MIN / 2);
+}
+
+static int chunk_coord(const struct row_pos* p, int coord){
+    return coord == POS_CX ? p->cx : coord == POS_BX ? p->bx : p->rx;
+}
+
+// where the chunk starting at from ends, for a row (or part of one) that ends at limit
+static int chunk_split(const erow* row, int from, int limit){
+    if(limit - from < CHUNK_SIZE + CHUNK_SIZE / 2) return limit; // no tiny chunk at the end
+    int end = from + CHUNK_SIZE;
+    for(int i = end; i < end + CHUNK_SLACK; ++i){
+        if(row->chars[i] && strchr(" \t;,()[]", row->chars[i])) return i + 1;
+    }
+    // no separator close by: between two letters or digits doesn't cut a comment marker or an
+    // escape in two, at least
+    for(int i = end; i < end + CHUNK_SLACK; ++i){
+        if(isalnum((unsigned char) row->chars[i - 1]) && isalnum((unsigned char) row->chars[i])) return i;
+    }
+    while(end > from + 1 && (row->chars[end] & 0xC0) == 0x80) --end; // or a character
+    return end;
+}
+
+static void chunk_free(struct row_chunk* c){
+    int len = c->end.bx - c->start.bx;
+    mem_free(MEM_RENDER, c->render, len + 1);
+    mem_free(MEM_HL, c->hl, len);
+    mem_free(MEM_RENDER, c->cols, sizeof(struct row_pos) * c->col_count);
+    c->render = NULL;
+    c->hl = NULL;
+    c->cols = NULL;
+    c->col_count = 0;
+}
+
+// render size bytes of chars from start into c, which must not hold anything yet
+static void chunk_build(const erow* row, struct row_chunk* c, struct row_pos start, int size){
+    c->start = start;
+    c->cols = NULL;
+    c->col_count = 0;
+    c->end = editor_build_columns(row, start, size, &c->cols, &c->col_count);
+    int len = c->end.bx - start.bx;
+    c->render = mem_alloc(MEM_RENDER, len + 1);
+    c->hl = mem_alloc(MEM_HL, len);
+    if(c->render == NULL || c->hl == NULL) error("malloc");
+    editor_render_span(row, start, size, c->render);
+    c->render[len] = '\0';
+    c->tabs = memchr(row->chars + start.cx, '\t', size) != NULL;
+    c->hl_done = 0;
+}
+
+// split the whole row into chunks, called by editor_update_render for rows that want them
+void editor_chunk_row(erow* row){
+    editor_unchunk_row(row);
+    int n = 0;
+    for(int at = 0; at < row->size; at = chunk_split(row, at, row->size)) ++n;
+    row->chunks = mem_alloc(MEM_RENDER, sizeof(struct row_chunk) * n);
+    if(row->chunks == NULL) error("malloc");
+    row->num_chunks = n;
+
+    struct row_pos p = { 0, 0, 0 };
+    int at = 0;
+    for(int k = 0; k < n; ++k){
+        int next = chunk_split(row, at, row->size);
+        chunk_build(row, &row->chunks[k], p, next - at);
+        p = row->chunks[k].end;
+        at = next;
+    }
+    row->rsize = p.bx;
+}
+
+void editor_unchunk_row(erow* row){
+    for(int k = 0; k < row->num_chunks; ++k) chunk_free(&row->chunks[k]);
+    mem_free(MEM_RENDER, row->chunks, sizeof(struct row_chunk) * row->num_chunks);
+    row->chunks = NULL;
+    row->num_chunks = 0;
+}
+
+// The bytes [at, at+removed) of row were replaced by inserted bytes, chars already holds the
+// result. Instead of editor_update_row's full re-render: rebuild the chunks that held the change,
+// shift the rest and re-highlight what changed.
+void editor_update_row_span(erow* row, int at, int removed, int inserted){
+    if(!row->chunks || !editor_row_wants_chunks(row)){
+        editor_update_row(row);
+        return;
+    }
+    ++state.changes;
+    struct row_chunk* chunks = row->chunks;
+    int n = row->num_chunks;
+
+    // the chunks [j, k] held the removed bytes, the positions in them are still from before the edit
+    int j = editor_chunk_at(row, POS_CX, at);
+    int k = j;
+    while(k + 1 < n && chunks[k + 1].start.cx < at + removed) ++k;
+    // a chunk ends on the character it was split after, if that goes the split moves too
+    if(removed > 0 && at + removed >= chunks[k].end.cx && k + 1 < n) ++k;
+    int size = chunks[k].end.cx - chunks[j].start.cx + inserted - removed;
+    if(size < CHUNK_SIZE / 4 && k + 1 < n){
+        // deleting keeps chunks from getting small, merge it into the next one
+        ++k;
+        size += chunks[k].end.cx - chunks[k].start.cx;
+    }
+    struct row_pos start = chunks[j].start, old_end = chunks[k].end;
+
+    // what they become, most often just one chunk again
+    int m = 0;
+    for(int p = start.cx; p < start.cx + size; p = chunk_split(row, p, start.cx + size)) ++m;
+    for(int i = j; i <= k; ++i) chunk_free(&chunks[i]);
+    int gone = k - j + 1;
+    if(m > gone){
+        chunks = mem_realloc(MEM_RENDER, chunks, sizeof(struct row_chunk) * n, sizeof(struct row_chunk) * (n + m - gone));
+        if(chunks == NULL) error("realloc");
+        memmove(&chunks[j + m], &chunks[k + 1], sizeof(struct row_chunk) * (n - k - 1));
+    }else if(m < gone){
+        memmove(&chunks[j + m], &chunks[k + 1], sizeof(struct row_chunk) * (n - k - 1));
+        chunks = mem_realloc(MEM_RENDER, chunks, sizeof(struct row_chunk) * n, sizeof(struct row_chunk) * (n + m - gone));
+    }
+    n += m - gone;
+    row->chunks = chunks;
+    row->num_chunks = n;
+
+    struct row_pos p = start;
+    int from = start.cx;
+    for(int i = j; i < j + m; ++i){
+        int next = chunk_split(row, from, start.cx + size);
+        chunk_build(row, &chunks[i], p, next - from);
+        p = chunks[i].end;
+        from = next;
+    }
+
+    // the chunks after only move, unless they have tabs and moved by part of a tab stop
+    struct row_pos d = { p.cx - old_end.cx, p.bx - old_end.bx, p.rx - old_end.rx };
+    for(int i = j + m; i < n; ++i){
+        struct row_chunk* c = &chunks[i];
+        if(c->tabs && d.rx % TAB_STOP != 0){
+            struct row_pos was = c->end;
+            int len = c->end.cx - c->start.cx;
+            chunk_free(c);
+            chunk_build(row, c, p, len);
+            d.bx = c->end.bx - was.bx;
+            d.rx = c->end.rx - was.rx;
+        }else{
+            c->start = p;
+            c->end.cx += d.cx;
+            c->end.bx += d.bx;
+            c->end.rx += d.rx;
+        }
+        p = c->end;
+    }
+    row->rsize = p.bx;
+    row->wrap_cols = 0;
+    editor_update_syntax(row);
+}
+
+static int hl_state_equal(const struct hl_state* a, const struct hl_state* b){
+    return a->in_comment == b->in_comment && a->in_string == b->in_string &&
+           a->line_comment == b->line_comment;
+}
+
+// editor_highlight_row for a chunked row: a chunk whose hl is up to date for the state it starts
+// in is skipped, so after an edit this costs one chunk (or the few a new /* reaches)
+int editor_highlight_chunks(erow* row, int in_comment){
+    struct hl_state st = { in_comment, 0, 0 };
+    for(int k = 0; k < row->num_chunks; ++k){
+        struct row_chunk* c = &row->chunks[k];
+        if(c->hl_done && hl_state_equal(&c->hl_in, &st)){
+            st = c->hl_out;
+            continue;
+        }
+        c->hl_in = st;
+        editor_highlight_span(c->render, c->hl, c->end.bx - c->start.bx, &st);
+        c->hl_out = st;
+        c->hl_done = 1;
+    }
+    return st.in_comment;
+}
+
+// the chunk of a chunked row that value (enum pos_coord coordinate coord) is in
+int editor_chunk_at(const erow* row, int coord, int value){
+    int lo = 0, hi = row->num_chunks - 1; // the last chunk starting at or before value
+    while(lo < hi){
+        int mid = (lo + hi + 1) / 2;
+        if(chunk_coord(&row->chunks[mid].start, coord) <= value) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Points render and hl at byte bx of the row's render and returns how many bytes from there are
+// in one piece: the rest of the row, or of the chunk for a chunked row. 0 at the end of the row.
+int editor_row_render_at(const erow* row, int bx, char** render, uint8_t** hl){
+    if(bx >= row->rsize) return 0;
+    if(!row->chunks){
+        *render = row->render + bx;
+        *hl = row->hl + bx;
+        return row->rsize - bx;
+    }
+    const struct row_chunk* c = &row->chunks[editor_chunk_at(row, POS_BX, bx)];
+    *render = c->render + bx - c->start.bx;
+    *hl = c->hl + bx - c->start.bx;
+    return c->end.bx - bx;
+}
+
+// copy render bytes [from, to) of a chunked row into out, whichever chunks they are in
+static void chunk_copy_render(const erow* row, int from, int to, char* out){
+    char* render;
+    uint8_t* hl;
+    while(from < to){
+        int n = editor_row_render_at(row, from, &render, &hl);
+        if(n > to - from) n = to - from;
+        memcpy(out, render, n);
+        out += n;
+        from += n;
+    }
+}
+
+// bx of the first match of query in the row's render, or -1. In a chunked row every chunk is
+// searched on its own, and a match across the end of a chunk is looked for in a copy of the
+// len-1 bytes on both sides of it.
+int editor_row_find(const erow* row, const char* query){
+    if(!row->chunks){
+        char* match = strstr(row->render, query);
+        return match ? match - row->render : -1;
+    }
+    int len = strlen(query);
+    char* seam = len > 1 ? malloc(2 * len - 1) : NULL;
+    if(len > 1 && seam == NULL) error("malloc");
+    int found = -1;
+    for(int k = 0; k < row->num_chunks && found == -1; ++k){
+        const struct row_chunk* c = &row->chunks[k];
+        char* match = strstr(c->render, query);
+        if(match){
+            found = c->start.bx + (match - c->render);
+        }else if(seam && k + 1 < row->num_chunks){
+            // anything found here starts in this chunk and ends in the ones after it
+            int from = c->end.bx - (len - 1), to = c->end.bx + (len - 1);
+            if(from < 0) from = 0;
+            if(to > row->rsize) to = row->rsize;
+            chunk_copy_render(row, from, to, seam);
+            seam[to - from] = '\0';
+            match = strstr(seam, query);
+            if(match) found = from + (match - seam);
+        }
+    }
+    free(seam);
+    return found;
+}
@@ -0,0 +1,128 @@
+
+#include "editor.h"
+
+/* ------------------------------------ lz codec ------------------------------------ */
+// A small LZ77 codec in the style of LZ4, fast enough to run between keystrokes. Used for rows
+// nobody has looked at for a while, see cold-rows.c. The output is a list of sequences:
+//
+//   token    high 4 bits: literal count, low 4 bits: match length - LZ_MIN_MATCH
+//            (15 in either means more length bytes follow, each adding 0..255, until one < 255)
+//   literals copied as they are
+//   offset   2 bytes, little endian, how far back the match starts
+//
+// The last sequence has only literals, which is how the decoder knows it is done.
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_TAIL 5 // the last bytes are always literals, so matching never reads past the end
+
+static uint32_t lz_read32(const unsigned char* p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int lz_hash(uint32_t v){
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// a length of 15 or more, after the 15 already in the token
+static unsigned char* lz_put_len(unsigned char* op, int len){
+    for(len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+static const unsigned char* lz_get_len(const unsigned char* ip, const unsigned char* end, int* len){
+    int b;
+    do{
+        if(ip == end) return NULL;
+        b = *ip++;
+        *len += b;
+    }while(b == 255);
+    return ip;
+}
+
+static unsigned char* lz_put_sequence(unsigned char* op, const unsigned char* lit, int lit_len){
+    unsigned char* token = op++;
+    *token = (lit_len < 15 ? lit_len : 15) << 4;
+    if(lit_len >= 15) op = lz_put_len(op, lit_len);
+    memcpy(op, lit, lit_len);
+    return op + lit_len;
+}
+
+// the most lz_compress can write for n bytes, when nothing in them repeats
+int lz_bound(int n){
+    return n + n / 255 + 16;
+}
+
+// compress n bytes of src into dst, which has room for lz_bound(n). Returns the compressed size.
+int lz_compress(const char* src, int n, char* dst){
+    const unsigned char* in = (const unsigned char*) src;
+    const unsigned char* ip = in, *anchor = in, *end = in + n;
+    const unsigned char* limit = n > LZ_TAIL + LZ_MIN_MATCH ? end - LZ_TAIL - LZ_MIN_MATCH : in;
+    unsigned char* op = (unsigned char*) dst;
+    int table[1 << LZ_HASH_BITS]; // where each hash was last seen, +1 so 0 is "nowhere"
+    memset(table, 0, sizeof(table));
+
+    while(ip < limit){
+        uint32_t v = lz_read32(ip);
+        int h = lz_hash(v);
+        int seen = table[h];
+        table[h] = ip - in + 1;
+        const unsigned char* ref = seen ? in + seen - 1 : ip;
+        if(ref == ip || ip - ref > 0xffff || lz_read32(ref) != v){
+            ++ip;
+            continue;
+        }
+        const unsigned char* mp = ip + LZ_MIN_MATCH, *rp = ref + LZ_MIN_MATCH;
+        while(mp < end - LZ_TAIL && *mp == *rp){
+            ++mp;
+            ++rp;
+        }
+        int match = mp - ip - LZ_MIN_MATCH;
+        unsigned char* token = op;
+        op = lz_put_sequence(op, anchor, ip - anchor);
+        *token |= match < 15 ? match : 15;
+        int offset = ip - ref;
+        *op++ = offset;
+        *op++ = offset >> 8;
+        if(match >= 15) op = lz_put_len(op, match);
+        ip = anchor = mp;
+    }
+    op = lz_put_sequence(op, anchor, end - anchor);
+    return op - (unsigned char*) dst;
+}
+
+// Decompress n bytes of src into dst, which has room for cap bytes. Returns the decompressed size,
+// -1 if src isn't something lz_compress wrote or doesn't fit.
+int lz_decompress(const char* src, int n, char* dst, int cap){
+    const unsigned char* ip = (const unsigned char*) src, *end = ip + n;
+    unsigned char* out = (unsigned char*) dst, *op = out, *oend = out + cap;
+    while(ip < end){
+        int token = *ip++;
+        int lit = token >> 4;
+        if(lit == 15 && (ip = lz_get_len(ip, end, &lit)) == NULL) return -1;
+        if(lit > end - ip || lit > oend - op) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if(ip == end) break; // the last sequence, no match after it
+
+        if(end - ip < 2) return -1;
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        int match = token & 15;
+        if(match == 15 && (ip = lz_get_len(ip, end, &match)) == NULL) return -1;
+        match += LZ_MIN_MATCH;
+        if(offset == 0 || offset > op - out || match > oend - op) return -1;
+        const unsigned char* ref = op - offset;
+        if(offset >= match){
+            memcpy(op, ref, match);
+            op += match;
+        }else{
+            while(match--) *op++ = *ref++; // overlaps what it is writing, a run
+        }
+    }
+    return op - out;
+}
@@ -0,0 +1,148 @@
+
+#include "editor.h"
+
+/* ------------------------------------ macros ------------------------------------ */
+// q{a-z} records every key editor_read_key hands out until the next q, @{a-z} plays it back
+// (@@ repeats the last one, 50@a plays it 50 times). Playback feeds the keys to the normal
+// keypress handling straight from memory: the screen is not redrawn until the whole replay is
+// done, and everything it changed is one undo group, so a single u takes all of it back.
+
+#define NUM_MACROS 26
+#define MACRO_MAX_DEPTH 100 // @a inside of a itself would otherwise never stop
+
+struct macro {
+    char* keys;
+    int len;
+    int cap;
+};
+
+// one running @x, the top of the stack is where editor_read_key takes its keys from
+struct replay_frame {
+    char* keys; // own copy, the register can be re-recorded while we are playing it
+    int len;
+    int pos;
+    int repeats; // plays left, including the current one
+};
+
+static struct macro macros[NUM_MACROS];
+static int recording = -1; // index of the macro being recorded, -1 if none
+static int last_played = -1;
+
+static struct replay_frame frames[MACRO_MAX_DEPTH];
+static int depth = 0;   // frames with keys left
+static int nesting = 0; // editor_macro_play calls on the C stack, a finished frame can still be running
+
+static int macro_index(int name){
+    if(name >= 'a' && name <= 'z') return name - 'a';
+    return -1;
+}
+
+void editor_macro_record(int name){
+    int i = macro_index(name);
+    if(i == -1){
+        editor_set_status_msg("Invalid register: %c", name);
+        return;
+    }
+    recording = i;
+    macros[i].len = 0;
+    editor_set_status_msg("recording @%c", name);
+}
+
+void editor_macro_stop(){
+    if(recording == -1) return;
+    // the q that stopped the recording was recorded as well
+    if(macros[recording].len > 0) --macros[recording].len;
+    editor_set_status_msg("recorded @%c (%d keys)", recording + 'a', macros[recording].len);
+    recording = -1;
+}
+
+// name of the register being recorded into, 0 if not recording
+int editor_macro_recording(){
+    return recording == -1 ? 0 : recording + 'a';
+}
+
+int editor_macro_replaying(){
+    return depth > 0;
+}
+
+// Next key of the innermost replay, -1 once there is nothing left to replay. A frame is popped
+// as soon as its last key is handed out, so editor_macro_play knows exactly when its macro ended.
+int editor_macro_next_key(){
+    if(depth == 0) return -1;
+    struct replay_frame* f = &frames[depth - 1];
+    int c = (unsigned char) f->keys[f->pos++];
+    if(f->pos == f->len){
+        if(--f->repeats > 0){
+            f->pos = 0;
+        }else{
+            free(f->keys);
+            --depth;
+        }
+    }
+    return c;
+}
+
+// called by editor_read_key for every key typed by the user
+void editor_macro_record_key(int c){
+    if(recording == -1) return;
+    struct macro* m = &macros[recording];
+    if(m->len == m->cap){
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->keys = realloc(m->keys, m->cap);
+    }
+    m->keys[m->len++] = c;
+}
+
+static void macro_run(const char* keys, int len, int count){
+    struct replay_frame* f = &frames[depth++];
+    f->keys = malloc(len);
+    memcpy(f->keys, keys, len);
+    f->len = len;
+    f->pos = 0;
+    f->repeats = count < 1 ? 1 : count;
+
+    // only the outermost replay opens an undo group, a nested @b belongs to the same one
+    int grouped = editor_undo_group_begin();
+
+    ++nesting;
+    int base = depth;
+    while(depth >= base){
+        editor_process_key(editor_read_key());
+    }
+    --nesting;
+
+    if(grouped) editor_undo_group_end();
+}
+
+void editor_macro_play(int name, int count){
+    int i = name == '@' ? last_played : macro_index(name);
+    if(i == -1){
+        editor_set_status_msg(name == '@' ? "No previous macro" : "Invalid register: %c", name);
+        return;
+    }
+    if(macros[i].len == 0){
+        editor_set_status_msg("Register %c is empty", i + 'a');
+        return;
+    }
+    if(nesting == MACRO_MAX_DEPTH){
+        // give up on the whole replay, every editor_macro_play below us returns once depth is 0
+        while(depth > 0) free(frames[--depth].keys);
+        editor_set_status_msg("Macros nested too deeply");
+        return;
+    }
+    if(nesting == 0) last_played = i;
+    macro_run(macros[i].keys, macros[i].len, count);
+}
+
+// feed keys through the keypress handling as if they were typed, used by -s scripts
+void editor_run_keys(const char* keys, int len){
+    if(len > 0) macro_run(keys, len, 1);
+}
+
+void editor_free_macros(){
+    while(depth > 0) free(frames[--depth].keys);
+    for(int i = 0; i < NUM_MACROS; ++i){
+        free(macros[i].keys);
+        macros[i] = (struct macro){0};
+    }
+}
@@ -12,13 +12,32 @@ void error(const char* s){
 
 /* --------------------------------------- program init --------------------------------------- */
 int main(int argc, char** argv){
-    enable_raw();
-    init_editor();
-    if(argc >= 2){
-        editor_open(argv[1]);
+    if(argc >= 2 && strcmp(argv[1], "-s") == 0){
+        // notes.out -s script file...: no terminal, see batch-mode.c
+        if(argc < 4){
+            fprintf(stderr, "usage: %s -s script file...\n", argv[0]);
+            return 1;
+        }
+        return editor_batch(argv[2], argv + 3, argc - 3);
     }
 
+    enable_raw();
+    init_editor();
     editor_set_status_msg("movement: vim");
+    // notes.out +F file follows it like less +F, notes.out -R file pages through it read-only
+    int follow = argc >= 3 && strcmp(argv[1], "+F") == 0;
+    int pager = argc >= 3 && strcmp(argv[1], "-R") == 0;
+    if(follow || pager){
+        ++argv;
+        --argc;
+    }
+    if(argc >= 2 && (pager || editor_pager_too_big(argv[1]))){
+        editor_pager_open(argv[1]); // only rows around the cursor are ever built, see pager.c
+    }else if(argc >= 2){
+        editor_open(argv[1]); // may replace the message, e.g. after recovering a swap file
+        editor_buffers_add(argv + 2, argc - 2); // the rest are read when first shown (:bn)
+        if(follow) editor_follow_toggle();
+    }
 
     while (1){
         editor_refresh_screen();
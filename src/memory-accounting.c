@@ -0,0 +1,144 @@
+
+#include "editor.h"
+
+/* ------------------------------------ memory accounting ------------------------------------ */
+// The editor's long lived structures are allocated through mem_alloc/mem_realloc/mem_free with a
+// subsystem tag, so :mem can show live and peak bytes per subsystem. The caller passes the size
+// on free and realloc (it always knows it: rsize + 1 for render, cap for payloads, ...), so
+// nothing is added to the allocations themselves. Short lived scratch buffers use plain malloc.
+//
+// The counters are only touched by the main thread. The loader's threads (file-loader.c) count
+// into a mem_batch of their own instead, which the main thread adds in once they are done.
+
+static const char* mem_names[MEM_NUM_TAGS] = {
+    "lines", "row table", "render", "hl", "undo", "registers", "search", "screen", "save", "wrap", "pager", "cold", "pool",
+};
+
+struct mem_count {
+    long live;
+    long peak;
+};
+
+static struct mem_count mem[MEM_NUM_TAGS];
+static struct mem_count total;
+
+static _Thread_local struct mem_batch* batch; // where this thread counts, NULL on the main thread
+
+static int overlay;
+
+static void mem_count_add(struct mem_count* c, long n){
+    c->live += n;
+    if(c->live > c->peak) c->peak = c->live;
+}
+
+static void mem_add(int tag, long n){
+    if(batch){
+        batch->live[tag] += n;
+        return;
+    }
+    mem_count_add(&mem[tag], n);
+    mem_count_add(&total, n);
+}
+
+static void mem_count_alloc(){
+    if(batch) ++batch->allocs;
+    else editor_perf_count_allocs(1);
+}
+
+// like malloc, NULL (and nothing counted) if it fails
+void* mem_alloc(int tag, size_t n){
+    void* p = malloc(n);
+    if(p == NULL && n > 0) return NULL;
+    mem_add(tag, n);
+    mem_count_alloc();
+    return p;
+}
+
+// old_n is how big p was, on failure p is left alone and NULL returned like realloc
+void* mem_realloc(int tag, void* p, size_t old_n, size_t new_n){
+    void* q = realloc(p, new_n);
+    if(q == NULL && new_n > 0) return NULL;
+    mem_add(tag, (long) new_n - (long) old_n);
+    mem_count_alloc();
+    return q;
+}
+
+void mem_free(int tag, void* p, size_t n){
+    if(p == NULL) return;
+    free(p);
+    mem_add(tag, -(long) n);
+}
+
+// n bytes that were counted under from now belong to to (e.g. rows moved into an undo entry)
+void mem_retag(int from, int to, long n){
+    if(from == to || n == 0) return;
+    mem_add(from, -n);
+    mem_add(to, n);
+}
+
+// until mem_batch_end, whatever the calling thread allocates or frees is counted in b only
+void mem_batch_begin(struct mem_batch* b){
+    memset(b, 0, sizeof(*b));
+    batch = b;
+}
+
+void mem_batch_end(){
+    batch = NULL;
+}
+
+// add what a thread counted in b to the counters, on the main thread once that thread is done
+void mem_batch_flush(struct mem_batch* b){
+    for(int i = 0; i < MEM_NUM_TAGS; ++i){
+        if(b->live[i]) mem_add(i, b->live[i]);
+    }
+    editor_perf_count_allocs(b->allocs);
+}
+
+long mem_live(int tag){
+    return mem[tag].live;
+}
+
+long mem_peak(int tag){
+    return mem[tag].peak;
+}
+
+long mem_total_live(){
+    return total.live;
+}
+
+long mem_total_peak(){
+    return total.peak;
+}
+
+const char* mem_name(int tag){
+    return mem_names[tag];
+}
+
+int editor_mem_overlay(){
+    return overlay;
+}
+
+static double mb(long bytes){
+    return bytes / (1024.0 * 1024.0);
+}
+
+// the panel goes below the perf overlay when both are shown
+void editor_draw_mem_overlay(struct abuf* ab){
+    int line = editor_perf_overlay() ? 7 : 1;
+    editor_draw_overlay_line(ab, line++, " %-10s %10s %10s ", "memory", "live MB", "peak MB");
+    for(int i = 0; i < MEM_NUM_TAGS; ++i){
+        editor_draw_overlay_line(ab, line++, " %-10s %10.2f %10.2f ", mem_names[i], mb(mem[i].live), mb(mem[i].peak));
+    }
+    editor_draw_overlay_line(ab, line, " %-10s %10.2f %10.2f ", "total", mb(total.live), mb(total.peak));
+}
+
+// :mem toggles the panel, and says where most of the memory is right now
+void editor_mem_command(){
+    overlay = !overlay;
+    int biggest = 0;
+    for(int i = 1; i < MEM_NUM_TAGS; ++i){
+        if(mem[i].live > mem[biggest].live) biggest = i;
+    }
+    editor_set_status_msg("%.1f MB live, largest: %s %.1f MB", mb(total.live),
+                          mem_names[biggest], mb(mem[biggest].live));
+}
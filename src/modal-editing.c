@@ -2,19 +2,44 @@
 #include <stdio.h>
 #include "editor.h"
 
+// Reads a count (any number of digits) starting with c, leaving the key after it in *next.
+// Returns 0 if there was no count. A leading '0' is not a count, it is the "start of line" motion.
+int read_count(int c, int* next){
+    int count = 0;
+    while(isdigit(c) && (c != '0' || count > 0)){
+        if(count < 100000000) count = count * 10 + (c - '0');
+        c = editor_read_key();
+    }
+    *next = c;
+    return count;
+}
+
+#define COUNT_MAX 999999999 // the most read_count gives
+
+// 99d99j: the two counts multiplied, saturating at COUNT_MAX instead of overflowing
+static int count_product(int a, int b){
+    long n = (long) a * b;
+    return n > COUNT_MAX ? COUNT_MAX : n;
+}
+
 void read_normal_mode(int c){
-    char second_char;
-    int bytes_read;
-
-    // check if it is a relative jump
-    if(isdigit(c)){
-        if(read(STDIN_FILENO, &second_char, 1) != 1) error("read");
-        c = c - '0';
-        while(c--){
-            move_cursor(second_char);
-        }
+    // 1000j, 3dw, 50x: the count applies to the whole command
+    int count = read_count(c, &c);
+    if(count) editor_cold_key(c, count); // what the count applies to decides what it reads
+    if(editor_pager_active() && !editor_pager_allows(c, count)) return; // see pager.c
+    if(c == '.'){
+        editor_repeat_change(count);
         return;
     }
+    editor_change_begin(c, count);
+    editor_normal_command(c, count);
+    editor_change_end(c);
+}
+
+// one normal mode command, c is its first key after the count (0 if there was none)
+void editor_normal_command(int c, int count){
+    int second_char, motion_count;
+    int n = count ? count : 1;
 
     switch(c){
         case ':':
@@ -22,10 +47,12 @@ void read_normal_mode(int c){
             break;
         case 'V':
             state.mode = VISUAL_MODE;
-            read_visual_line_mode(c);
+            state.visual_anchor = state.cy;
             break;
         case CTRL_KEY('d'):
-            if(state.cy < state.num_rows - 10){
+            if(state.wrap){
+                editor_wrap_move(10); // screen lines, a row can be taller than the screen
+            }else if(state.cy < state.num_rows - 10){
                 state.cy += 10;
             }else{
                 state.cy = state.num_rows - 1;
@@ -34,8 +61,13 @@ void read_normal_mode(int c){
         case CTRL_KEY('r'):
             editor_redo();
             break;
+        case CTRL_KEY('w'): // Ctrl-W w, h, j, k, l, s, v, c, o: split windows
+            editor_window_command(editor_read_key());
+            break;
         case CTRL_KEY('u'):
-            if(state.cy >= 10){
+            if(state.wrap){
+                editor_wrap_move(-10);
+            }else if(state.cy >= 10){
                 state.cy -= 10;
             }else{
                 state.cy = 0;
@@ -52,22 +84,23 @@ void read_normal_mode(int c){
                 state.cx = state.row[state.cy].size;
             }
             break;
-        case 'G':
-            state.cy = state.num_rows - 1;
+        case 'G': // 50G goes to line 50
+            if(editor_pager_active() && !count) editor_pager_goto(-1); // the rows aren't all of the file
+            else editor_goto_line(count ? count : state.num_rows);
             break;
         case 'g':
-            if(read(STDIN_FILENO, &second_char, 1) == 1 && second_char == 'g'){
-                state.cy = 0;
+            if(editor_read_key() == 'g'){
+                editor_goto_line(count ? count : 1);
             }
             break;
         case '/':
             editor_find();
             break;
         case BACKSPACE:
-            move_cursor('h');
+            move_cursor_count('h', n);
             break;
         case '\r':
-            move_cursor('j');
+            move_cursor_count('j', n);
             break;
         case 'I':
             state.cx = 0;
@@ -108,42 +141,40 @@ void read_normal_mode(int c){
             state.mode = INSERT_MODE;
             break;
         case 'c':
-            if(read(STDIN_FILENO, &second_char, 1) == 1 && second_char == 'w'){
-                editor_delete_word();
+            // c3w and 3cw both change three words
+            motion_count = read_count(editor_read_key(), &second_char);
+            if(motion_count) n = count_product(n, motion_count);
+            if(second_char == 'w'){
+                editor_delete_words(n);
             }
             state.mode = INSERT_MODE;
             break;
         case 'd':
-            bytes_read = read(STDIN_FILENO, &second_char, 1);
-            if(bytes_read && second_char == 'w'){
-                editor_delete_word();
-            }else if(bytes_read && second_char == 'd'){
-                state.cx = 0;
-                if(state.cy >= 0 && state.cy < state.num_rows){
+            motion_count = read_count(editor_read_key(), &second_char);
+            if(motion_count) n = count_product(n, motion_count);
+            if(second_char == 'w'){
+                editor_delete_words(n);
+            }else if(second_char == 'd'){
+                // 3dd: this line and the two below it
+                if(state.cy < state.num_rows){
                     state.cx = 0;
-                    editor_delete_row(state.cy);
+                    editor_delete_lines(state.cy, n);
                     if(state.cy >= state.num_rows) state.cy = state.num_rows - 1;
+                    if(state.cy < 0) state.cy = 0;
                 }
-            }else if(bytes_read && second_char == 'g'){
-                bytes_read = read(STDIN_FILENO, &second_char, 1);
-                if(bytes_read && second_char == 'g'){
+            }else if(second_char == 'g'){
+                if(editor_read_key() == 'g'){
                     editor_delete_to_top();  // Deletes all lines to the top, including current
                 }
-            }else if(bytes_read && second_char == 'G'){
+            }else if(second_char == 'G'){
                 editor_delete_to_bottom();  // Deletes all lines to the bottom, including current
-            }else if(bytes_read && isdigit(second_char)){
-                int value = second_char - '0';
-                bytes_read = read(STDIN_FILENO, &second_char, 1);
-                if(bytes_read){
-                    editor_delete_in_direction(second_char, value);
-                }
-            }else if(bytes_read){
+            }else{
                 switch(second_char){
                     case 'h':
                     case 'j':
                     case 'k':
                     case 'l':
-                        editor_delete_in_direction(second_char, 1);
+                        editor_delete_in_direction(second_char, n);
                         break;
                 }
             }
@@ -151,16 +182,60 @@ void read_normal_mode(int c){
         case 'D':
             editor_delete_to_eol();
             break;
+        case 'q':
+            if(editor_macro_recording()){
+                editor_macro_stop();
+            }else{
+                editor_macro_record(editor_read_key());
+            }
+            break;
+        case '@': // @a, 50@a, @@
+            editor_macro_play(editor_read_key(), n);
+            break;
+        case '"':
+            second_char = editor_read_key();
+            if(!editor_select_register(second_char)){
+                editor_set_status_msg("Invalid register: %c", second_char);
+            }
+            break;
+        case 'y':
+            if(state.cy >= state.num_rows) break;
+            motion_count = read_count(editor_read_key(), &second_char);
+            if(motion_count) n = count_product(n, motion_count);
+            if(second_char == 'y'){
+                editor_yank_rows(state.cy, n < state.num_rows - state.cy ? n : state.num_rows - state.cy);
+            }else if(second_char == 'G'){
+                editor_yank_rows(state.cy, state.num_rows - state.cy);
+            }else if(second_char == 'g'){
+                if(editor_read_key() == 'g'){
+                    editor_yank_rows(0, state.cy + 1);
+                }
+            }else if(second_char == 'j'){
+                editor_yank_rows(state.cy, n < state.num_rows - 1 - state.cy ? n + 1 : state.num_rows - state.cy);
+            }else if(second_char == 'k' && state.cy > 0){
+                if(n > state.cy) n = state.cy;
+                editor_yank_rows(state.cy - n, n + 1);
+            }
+            break;
+        case 'p':
+            editor_put(1, n);
+            break;
+        case 'P':
+            editor_put(0, n);
+            break;
         case 'x':
-            if(state.cy<state.num_rows && (state.cx + 1) <= state.row[state.cy].size){
-                ++state.cx;
-                editor_delete_char();
+            // 50x is a single span delete, of n characters rather than bytes
+            if(state.cy < state.num_rows){
+                erow* row = &state.row[state.cy];
+                int end = state.cx;
+                for(int k = 0; k < n && end < row->size; ++k) end = utf8_next(row->chars, row->size, end);
+                editor_delete_span(state.cx, end - state.cx);
             }
             break;
         case 'r':
-            if(read(STDIN_FILENO, &second_char, 1) == 1){
+            if((second_char = editor_read_key())){
                 if(state.cy<state.num_rows && (state.cx + 1) <= state.row[state.cy].size){
-                    ++state.cx;
+                    state.cx = utf8_next(state.row[state.cy].chars, state.row[state.cy].size, state.cx);
                     editor_delete_char();
                 }
                 editor_insert_char(second_char);
@@ -168,24 +243,20 @@ void read_normal_mode(int c){
             }
             break;
         case 'F':
-            if(read(STDIN_FILENO, &second_char, 1) == 1){
-                move_backwards_F(second_char);
-            }
+            second_char = editor_read_key();
+            while(n--) move_backwards_F(second_char);
             break;
         case 'f':
-            if(read(STDIN_FILENO, &second_char, 1) == 1){
-                move_forwards_F(second_char);
-            }
+            second_char = editor_read_key();
+            while(n--) move_forwards_F(second_char);
             break;
         case 'T':
-            if(read(STDIN_FILENO, &second_char, 1) == 1){
-                move_backwards_T(second_char);
-            }
+            second_char = editor_read_key();
+            while(n--) move_backwards_T(second_char);
             break;
         case 't':
-            if(read(STDIN_FILENO, &second_char, 1) == 1){
-                move_forwards_T(second_char);
-            }
+            second_char = editor_read_key();
+            while(n--) move_forwards_T(second_char);
             break;
         case 'w':
         case 'e':
@@ -194,7 +265,7 @@ void read_normal_mode(int c){
         case 'j':
         case 'k':
         case 'l':
-            move_cursor(c);
+            move_cursor_count(c, n);
             break;
         default: break;
     }
@@ -220,63 +291,118 @@ void read_insert_mode(int c){
     }
 }
 
+// first and last row of the visual-line selection (anchor to cursor, either way around)
+void editor_visual_range(int* lo, int* hi){
+    *lo = state.visual_anchor < state.cy ? state.visual_anchor : state.cy;
+    *hi = state.visual_anchor < state.cy ? state.cy : state.visual_anchor;
+    if(*hi >= state.num_rows) *hi = state.num_rows - 1;
+}
+
+// Rows between the anchor (where V was pressed) and the cursor are selected. They are drawn
+// inverted by editor_draw_rows, so nothing has to be painted into hl or restored afterwards.
 void read_visual_line_mode(int c){
     if(!state.row) return;
-    static uint8_t* saved_line_hl = NULL;
-    int len = state.row[state.cy].size;
-    if(!saved_line_hl){
-        saved_line_hl = malloc(len);
-        memcpy(saved_line_hl, state.row[state.cy].hl, len);
-    }
+    int count;
+    int lo, hi;
+    editor_visual_range(&lo, &hi);
+    int n = hi - lo + 1;
 
     switch(c){
+        case 'V':
+            state.visual_anchor = state.cy;
+            break;
         case '\x1b':
             state.mode = NORMAL_MODE;
-            memcpy(state.row[state.cy].hl, saved_line_hl, len);
-            free(saved_line_hl);
-            saved_line_hl = NULL;
-
-            return;
+            break;
         case 'd':
             state.mode = NORMAL_MODE;
-            memcpy(state.row[state.cy].hl, saved_line_hl, len);
-            free(saved_line_hl);
-            saved_line_hl = NULL;
-
-            if(state.cy >= 0 && state.cy < state.num_rows){
-                state.cx = 0;
-                editor_delete_row(state.cy);
-                if(state.cy >= state.num_rows) state.cy = state.num_rows - 1;
-                state.dirty = 1;
-            }
-            return;
-        case 'J': // move highlighted line down one space (swapping with line below)
-            if(state.cy < (state.num_rows - 1)){
-                erow temp = state.row[state.cy+1];
-                state.row[state.cy+1] = state.row[state.cy];
-                state.row[state.cy] = temp;
+            state.cx = 0;
+            state.cy = lo;
+            editor_delete_lines(lo, n);
+            if(state.cy >= state.num_rows) state.cy = state.num_rows - 1;
+            if(state.cy < 0) state.cy = 0;
+            break;
+        case 'y':
+            state.mode = NORMAL_MODE;
+            editor_yank_rows(lo, n);
+            state.cy = lo;
+            break;
+        case '>':
+        case '<':
+            editor_indent_rows(lo, n, c == '>' ? 1 : -1);
+            break;
+        case 'J': // move the selected lines down one line (the line below moves above them)
+            if(hi < state.num_rows - 1){
+                editor_move_rows(lo, n, 1);
                 ++state.cy;
+                ++state.visual_anchor;
             }
-            state.dirty = 1;
             break;
         case 'K': // Same as J but upwards
-            if(state.cy > 0){
-                erow temp = state.row[state.cy-1];
-                state.row[state.cy-1] = state.row[state.cy];
-                state.row[state.cy] = temp;
+            if(lo > 0){
+                editor_move_rows(lo, n, -1);
                 --state.cy;
+                --state.visual_anchor;
+            }
+            break;
+        case 'G':
+            state.cy = state.num_rows - 1;
+            break;
+        case 'g':
+            if(editor_read_key() == 'g'){
+                state.cy = 0;
+            }
+            break;
+        default:
+            // counted motions extend the selection: 100j
+            count = read_count(c, &c);
+            switch(c){
+                case 'h':
+                case 'j':
+                case 'k':
+                case 'l':
+                    move_cursor_count(c, count ? count : 1);
+                    break;
             }
-            state.dirty = 1;
             break;
     }
-    // highlight current line
-    memset(state.row[state.cy].hl, HL_VISUAL, len);
 }
 
 void read_command_mode(){
     char* query = editor_prompt(":%s", NULL);
+    if(query && editor_pager_active() && editor_pager_refuses(query)){
+        free(query);
+        return;
+    }
+    // whatever the command does may read any row, :perf and :mem only show numbers (see cold-rows.c)
+    if(query && strncmp(query, "perf", 4) != 0 && strcmp(query, "mem") != 0) editor_cold_thaw_all();
     if(query && (strlen(query) == 1 && (*query == 'w' || *query == 'W'))){
         editor_save();
+    }else if(query && strncmp(query, "perf", 4) == 0){
+        editor_perf_command(query + 4);
+    }else if(query && strcmp(query, "mem") == 0){
+        editor_mem_command();
+    }else if(query && strcmp(query, "wrap") == 0){
+        editor_wrap_toggle();
+    }else if(query && strcmp(query, "follow") == 0){
+        editor_follow_toggle();
+    }else if(query && strcmp(query, "e!") == 0){
+        editor_reload();
+    }else if(query && (strncmp(query, "e ", 2) == 0 || strcmp(query, "e") == 0)){
+        editor_buffer_edit(query + 1);
+    }else if(query && strcmp(query, "bn") == 0){
+        editor_buffer_next(1);
+    }else if(query && strcmp(query, "bp") == 0){
+        editor_buffer_next(-1);
+    }else if(query && strcmp(query, "ls") == 0){
+        editor_buffer_list();
+    }else if(query && (strncmp(query, "sp", 2) == 0 || strncmp(query, "vs", 2) == 0) &&
+             (query[2] == '\0' || query[2] == ' ')){
+        editor_window_split(query[0] == 'v', query + 2);
+    }else if(query && strcmp(query, "close") == 0){
+        editor_window_close();
+    }else if(query && strcmp(query, "only") == 0){
+        editor_window_only();
     }else if(query && (strlen(query) == 1 && (*query == 'q' || *query == 'Q'))){
         // TODO: warning from ctrl c that is already implemented
         exit(0);
@@ -295,7 +421,7 @@ void move_cursor(int c){
     switch (c) {
         case 'h':
             if(state.cx != 0){
-                --state.cx;
+                state.cx = utf8_prev(row->chars, state.cx); // a whole character
             }else if(state.cy > 0){
                 --state.cy;
                 state.cx = state.row[state.cy].size;
@@ -315,7 +441,7 @@ void move_cursor(int c){
             break;
         case 'l':
             if(state.cx < row->size){
-                ++state.cx;
+                state.cx = utf8_next(row->chars, row->size, state.cx);
             }else if(state.cy < (state.num_rows-1)){
                 ++state.cy;
                 state.cx = 0;
@@ -334,10 +460,53 @@ void move_cursor(int c){
     // snap the horizontal to the end of each line
     row = (state.cy >= state.num_rows) ? NULL : &state.row[state.cy];
 
-    int rowlen = row ? row->size : 0;
-    if (state.cx > rowlen) {
-        state.cx = rowlen;
+    // and onto a whole character
+    state.cx = row ? editor_row_snap_cx(row, state.cx) : 0;
+}
+
+// Count-aware motions: j/k/h/l land on the target directly instead of stepping count times.
+void move_cursor_count(int c, int count){
+    if(state.cy >= state.num_rows) return;
+    if(count <= 1){
+        move_cursor(c); // a single h/l can wrap onto the neighbouring line
+        return;
     }
+    int size = state.row[state.cy].size;
+    switch(c){
+        case 'j':
+            state.cy = (count < state.num_rows - 1 - state.cy) ? state.cy + count : state.num_rows - 1;
+            break;
+        case 'k':
+            state.cy = (count < state.cy) ? state.cy - count : 0;
+            break;
+        case 'h':
+            while(count-- && state.cx > 0) state.cx = utf8_prev(state.row[state.cy].chars, state.cx);
+            break;
+        case 'l':
+            while(count-- && state.cx < size) state.cx = utf8_next(state.row[state.cy].chars, size, state.cx);
+            break;
+        default:
+            // word motions depend on the text in between
+            while(count--) move_cursor(c);
+            return;
+    }
+    // snap the horizontal to the end of the line, and onto a whole character
+    editor_row_touch(&state.row[state.cy]); // 1000j can land on a frozen row, see cold-rows.c
+    state.cx = editor_row_snap_cx(&state.row[state.cy], state.cx);
+}
+
+// jump to a 1-based line number, clamped to the file
+void editor_goto_line(int line){
+    if(editor_pager_active()){
+        editor_pager_goto(line);
+        return;
+    }
+    if(state.num_rows == 0) return;
+    if(line < 1) line = 1;
+    if(line > state.num_rows) line = state.num_rows;
+    state.cy = line - 1;
+    editor_row_touch(&state.row[state.cy]);
+    state.cx = editor_row_snap_cx(&state.row[state.cy], state.cx);
 }
 
 void move_end_next_word() {
@@ -451,60 +620,50 @@ void move_forwards_T(int c) {
     }
 }
 void editor_delete_to_top() {
-    int i;
-    for(i = 0; i <= state.cy; ++i){
-        // continuously delete the first row
-        editor_delete_row(0);
-    }
+    editor_delete_lines(0, state.cy + 1);
     state.cx = 0;
     state.cy = 0;
 }
 
 void editor_delete_to_bottom() {
-    while (state.cy < state.num_rows) {
-        editor_delete_row(state.cy);
-    }
+    editor_delete_lines(state.cy, state.num_rows - state.cy);
     if (state.cy > 0) state.cy--;
     state.cx = 0;
 }
 
+// dNh and dNl count characters like h, l and x do, not bytes
 void editor_delete_in_direction(char direction, int value) {
-    int i, size;
+    int size, k;
+    erow* row = state.cy < state.num_rows ? &state.row[state.cy] : NULL;
     switch (direction) {
         case 'h':
-            for (i = 0; i < value && state.cx > 0; ++i) {
-                editor_delete_char();
-            }
+            if (row == NULL) break;
+            size = state.cx;
+            for (k = 0; k < value && size > 0; ++k) size = utf8_prev(row->chars, size);
+            editor_delete_span(size, state.cx - size);
+            state.cx = size;
             break;
         case 'l':
-            if(state.cy >= state.num_rows) break;
-            size = state.row[state.cy].size;
-            for (i = 0; i < value && state.cx < size; ++i) {
-                ++state.cx;
-                editor_delete_char();
-            }
+            if (row == NULL) break;
+            size = state.cx;
+            for (k = 0; k < value && size < row->size; ++k) size = utf8_next(row->chars, row->size, size);
+            editor_delete_span(state.cx, size - state.cx);
             break;
         case 'j':
-            for (i = 0; i <= value && state.cy < state.num_rows; ++i) {
-                editor_delete_row(state.cy);
-            }
+            // current row and value rows below it
+            editor_delete_lines(state.cy, value + 1);
+            if (state.cy >= state.num_rows && state.cy > 0) state.cy = state.num_rows - 1;
             break;
         case 'k':
-            for (i = 0; i <= value && state.cy > 0; ++i) {
-                editor_delete_row(state.cy);
-                --state.cy;
-            }
+            // current row and value rows above it (the first row is never included)
+            size = (value + 1 < state.cy) ? value + 1 : state.cy;
+            editor_delete_lines(state.cy - size + 1, size);
+            state.cy -= size;
             break;
     }
 }
 
 void editor_delete_to_eol(){
     if(state.cy >= state.num_rows) return;
-    erow* row = &state.row[state.cy];
-    int pos = state.cx == 0? 0: state.cx;
-    state.cx = row->size;
-    while(state.cx != pos){
-        editor_delete_char();
-    }
-    state.dirty = 1;
+    editor_delete_span(state.cx, state.row[state.cy].size - state.cx);
 }
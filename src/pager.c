@@ -0,0 +1,455 @@
+
+#define _GNU_SOURCE // memmem
+#include "editor.h"
+#include <sys/mman.h> /* mapping the file */
+
+/* ------------------------------------ paging huge files ------------------------------------ */
+// notes.out -R file (or any file too big to load, see editor_pager_too_big) is viewed read-only
+// without ever being loaded. The file is mapped, and only a window of rows around the cursor is
+// built in state.row: the rest of the editor sees a file of a few thousand rows, with the status
+// bar, G, gg and / translating to the whole file.
+//
+// A thread counts the file's lines once in the background and writes a sparse index: for every
+// PAGER_STRIDE bytes, where the first line starting in them is and what its number is. The lines
+// of one stride are a block. The window is a run of whole blocks, and slides (keeping the blocks it
+// still needs) when the cursor gets within PAGER_MARGIN rows of either end. Blocks that fall out of
+// it are kept as they are in a small cache in case they are visited again, and the least recently
+// used ones are freed once window and cache together go over PAGER_BUDGET. Pages of the mapping
+// are handed back to the kernel as soon as their lines are built or counted, so what stays
+// resident is the budget plus the index (16 bytes per stride), however big the file is. A line
+// can run on for gigabytes (a JSON dump), so only its first PAGER_LINE_MAX bytes are built.
+
+#define PAGER_STRIDE (128 << 10) // bytes per block, one index entry each
+#define PAGER_BUDGET (64 << 20)  // about this many bytes of rows are kept built
+#define PAGER_MARGIN 1000        // rows kept built above and below the cursor
+#define PAGER_LINE_MAX (1 << 20) // bytes of one line that are built, a multi-GB line is cut off
+#define PAGER_SCAN (64 << 20)    // bytes counted or searched before their pages are released
+#define PAGER_AUTO_SHARE 4       // files over 1/4 of the RAM are paged instead of loaded
+
+// block k: the lines starting at index[k].offset up to index[k+1].offset
+struct page_entry {
+    long line;
+    off_t offset;
+};
+
+// a block that is built but not in the window
+struct page {
+    long block;
+    erow* rows;
+    int n;
+    size_t bytes;
+    long last_used;
+};
+
+static struct {
+    int active;
+    int fd;
+    const char* map;
+    off_t size;
+
+    struct page_entry* index; // blocks + 1 entries, the last one is the end of the file
+    long blocks;
+    pthread_t thread;
+    _Atomic long indexed;     // entries the indexer has written
+    _Atomic int stop;
+
+    long first, last; // the window is blocks [first, last), state.row[0] is line first_line
+    long first_line;
+
+    struct page* cache;
+    int cached, cache_cap;
+    size_t cache_bytes;
+    long clock;
+
+    char* query; // the last search, for n and N
+} pager = { .fd = -1 };
+
+int editor_pager_active(){
+    return pager.active;
+}
+
+// give the pages of [lo, hi) back, the lines in them are built or counted already
+static void pager_release(off_t lo, off_t hi){
+    long page = sysconf(_SC_PAGESIZE);
+    lo -= lo % page;
+    if(hi > lo) madvise((char*) pager.map + lo, hi - lo, MADV_DONTNEED);
+}
+
+static void* pager_indexer(void* arg){
+    (void) arg;
+    const char* map = pager.map;
+    off_t size = pager.size, at = 0, released = 0; // at: the start of line number `line`
+    long line = 0;
+    for(long k = 0; k < pager.blocks && !pager.stop; ++k){
+        off_t lo = (off_t) k * PAGER_STRIDE;
+        if(at < lo){
+            // the first line starting at or after lo comes after the first newline from lo - 1
+            const char* nl = memchr(map + lo - 1, '\n', size - (lo - 1));
+            off_t start = nl ? nl - map + 1 : size;
+            line += editor_count_newlines(map + at, start - at);
+            at = start;
+        }
+        pager.index[k] = (struct page_entry){ line, at };
+        pager.indexed = k + 1;
+        if(at - released >= PAGER_SCAN){
+            pager_release(released, at);
+            released = at;
+        }
+    }
+    if(pager.stop) return NULL;
+    line += editor_count_newlines(map + at, size - at) + (size > 0 && map[size - 1] != '\n');
+    pager.index[pager.blocks] = (struct page_entry){ line, size };
+    pager_release(released, size);
+    pager.indexed = pager.blocks + 1;
+    return NULL;
+}
+
+// blocks whose rows are known: the index has the block after them too
+static long pager_ready(){
+    return pager.indexed > 0 ? pager.indexed - 1 : 0;
+}
+
+static int block_rows(long k){
+    return pager.index[k + 1].line - pager.index[k].line;
+}
+
+// the block with line (0-based) in it, -1 if the index doesn't get there yet
+static long pager_block_of(long line){
+    long lo = 0, hi = pager_ready();
+    if(hi == 0 || line >= pager.index[hi].line) return -1;
+    while(hi - lo > 1){ // index[lo].line <= line < index[hi].line
+        long mid = (lo + hi) / 2;
+        if(pager.index[mid].line <= line) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// lines the file has, as far as the index knows
+static long pager_lines(){
+    return pager.indexed > 0 ? pager.index[pager.indexed - 1].line : 0;
+}
+
+// roughly what n built rows take up
+static size_t rows_bytes(const erow* rows, int n){
+    size_t bytes = sizeof(erow) * n;
+    for(int i = 0; i < n; ++i){
+        bytes += rows[i].size + 1 + 2 * (rows[i].rsize + 1) + sizeof(struct row_pos) * rows[i].col_count;
+    }
+    return bytes;
+}
+
+/* ---------------------------------------- block cache ---------------------------------------- */
+static void cache_put(long block, const erow* rows, int n){
+    if(n == 0) return;
+    if(pager.cached == pager.cache_cap){
+        int cap = pager.cache_cap ? pager.cache_cap * 2 : 16;
+        pager.cache = mem_realloc(MEM_PAGER, pager.cache, sizeof(struct page) * pager.cache_cap, sizeof(struct page) * cap);
+        if(pager.cache == NULL) error("realloc");
+        pager.cache_cap = cap;
+    }
+    struct page* p = &pager.cache[pager.cached++];
+    p->block = block;
+    p->n = n;
+    p->rows = mem_alloc(MEM_PAGER, sizeof(erow) * n);
+    if(p->rows == NULL) error("malloc");
+    memcpy(p->rows, rows, sizeof(erow) * n);
+    p->bytes = rows_bytes(rows, n);
+    p->last_used = ++pager.clock;
+    pager.cache_bytes += p->bytes;
+}
+
+// forget page i, its rows have been moved out or freed
+static void cache_drop(int i){
+    struct page* p = &pager.cache[i];
+    pager.cache_bytes -= p->bytes;
+    mem_free(MEM_PAGER, p->rows, sizeof(erow) * p->n);
+    pager.cache[i] = pager.cache[--pager.cached];
+}
+
+// move the rows of block out of the cache into dst, 0 if they aren't there
+static int cache_take(long block, erow* dst){
+    for(int i = 0; i < pager.cached; ++i){
+        if(pager.cache[i].block != block) continue;
+        memcpy(dst, pager.cache[i].rows, sizeof(erow) * pager.cache[i].n);
+        cache_drop(i);
+        return 1;
+    }
+    return 0;
+}
+
+// free the least recently used blocks until the window and the cache fit the budget
+static void cache_trim(){
+    size_t window = rows_bytes(state.row, state.num_rows);
+    while(pager.cached > 0 && window + pager.cache_bytes > PAGER_BUDGET){
+        int lru = 0;
+        for(int i = 1; i < pager.cached; ++i){
+            if(pager.cache[i].last_used < pager.cache[lru].last_used) lru = i;
+        }
+        for(int r = 0; r < pager.cache[lru].n; ++r) editor_free_row(&pager.cache[lru].rows[r]);
+        cache_drop(lru);
+    }
+}
+
+/* ------------------------------------------ window ------------------------------------------ */
+// Make blocks [b0, b1) the window. Blocks it has already stay built, the others come from the
+// cache or the mapping, and the ones it loses go to the cache. The cursor stays on its line.
+static void pager_window(long b0, long b1){
+    if(b0 == pager.first && b1 == pager.last) return;
+    int n = 0;
+    for(long k = b0; k < b1; ++k) n += block_rows(k);
+    erow* rows = mem_alloc(MEM_ROWS, sizeof(erow) * (n ? n : 1));
+    if(rows == NULL) error("malloc");
+
+    for(long k = pager.first; k < pager.last; ++k){
+        if(k < b0 || k >= b1) cache_put(k, &state.row[pager.index[k].line - pager.first_line], block_rows(k));
+    }
+    int at = 0;
+    for(long k = b0; k < b1; ++k){
+        int count = block_rows(k);
+        if(k >= pager.first && k < pager.last){
+            memcpy(&rows[at], &state.row[pager.index[k].line - pager.first_line], sizeof(erow) * count);
+        }else if(count > 0 && !cache_take(k, &rows[at])){
+            editor_build_rows(&rows[at], pager.map + pager.index[k].offset, pager.index[k + 1].offset - pager.index[k].offset,
+                              PAGER_LINE_MAX);
+            pager_release(pager.index[k].offset, pager.index[k + 1].offset);
+        }
+        at += count;
+    }
+
+    long shift = pager.first_line - pager.index[b0].line; // rows that were above the old window
+    mem_free(MEM_ROWS, state.row, sizeof(erow) * state.row_cap);
+    state.row = rows;
+    state.num_rows = n;
+    state.row_cap = n ? n : 1;
+    ++state.changes;
+    pager.first = b0;
+    pager.last = b1;
+    pager.first_line = pager.index[b0].line;
+    at = 0;
+    for(int i = 0; i < n; ++i) state.row[i].idx = i;
+    // blocks were highlighted on their own, a /* comment */ can carry over from the one above
+    for(long k = b0; k < b1; at += block_rows(k++)){
+        if(at > 0 && at < n && state.row[at - 1].hl_open_comment) editor_update_syntax(&state.row[at]);
+    }
+
+    state.cy += shift;
+    state.rowoff += shift;
+    state.visual_anchor += shift;
+    if(state.cy >= n) state.cy = n - 1;
+    if(state.cy < 0) state.cy = 0;
+    if(state.rowoff < 0) state.rowoff = 0;
+    if(state.rowoff > state.cy) state.rowoff = state.cy;
+    state.cx = state.cy < n ? editor_row_snap_cx(&state.row[state.cy], state.cx) : 0;
+    cache_trim();
+}
+
+// a window around block k, PAGER_MARGIN rows and a screen beyond it on both sides where there are any
+static void pager_center(long k){
+    long b0 = k, b1 = k + 1, ready = pager_ready();
+    for(long above = 0; b0 > 0 && above < PAGER_MARGIN + state.screen_rows;) above += block_rows(--b0);
+    for(long below = 0; b1 < ready && below < PAGER_MARGIN + state.screen_rows;) below += block_rows(b1++);
+    pager_window(b0, b1);
+}
+
+// Before drawing: slide the window if the cursor got near one of its ends, or the index has found
+// rows for an empty one
+void editor_pager_slide(){
+    if(!pager.active || pager_ready() == 0) return;
+    int near_top = state.cy < PAGER_MARGIN && pager.first > 0;
+    int near_end = state.num_rows - 1 - state.cy < PAGER_MARGIN + state.screen_rows && pager.last < pager_ready();
+    if(!near_top && !near_end) return;
+    long k = pager_block_of(pager.first_line + state.cy);
+    pager_center(k >= 0 ? k : pager_ready() - 1);
+}
+
+// Go to line (1-based), waiting for the index to get there. A key stops the wait. -1 is the last line.
+void editor_pager_goto(long line){
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    int waited = 0;
+    while(pager.indexed <= pager.blocks && (line < 0 || pager_block_of(line - 1) < 0)){
+        editor_set_status_msg("indexing %d%%, any key to stop waiting", editor_pager_indexing());
+        editor_refresh_screen();
+        waited = 1;
+        if(poll(&pfd, 1, 100) > 0) return;
+    }
+    if(waited) editor_set_status_msg("");
+    long lines = pager_lines();
+    if(lines == 0) return;
+    if(line < 0 || line > lines) line = lines;
+    if(line == 0) line = 1;
+    pager_center(pager_block_of(line - 1));
+    state.cy = line - 1 - pager.first_line;
+    state.cx = editor_row_snap_cx(&state.row[state.cy], state.cx);
+}
+
+/* ---------------------------------------- searching ---------------------------------------- */
+// the first (dir 1) or last (dir -1) match of q starting in [lo, hi), -1 if there is none
+static off_t pager_scan(const char* q, size_t len, off_t lo, off_t hi, int dir){
+    for(off_t done = 0; done < hi - lo; done += PAGER_SCAN){
+        off_t a = dir > 0 ? lo + done : hi - done - PAGER_SCAN;
+        off_t b = dir > 0 ? a + PAGER_SCAN : hi - done;
+        if(a < lo) a = lo;
+        if(b > hi) b = hi;
+        off_t end = b + (off_t) len - 1 < pager.size ? b + (off_t) len - 1 : pager.size; // a match may run past b
+        off_t found = -1;
+        for(const char* p = pager.map + a; (p = memmem(p, pager.map + end - p, q, len)) && p < pager.map + b; ++p){
+            found = p - pager.map;
+            if(dir > 0) break;
+        }
+        pager_release(a, b);
+        if(found >= 0) return found;
+    }
+    return -1;
+}
+
+// the byte offset of the start of line (0-based), which has to be in the window
+static off_t pager_line_offset(long line){
+    long k = pager_block_of(line);
+    off_t at = pager.index[k].offset;
+    for(long l = pager.index[k].line; l < line; ++l) at = (const char*) memchr(pager.map + at, '\n', pager.size - at) - pager.map + 1;
+    return at;
+}
+
+// n (dir 1) and N (dir -1): the next match of the last search, from the cursor on and around the end
+static void pager_search(int dir){
+    if(pager.query == NULL){
+        editor_set_status_msg("no previous search");
+        return;
+    }
+    if(state.num_rows == 0){
+        editor_set_status_msg("Pattern not found: %s", pager.query);
+        return;
+    }
+    size_t len = strlen(pager.query);
+    off_t here = pager_line_offset(pager.first_line + state.cy) + state.cx;
+    off_t pos = dir > 0 ? pager_scan(pager.query, len, here + 1, pager.size, 1) : pager_scan(pager.query, len, 0, here, -1);
+    if(pos < 0){
+        pos = dir > 0 ? pager_scan(pager.query, len, 0, here + 1, 1) : pager_scan(pager.query, len, here, pager.size, -1);
+        if(pos >= 0) editor_set_status_msg(dir > 0 ? "search hit BOTTOM, continuing at TOP" : "search hit TOP, continuing at BOTTOM");
+    }
+    if(pos < 0){
+        editor_set_status_msg("Pattern not found: %s", pager.query);
+        return;
+    }
+    // its line: count from the last index entry before it, once the indexer has gone that far
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    while(pager.indexed <= pager.blocks && pager.index[pager.indexed - 1].offset <= pos){
+        if(poll(&pfd, 1, 100) > 0) return;
+    }
+    long lo = 0, hi = pager.indexed - 1;
+    while(hi - lo > 1){
+        long mid = (lo + hi) / 2;
+        if(pager.index[mid].offset <= pos) lo = mid;
+        else hi = mid;
+    }
+    long line = pager.index[lo].line + editor_count_newlines(pager.map + pager.index[lo].offset, pos - pager.index[lo].offset);
+    const char* start = memrchr(pager.map + pager.index[lo].offset, '\n', pos - pager.index[lo].offset);
+    off_t col = start ? pos - (start - pager.map + 1) : pos - pager.index[lo].offset;
+    pager_release(pager.index[lo].offset, pos); // a block can be one very long line
+    editor_pager_goto(line + 1);
+    // a match past what was built of a very long line puts the cursor at the end of it
+    if(state.cy < state.num_rows) state.cx = editor_row_snap_cx(&state.row[state.cy], col < state.row[state.cy].size ? col : state.row[state.cy].size);
+}
+
+// /: a search through the whole file, not incremental like editor_find's
+void editor_pager_find(){
+    char* query = editor_prompt("Search: %s (ESC to cancel)", NULL);
+    if(query == NULL) return;
+    free(pager.query);
+    pager.query = query;
+    pager_search(1);
+}
+
+/* ------------------------------------------ keys ------------------------------------------ */
+// Normal mode command c (with count) is fine in a read-only file. n and N are done here instead,
+// and so are j and k with a count that goes past the window.
+int editor_pager_allows(int c, int count){
+    switch(c){
+        case 'n':
+        case 'N':
+            pager_search(c == 'n' ? 1 : -1);
+            return 0;
+        case 'j':
+        case 'k':
+            if(count < PAGER_MARGIN) return 1;
+            long line = pager.first_line + state.cy + 1 + (c == 'j' ? count : -count);
+            editor_pager_goto(line < 1 ? 1 : line); // -1 would be the last line
+            return 0;
+        case ':': case '/': case 'G': case 'g':
+        case 'h': case 'l': case 'w': case 'b': case 'e': case '0': case '$':
+        case 'f': case 'F': case 't': case 'T':
+        case '\r': case BACKSPACE: case CTRL_KEY('d'): case CTRL_KEY('u'):
+            return 1;
+    }
+    editor_set_status_msg("\"%s\" is read-only", state.filename);
+    return 0;
+}
+
+// a : command, 1 if it was turned down
+int editor_pager_refuses(const char* query){
+    if(strcmp(query, "q") == 0 || strcmp(query, "Q") == 0 || strncmp(query, "perf", 4) == 0 ||
+       strcmp(query, "mem") == 0 || strcmp(query, "wrap") == 0) return 0;
+    editor_set_status_msg("only :q, :perf, :mem and :wrap while paging a read-only file");
+    return 1;
+}
+
+/* ----------------------------------------- opening ----------------------------------------- */
+// files that wouldn't fit in memory once built into rows
+int editor_pager_too_big(const char* filename){
+    struct stat st;
+    long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+    return stat(filename, &st) == 0 && pages > 0 && st.st_size > (off_t) pages * page / PAGER_AUTO_SHARE;
+}
+
+void editor_pager_open(const char* filename){
+    state.filename = strdup(filename);
+    if(state.filename == NULL) error("strdup");
+    pager.fd = open(filename, O_RDONLY);
+    struct stat st;
+    if(pager.fd == -1 || fstat(pager.fd, &st) == -1) error("open");
+    pager.size = st.st_size;
+    if(pager.size > 0){
+        pager.map = mmap(NULL, pager.size, PROT_READ, MAP_PRIVATE, pager.fd, 0);
+        if(pager.map == MAP_FAILED) error("mmap");
+    }
+    pager.blocks = (pager.size + PAGER_STRIDE - 1) / PAGER_STRIDE;
+    pager.index = mem_alloc(MEM_PAGER, sizeof(struct page_entry) * (pager.blocks + 1));
+    if(pager.index == NULL) error("malloc");
+    pager.active = 1;
+    if(pthread_create(&pager.thread, NULL, pager_indexer, NULL) != 0) error("pthread_create");
+
+    // the first block is counted in no time
+    while(pager_ready() == 0 && pager.indexed <= pager.blocks) usleep(1000);
+    if(pager.blocks > 0) pager_center(0);
+    editor_set_status_msg("\"%s\" %lld bytes, read-only", filename, (long long) pager.size);
+}
+
+// percent of the file the indexer has counted, -1 once it is done (or there is no pager)
+int editor_pager_indexing(){
+    if(!pager.active || pager.indexed > pager.blocks) return -1;
+    return pager.indexed * 100 / (pager.blocks + 1);
+}
+
+// for the status bar: the cursor's line and how many there are (so far) in the whole file
+void editor_pager_position(long* line, long* lines){
+    *line = pager.first_line + state.cy + 1;
+    *lines = pager_lines();
+}
+
+// the window's rows are freed with state's, everything else here
+void editor_free_pager(){
+    if(!pager.active) return;
+    pager.stop = 1;
+    pthread_join(pager.thread, NULL);
+    while(pager.cached > 0){
+        for(int r = 0; r < pager.cache[0].n; ++r) editor_free_row(&pager.cache[0].rows[r]);
+        cache_drop(0);
+    }
+    mem_free(MEM_PAGER, pager.cache, sizeof(struct page) * pager.cache_cap);
+    mem_free(MEM_PAGER, pager.index, sizeof(struct page_entry) * (pager.blocks + 1));
+    if(pager.map) munmap((char*) pager.map, pager.size);
+    close(pager.fd);
+    free(pager.query);
+    pager.active = 0;
+}
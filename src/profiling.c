@@ -0,0 +1,205 @@
+
+#include "editor.h"
+
+/* ------------------------------------ profiling ------------------------------------ */
+// Hot paths time themselves with editor_perf_now()/editor_perf_record() and bump a few counters.
+// A frame is one key handled plus the refresh after it. :perf toggles an overlay in the top right
+// corner with the numbers of the last finished frame, :perf trace starts recording every timed
+// call, and a second :perf trace [file] writes them out as a Chrome trace (chrome://tracing or
+// https://ui.perfetto.dev) and stops.
+
+#define PERF_TRACE_EVENTS (1 << 16) // ring buffer, the oldest events are overwritten
+#define PERF_TRACE_DEFAULT "notepad-trace.json"
+
+static const char* phase_names[PERF_NUM_PHASES] = { "input", "syntax", "draw_rows", "write" };
+
+struct perf_frame {
+    long long ns[PERF_NUM_PHASES];
+    long long start;
+    long long total_ns; // first timed call to the end of the refresh
+    long bytes;         // written to the terminal
+    long rows;          // re-highlighted by editor_update_syntax
+    long allocs;
+};
+
+struct trace_event {
+    long long start, ns;
+    int phase;
+    long value; // bytes for write, rows for syntax
+    long live;  // bytes in use (see memory-accounting.c) when the event ended
+};
+
+static struct {
+    int overlay;
+    struct perf_frame cur;  // being measured
+    struct perf_frame last; // what the overlay shows
+    long long total_bytes;
+    long long total_rows;
+    long long total_allocs;
+    long long frame_allocs_base; // total_allocs when the current frame started
+
+    struct trace_event* trace;
+    long trace_len; // events recorded so far, trace[trace_len % PERF_TRACE_EVENTS] is next
+    long long trace_start;
+
+    // walking the undo stacks is not free, so only redo it when they changed
+    int undo_size, redo_size;
+    long undo_bytes;
+} perf;
+
+long long editor_perf_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void perf_trace_add(int phase, long long start, long long ns, long value){
+    // the :perf trace that started the trace is still being handled, leave it out
+    if(perf.trace == NULL || start < perf.trace_start) return;
+    struct trace_event* e = &perf.trace[perf.trace_len++ % PERF_TRACE_EVENTS];
+    e->start = start;
+    e->ns = ns;
+    e->phase = phase;
+    e->value = value;
+    e->live = mem_total_live();
+}
+
+// a timed call to phase (enum perf_phase) that started at start is over. value goes into the
+// trace: rows for syntax, bytes for write
+void editor_perf_record(int phase, long long start, long value){
+    long long ns = editor_perf_now() - start;
+    if(perf.cur.start == 0) perf.cur.start = start;
+    perf.cur.ns[phase] += ns;
+    perf_trace_add(phase, start, ns, value);
+}
+
+void editor_perf_count_rows(int n){
+    perf.cur.rows += n;
+    perf.total_rows += n;
+}
+
+void editor_perf_count_allocs(long n){
+    perf.total_allocs += n;
+}
+
+// called once the refresh has written its bytes
+void editor_perf_end_frame(long bytes){
+    long long now = editor_perf_now();
+    perf.cur.bytes = bytes;
+    perf.total_bytes += bytes;
+    if(perf.cur.start == 0) perf.cur.start = now;
+    perf.cur.total_ns = now - perf.cur.start;
+    perf.cur.allocs = perf.total_allocs - perf.frame_allocs_base;
+    perf.frame_allocs_base += perf.cur.allocs;
+    perf.last = perf.cur;
+    memset(&perf.cur, 0, sizeof(perf.cur));
+}
+
+int editor_perf_overlay(){
+    return perf.overlay;
+}
+
+static void perf_update_undo_bytes(){
+    if(perf.undo_size == state.undo.stack_size && perf.redo_size == state.redo.stack_size) return;
+    perf.undo_size = state.undo.stack_size;
+    perf.redo_size = state.redo.stack_size;
+    perf.undo_bytes = editor_undo_memory();
+}
+
+// one right aligned, inverted line of an overlay panel
+void editor_draw_overlay_line(struct abuf* ab, int line, const char* fmt, ...){
+    char text[64];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if(len > (int) sizeof(text) - 1) len = sizeof(text) - 1;
+    if(len > state.screen_cols) len = state.screen_cols;
+
+    char pos[32];
+    int plen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", state.screen_top + line,
+                        state.screen_left + state.screen_cols - len + 1); // of the current window
+    ab_append(ab, pos, plen);
+    ab_append(ab, "\x1b[7m", 4);
+    ab_append(ab, text, len);
+    ab_append(ab, "\x1b[m", 3);
+}
+
+// drawn over the top right corner of the text, the cursor is moved back afterwards anyway
+void editor_draw_perf_overlay(struct abuf* ab){
+    perf_update_undo_bytes();
+    struct perf_frame* f = &perf.last;
+    editor_draw_overlay_line(ab, 1, " frame %8.1f us  %-18s ", f->total_ns / 1e3, perf.trace ? "[tracing]" : "");
+    editor_draw_overlay_line(ab, 2, " input %8.1f us  syntax %8.1f us ", f->ns[PERF_INPUT] / 1e3, f->ns[PERF_SYNTAX] / 1e3);
+    editor_draw_overlay_line(ab, 3, " draw  %8.1f us  write  %8.1f us ", f->ns[PERF_DRAW] / 1e3, f->ns[PERF_WRITE] / 1e3);
+    editor_draw_overlay_line(ab, 4, " bytes %8ld     rows   %8ld    ", f->bytes, f->rows);
+    editor_draw_overlay_line(ab, 5, " alloc %8ld     undo %7.1f KB    ", f->allocs, perf.undo_bytes / 1024.0);
+}
+
+static int perf_write_trace(const char* path){
+    FILE* f = fopen(path, "w");
+    if(f == NULL) return -1;
+    long n = perf.trace_len < PERF_TRACE_EVENTS ? perf.trace_len : PERF_TRACE_EVENTS;
+    long first = perf.trace_len - n;
+    fprintf(f, "{\"traceEvents\": [\n");
+    for(long i = 0; i < n; ++i){
+        struct trace_event* e = &perf.trace[(first + i) % PERF_TRACE_EVENTS];
+        double ts = (e->start - perf.trace_start) / 1e3; // trace timestamps are in microseconds
+        fprintf(f, "  {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1",
+                phase_names[e->phase], ts, e->ns / 1e3);
+        if(e->phase == PERF_WRITE){
+            fprintf(f, ", \"args\": {\"bytes\": %ld}},\n", e->value);
+            // and as a counter track, so bytes per frame can be graphed
+            fprintf(f, "  {\"name\": \"bytes written\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, "
+                       "\"args\": {\"bytes\": %ld}},\n", ts, e->value);
+            fprintf(f, "  {\"name\": \"memory\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, "
+                       "\"args\": {\"live\": %ld}}", ts, e->live);
+        }else if(e->phase == PERF_SYNTAX){
+            fprintf(f, ", \"args\": {\"rows\": %ld}}", e->value);
+        }else{
+            fprintf(f, "}");
+        }
+        fprintf(f, "%s\n", i + 1 < n ? "," : "");
+    }
+    fprintf(f, "],\n\"otherData\": {\"total_bytes\": %lld, \"total_rows\": %lld, \"total_allocs\": %lld",
+            perf.total_bytes, perf.total_rows, (long long) perf.total_allocs);
+    for(int tag = 0; tag < MEM_NUM_TAGS; ++tag){
+        fprintf(f, ", \"mem %s live\": %ld, \"mem %s peak\": %ld",
+                mem_name(tag), mem_live(tag), mem_name(tag), mem_peak(tag));
+    }
+    fprintf(f, "}}\n");
+    return fclose(f);
+}
+
+// :perf toggles the overlay, :perf trace starts a trace and :perf trace [file] writes it out
+void editor_perf_command(const char* args){
+    while(*args == ' ') ++args;
+    if(*args == '\0'){
+        perf.overlay = !perf.overlay;
+        editor_set_status_msg("perf overlay %s", perf.overlay ? "on" : "off");
+        return;
+    }
+    if(strncmp(args, "trace", 5) != 0){
+        editor_set_status_msg("usage: :perf [trace [file]]");
+        return;
+    }
+    args += 5;
+    while(*args == ' ') ++args;
+
+    if(perf.trace == NULL){
+        perf.trace = malloc(sizeof(struct trace_event) * PERF_TRACE_EVENTS);
+        perf.trace_len = 0;
+        perf.trace_start = editor_perf_now();
+        editor_set_status_msg("perf trace started, :perf trace [file] to write it out");
+        return;
+    }
+    const char* path = *args ? args : PERF_TRACE_DEFAULT;
+    long events = perf.trace_len < PERF_TRACE_EVENTS ? perf.trace_len : PERF_TRACE_EVENTS;
+    if(perf_write_trace(path) == -1){
+        editor_set_status_msg("Failed to write %s: %s", path, strerror(errno));
+    }else{
+        editor_set_status_msg("%ld events written to %s", events, path);
+    }
+    free(perf.trace);
+    perf.trace = NULL;
+}
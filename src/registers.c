@@ -0,0 +1,104 @@
+
+#include "editor.h"
+
+/* ------------------------------------ registers ------------------------------------ */
+// Registers hold whole lines as shared references to the row payloads: yanking or deleting a
+// million lines copies a million pointers, never the text. A payload is only copied once either
+// the row or the register side writes to it (see line_writable). Every store also goes into the
+// unnamed register, like vim.
+
+#define NUM_REGISTERS 27 // unnamed + a-z
+#define PUT_MAX_LINES (1 << 24) // 99999999p of a few lines would want more memory than there is
+
+struct reg {
+    struct line_slice* lines;
+    int num_lines;
+};
+
+static struct reg registers[NUM_REGISTERS];
+static int selected = 0; // register chosen with "x for the next command, 0 is the unnamed one
+
+// "x before a command: returns 0 if x is not a register name
+int editor_select_register(int name){
+    if(name == '"'){
+        selected = 0;
+    }else if(name >= 'a' && name <= 'z'){
+        selected = name - 'a' + 1;
+    }else{
+        return 0;
+    }
+    return 1;
+}
+
+static void register_clear(struct reg* r){
+    for(int i = 0; i < r->num_lines; ++i) line_release(r->lines[i].chars);
+    mem_free(MEM_REGISTERS, r->lines, sizeof(struct line_slice) * r->num_lines);
+    r->lines = NULL;
+    r->num_lines = 0;
+}
+
+static void register_fill(struct reg* r, int row_num, int n){
+    register_clear(r);
+    r->lines = mem_alloc(MEM_REGISTERS, sizeof(struct line_slice) * n);
+    editor_cold_thaw_rows(row_num, n); // the payloads are shared, see cold-rows.c
+    for(int i = 0; i < n; ++i){
+        r->lines[i].chars = line_share(state.row[row_num + i].chars);
+        r->lines[i].size = state.row[row_num + i].size;
+    }
+    r->num_lines = n;
+}
+
+// remember rows [row_num, row_num+n) in the selected register (and the unnamed one)
+void editor_register_store(int row_num, int n){
+    if(row_num < 0 || n <= 0 || row_num + n > state.num_rows) return;
+    register_fill(&registers[0], row_num, n);
+    if(selected) register_fill(&registers[selected], row_num, n);
+    selected = 0;
+}
+
+void editor_yank_rows(int row_num, int n){
+    editor_register_store(row_num, n);
+    if(n > 2) editor_set_status_msg("%d lines yanked", n);
+}
+
+// put the selected register count times below (or above) the cursor row, as one bulk row insert
+void editor_put(int below, int count){
+    struct reg* r = &registers[selected];
+    selected = 0;
+    if(r->num_lines == 0){
+        editor_set_status_msg("Nothing in register");
+        return;
+    }
+    int at = state.cy;
+    if(below && state.cy < state.num_rows) ++at;
+    if(count < 1) count = 1;
+
+    long total = (long) r->num_lines * count;
+    if(total > PUT_MAX_LINES){
+        editor_set_status_msg("Can't put %ld lines, at most %d at once", total, PUT_MAX_LINES);
+        return;
+    }
+    struct line_slice* lines = r->lines;
+    int n = total;
+    if(count > 1){
+        // repeat the slices, the payloads themselves are still shared
+        lines = malloc(sizeof(struct line_slice) * n);
+        if(lines == NULL){
+            editor_set_status_msg("Not enough memory to put %d lines", n);
+            return;
+        }
+        for(int i = 0; i < count; ++i){
+            memcpy(lines + i * r->num_lines, r->lines, sizeof(struct line_slice) * r->num_lines);
+        }
+    }
+    editor_insert_lines(at, lines, n);
+    if(lines != r->lines) free(lines);
+
+    state.cy = at;
+    state.cx = 0;
+    if(n > 2) editor_set_status_msg("%d more lines", n);
+}
+
+void editor_free_registers(){
+    for(int i = 0; i < NUM_REGISTERS; ++i) register_clear(&registers[i]);
+}
@@ -5,7 +5,7 @@
 // For appending a string to the end of the current append buffer
 void ab_append(struct abuf* ab, const char* s, int len){
     // allocate for the new string
-    char* new = realloc(ab->b, ab->len + len);
+    char* new = mem_realloc(MEM_SCREEN, ab->b, ab->len, ab->len + len);
     if(new == NULL) return;
 
     // copy new string s into new[.], strcpy would also work
@@ -17,7 +17,7 @@ void ab_append(struct abuf* ab, const char* s, int len){
 
 // deallocate the malloced char array in append buffer
 void ab_free(struct abuf* ab){
-    free(ab->b);
+    mem_free(MEM_SCREEN, ab->b, ab->len);
 }
 
 /* --------------------------------------- drawing to screen --------------------------------------- */
@@ -26,8 +26,13 @@ void ab_free(struct abuf* ab){
 void editor_scroll() {
     state.rx = 0;
     if (state.cy < state.num_rows) {
+        editor_row_touch(state.row + state.cy); // G can land on a frozen row, see cold-rows.c
         state.rx = editor_row_cx_to_rx(state.row + state.cy, state.cx);
     }
+    if (state.wrap) {
+        editor_wrap_scroll();
+        return;
+    }
 
     // Vertical -----
     // Since cy is relative to the file, we need to subtract
@@ -52,65 +57,114 @@ void editor_scroll() {
     }
 }
 
-// write all the contents of the append buffer to the terminal
+// write all the contents of the append buffer to the terminal. With split windows this is the
+// current window's part of the screen, every line is positioned and padded to its width.
 void editor_draw_rows(struct abuf* ab){
+    int split = editor_windows_split();
     int i;
     for(i=0;i<state.screen_rows; ++i){
-        int filerow = i + state.rowoff;
+        if(split){
+            char pos[32];
+            int plen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", state.screen_top + i + 1, state.screen_left + 1);
+            ab_append(ab, pos, plen);
+        }
+        int col = 0; // screen columns drawn on this line
+        // the span of render drawn on this screen line: from coloff, or one segment when wrapping
+        int filerow, start = 0, len = 0;
+        int pad = 0; // a wide character cut by the left edge is drawn as blanks
+        if(state.wrap){
+            if(!editor_wrap_line(i, &filerow, &start, &len)) filerow = state.num_rows;
+        }else{
+            filerow = i + state.rowoff;
+            if(filerow < state.num_rows){
+                erow* row = &state.row[filerow];
+                editor_row_touch(row); // thaws a row that was compressed, see cold-rows.c
+                struct row_pos pos = editor_row_pos(row, POS_RX, state.coloff);
+                if(pos.rx < state.coloff && pos.cx < row->size) editor_row_step(row, &pos);
+                if(pos.rx > state.coloff) pad = pos.rx - state.coloff;
+                start = pos.bx;
+                len = row->rsize - start;
+            }
+        }
         if(filerow >= state.num_rows){
             // check if we are outside the range of the currently edited number of rows
             ab_append(ab, "~", 1);
+            col = 1;
         }else{
-            int len = state.row[filerow].rsize - state.coloff;
-            if(len < 0) len = 0;
-            if(len > state.screen_cols) len = state.screen_cols;
+            // visual-line selection is drawn over whatever highlighting the row has
+            int selected = 0;
+            if(state.mode == VISUAL_MODE){
+                int lo, hi;
+                editor_visual_range(&lo, &hi);
+                selected = filerow >= lo && filerow <= hi;
+            }
 
-            // move through the portion of the row that should be displayed on screen
-            char* p = state.row[filerow].render + state.coloff; // render array ptr
-            uint8_t* highlights = state.row[filerow].hl + state.coloff; // hl array ptr
+            if(len < 0) len = 0;
+            for(int k = 0; k < pad; ++k) ab_append(ab, " ", 1);
 
             // only change color when it is different from the previous character
             int curr_color = -1;
 
             int in_visual_highlight = 0;
-            int i;
-            for(i=0;i<len;++i){
-                if(iscntrl(p[i])){ // for non-printable characters, make them print nicely
-                    char symbol = (p[i] <= 26) ? '@' + p[i] : '?';
-                    ab_append(ab, "\x1b[7m", 4); // invert colors
-                    ab_append(ab, &symbol, 1);
-                    ab_append(ab, "\x1b[m", 3); // revert colors
-                    if (curr_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", curr_color);
-                        ab_append(ab, buf, clen); // add current color back
-                    }
-                }else if(highlights[i] == HL_NORMAL){   // making the common case fast
-                    if(curr_color != -1){
-                        curr_color = -1;
-                        ab_append(ab, "\x1b[39m", 5); // default color
-                    }
-                    ab_append(ab, p + i, 1);
-                }else if(highlights[i] == HL_VISUAL){
-                    if(!in_visual_highlight){
-                        in_visual_highlight = 1;
-                        char sequence_buf[16];
-                        int sequence_length = snprintf(sequence_buf, sizeof(sequence_buf), "\x1b[%dm",
-                                                                     editor_syntax_to_color(highlights[i]));
-                        ab_append(ab, sequence_buf, sequence_length); // start highlight in row
-                    }
-                    ab_append(ab, p + i, 1);
-                }else{
-                    int h_color = editor_syntax_to_color(highlights[i]);
-                    if(curr_color != h_color){
-                        curr_color = h_color;
-
-                        char sequence_buf[16];
-                        int sequence_length = snprintf(sequence_buf, sizeof(sequence_buf), "\x1b[%dm", h_color);
-                        ab_append(ab, sequence_buf, sequence_length); // update color
+            int i, n;
+            col = pad;
+            int bx = start, end = start + len;
+            while(bx < end){
+                // move through the portion of the row that should be displayed on screen. A long
+                // row keeps its render in chunks (see long-rows.c), so go one contiguous piece at a time
+                char* p; // render array ptr
+                uint8_t* highlights; // hl array ptr
+                int piece = editor_row_render_at(&state.row[filerow], bx, &p, &highlights);
+                if(piece > end - bx) piece = end - bx;
+                if(piece <= 0) break;
+                for(i=0;i<piece;i+=n){
+                    // one character (n bytes of render) at a time, as many as fit in the screen columns
+                    int cp = (unsigned char) p[i];
+                    n = 1;
+                    if(cp >= 0x80) n = utf8_decode(p + i, piece - i, &cp);
+                    int w = cp < 0 ? 1 : utf8_width(cp);
+                    if(col + w > state.screen_cols) break;
+                    col += w;
+
+                    if(cp < 0 || (cp < 0x80 && iscntrl(cp))){ // for non-printable characters and bad UTF-8, make them print nicely
+                        char symbol = (cp >= 0 && cp <= 26) ? '@' + cp : '?';
+                        ab_append(ab, "\x1b[7m", 4); // invert colors
+                        ab_append(ab, &symbol, 1);
+                        ab_append(ab, "\x1b[m", 3); // revert colors
+                        if (curr_color != -1) {
+                            char buf[16];
+                            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", curr_color);
+                            ab_append(ab, buf, clen); // add current color back
+                        }
+                    }else if(!selected && highlights[i] == HL_NORMAL){   // making the common case fast
+                        if(curr_color != -1){
+                            curr_color = -1;
+                            ab_append(ab, "\x1b[39m", 5); // default color
+                        }
+                        ab_append(ab, p + i, n);
+                    }else if(selected || highlights[i] == HL_VISUAL){
+                        if(!in_visual_highlight){
+                            in_visual_highlight = 1;
+                            char sequence_buf[16];
+                            int sequence_length = snprintf(sequence_buf, sizeof(sequence_buf), "\x1b[%dm",
+                                                                         editor_syntax_to_color(HL_VISUAL));
+                            ab_append(ab, sequence_buf, sequence_length); // start highlight in row
+                        }
+                        ab_append(ab, p + i, n);
+                    }else{
+                        int h_color = editor_syntax_to_color(highlights[i]);
+                        if(curr_color != h_color){
+                            curr_color = h_color;
+
+                            char sequence_buf[16];
+                            int sequence_length = snprintf(sequence_buf, sizeof(sequence_buf), "\x1b[%dm", h_color);
+                            ab_append(ab, sequence_buf, sequence_length); // update color
+                        }
+                        ab_append(ab, p + i, n);
                     }
-                    ab_append(ab, p + i, 1);
                 }
+                if(i < piece) break; // the screen line is full
+                bx += piece;
             }
             if(in_visual_highlight){
                 in_visual_highlight = 0;
@@ -118,6 +172,10 @@ void editor_draw_rows(struct abuf* ab){
             }
             ab_append(ab, "\x1b[39m", 5); // reset to default color
         }
+        if(split){
+            for(; col < state.screen_cols; ++col) ab_append(ab, " ", 1); // \x1b[K would clear the window beside
+            continue;
+        }
         ab_append(ab, "\x1b[K", 3); // erase to the right of current line
         ab_append(ab, "\r\n", 2); // dont do newline at bottom
     }
@@ -127,10 +185,25 @@ void editor_draw_rows(struct abuf* ab){
 void editor_draw_status_bar(struct abuf* ab){
     ab_append(ab, "\x1b[7m", 4); // invert colors escape sequence
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-            state.filename ? state.filename : "[No Name]", state.num_rows, state.dirty ? "[+]" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-            state.cy + 1, state.num_rows);
+    int rec = editor_macro_recording();
+    long line = state.cy + 1, lines = state.num_rows;
+    if(editor_pager_active()) editor_pager_position(&line, &lines); // the rows are a window into the file
+    int len = snprintf(status, sizeof(status), "%.20s - %ld lines %s%s%s%s%c",
+            state.filename ? state.filename : "[No Name]", lines, state.dirty ? "[+]" : "",
+            editor_following() ? "[follow]" : "", editor_pager_active() ? "[RO]" : "",
+            rec ? " recording @" : "", rec ? rec : ' ');
+    int rlen;
+    int saved = editor_save_progress(), indexing = editor_pager_indexing();
+    if(saved >= 0){
+        rlen = snprintf(rstatus, sizeof(rstatus), "saving %d%% | %ld/%ld",
+                saved, line, lines);
+    }else if(indexing >= 0){
+        rlen = snprintf(rstatus, sizeof(rstatus), "indexing %d%% | %ld/%ld+",
+                indexing, line, lines);
+    }else{
+        rlen = snprintf(rstatus, sizeof(rstatus), "%ld/%ld",
+                line, lines);
+    }
     if (len > state.screen_cols) len = state.screen_cols;
     ab_append(ab, status, len);
     for(;len<state.screen_cols; ++len){
@@ -141,7 +214,7 @@ void editor_draw_status_bar(struct abuf* ab){
         ab_append(ab, " ", 1); // color the bar
     }
     ab_append(ab, "\x1b[m", 3); // undo color invert
-    ab_append(ab, "\r\n", 2);
+    if(!editor_windows_split()) ab_append(ab, "\r\n", 2); // a window's status line is positioned instead
 }
 
 // write a content to the space for where messages and prompts come up
@@ -173,6 +246,9 @@ void editor_set_status_msg(const char* fmt, ...){
 
 // update screen by drawing all contents (occurs on any keypress)
 void editor_refresh_screen(){
+    // a macro replay draws once, after its last key. -s never draws at all
+    if(state.headless || editor_macro_replaying()) return;
+    editor_pager_slide(); // a file too big to load has a window of rows around the cursor
     editor_scroll();
 
     struct abuf ab;
@@ -182,13 +258,26 @@ void editor_refresh_screen(){
     ab_append(&ab, "\x1b[?25l", 6); // hide cursor
     ab_append(&ab, "\x1b[H", 3); // reposition cursor to top of screen
 
-    editor_draw_rows(&ab);
-    editor_draw_status_bar(&ab);
+    long long start = editor_perf_now();
+    if(editor_windows_split()){
+        editor_draw_windows(&ab); // also leaves the terminal cursor on the message line
+    }else{
+        editor_draw_rows(&ab);
+        editor_draw_status_bar(&ab);
+    }
+    editor_perf_record(PERF_DRAW, start, 0);
     editor_draw_msg_bar(&ab);
+    if(editor_perf_overlay()) editor_draw_perf_overlay(&ab);
+    if(editor_mem_overlay()) editor_draw_mem_overlay(&ab);
+    if(editor_buffer_listing()) editor_draw_buffer_list(&ab);
+    // a panel covers other windows too, they have to be drawn again once it is gone
+    editor_windows_overlaid(editor_perf_overlay() || editor_mem_overlay() || editor_buffer_listing());
 
     // the terminal uses 1-indexing, so (1,1) is the top left corner
+    int y = state.cy - state.rowoff, x = state.rx - state.coloff;
+    if(state.wrap) editor_wrap_cursor(&y, &x);
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (state.cy - state.rowoff) + 1, (state.rx - state.coloff) + 1);
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", state.screen_top + y + 1, state.screen_left + x + 1);
     // append this escape sequence, so that we move cursor to the designated location
     // Note that this is moving the cursor to a position relative to the screen, not the file
     ab_append(&ab, buf, strlen(buf));
@@ -196,6 +285,9 @@ void editor_refresh_screen(){
 
     ab_append(&ab, "\x1b[?25h", 6); // show cursor
 
+    start = editor_perf_now();
     write(STDOUT_FILENO, ab.b, ab.len);
+    editor_perf_record(PERF_WRITE, start, ab.len);
+    editor_perf_end_frame(ab.len);
     ab_free(&ab);
 }
@@ -2,18 +2,43 @@
 #include "editor.h"
 
 /* ------------------------------------ incremental searching ------------------------------------ */
+// The hl under render bytes [at, at+size) of row, one piece at a time: a match in a long row can
+// run across the end of a chunk (see long-rows.c). Saves it into buf and paints it HL_MATCH, or
+// with restore puts buf back.
+static void match_hl(erow* row, int at, char* buf, int size, int restore){
+    char* render;
+    uint8_t* hl;
+    for(int done = 0; done < size;){
+        int n = editor_row_render_at(row, at + done, &render, &hl);
+        if(n <= 0) break;
+        if(n > size - done) n = size - done;
+        if(restore){
+            memcpy(hl, buf + done, n);
+        }else{
+            memcpy(buf + done, hl, n);
+            memset(hl, HL_MATCH, n);
+        }
+        done += n;
+    }
+}
+
 // For looping and moving to words as they are typed (callback for editor_find())
 void editor_find_callback(char* query, int key){
     static int last_match = -1;
     static int direction = 1;
 
+    // the highlighting under the match, put back before the next search
     static int saved_hl_line;
+    static int saved_hl_at;
     static char* saved_hl = NULL;
+    static int saved_hl_size;
 
     if(saved_hl){
-        memcpy(state.row[saved_hl_line].hl, saved_hl, state.row[saved_hl_line].rsize);
-        free(saved_hl);
+        line_cache_unshare(&state.row[saved_hl_line]); // the row may have been highlighted into the shared hl since
+        match_hl(&state.row[saved_hl_line], saved_hl_at, saved_hl, saved_hl_size, 1);
+        mem_free(MEM_SEARCH, saved_hl, saved_hl_size);
         saved_hl = NULL;
+        ++state.changes; // a window beside this one may show the row too
     }
 
     if(key == '\r' || key == '\x1b' || key == CTRL_KEY('c')){
@@ -50,19 +75,26 @@ void editor_find_callback(char* query, int key){
         }
 
         erow* row = &state.row[current];
-        char* match = strstr(row->render, query);
-        if(match){
+        editor_row_touch(row); // only the rows searched through are thawed, see cold-rows.c
+        int match = editor_row_find(row, query);
+        if(match >= 0){
             last_match = current;
             state.cy = current;
-            state.cx = editor_row_rx_to_cx(row, match - row->render);
+            state.cx = editor_row_pos(row, POS_BX, match).cx;
 
             // make it so that we are at the very bottom of the file, so editor_scroll will scroll us upwards to the word
             //state.rowoff = state.num_rows;
 
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&state.row[current].hl[match-row->render], HL_MATCH, strlen(query));
+            line_cache_unshare(row); // the match is drawn into hl, see line-storage.c
+            if(query[0] != '\0' && match < row->rsize){
+                saved_hl_line = current;
+                saved_hl_at = match;
+                saved_hl_size = strlen(query);
+                saved_hl = mem_alloc(MEM_SEARCH, saved_hl_size);
+                if(saved_hl == NULL) error("malloc");
+                match_hl(row, match, saved_hl, saved_hl_size, 0);
+                ++state.changes;
+            }
             break;
         }
     }
@@ -70,10 +102,15 @@ void editor_find_callback(char* query, int key){
 
 // driver function for incremental search. Restores cx and cy if search is cancelled.
 void editor_find(){
+    if(editor_pager_active()){
+        editor_pager_find(); // the file isn't all in rows
+        return;
+    }
     int saved_cx = state.cx;
     int saved_cy = state.cy;
     int saved_coloff = state.coloff;
     int saved_rowoff = state.rowoff;
+    int saved_segoff = state.segoff;
     char* query = editor_prompt("Search: %s (ESC to cancel)", editor_find_callback);
 
     if(query){
@@ -83,5 +120,6 @@ void editor_find(){
         state.cy = saved_cy;
         state.coloff = saved_coloff;
         state.rowoff = saved_rowoff;
+        state.segoff = saved_segoff;
     }
 }
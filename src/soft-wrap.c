@@ -0,0 +1,207 @@
+
+#include "editor.h"
+
+/* ------------------------------------ soft wrap ------------------------------------ */
+// With :wrap on, rows longer than the screen are continued on the next screen lines instead of
+// scrolling sideways. Every row caches where its screen lines ("segments") start, and
+// the cache is only rebuilt after editor_update_render (an edit) or when the screen width changes.
+//
+// The top of the screen is (rowoff, segoff), and editor_wrap_scroll fills a small index mapping
+// each screen line to (row, segment). Scrolling only ever walks the rows between the top of the
+// screen and the cursor, giving up after a screenful, so G or a jump into a row that wraps into
+// hundreds of lines costs the same as moving one line.
+
+struct screen_line {
+    int row; // -1 past the end of the file
+    int seg;
+};
+
+static struct screen_line* lines; // state.screen_rows entries, rebuilt by editor_wrap_scroll
+static int lines_len;
+static int cursor_y, cursor_x;
+
+// where the segment starting at start ends: after the last blank that fits, or at the screen
+// edge when there is none in its second half. The end of the row if the rest fits.
+static struct row_pos wrap_next(const erow* row, struct row_pos start, int cols){
+    struct row_pos p = start, blank = start;
+    while(p.cx < row->size){
+        struct row_pos next = p;
+        editor_row_step(row, &next);
+        if(next.rx - start.rx > cols && p.cx > start.cx) return blank.cx > start.cx ? blank : p;
+        char c = row->chars[p.cx];
+        p = next;
+        if((c == ' ' || c == '\t') && p.rx - start.rx > cols / 2) blank = p;
+    }
+    return p;
+}
+
+// recompute row->wrap for the current screen width, if it is stale
+static void wrap_update(erow* row){
+    editor_row_touch(row); // a frozen row has no wrap points either, see cold-rows.c
+    int cols = state.screen_cols;
+    if(row->wrap_cols == cols) return;
+    struct row_pos start = { 0, 0, 0 };
+    int count = 0;
+    for(struct row_pos s = wrap_next(row, start, cols); s.cx < row->size; s = wrap_next(row, s, cols)){
+        ++count;
+    }
+    if(count != row->wrap_count){
+        row->wrap = mem_realloc(MEM_WRAP, row->wrap, sizeof(struct row_pos) * row->wrap_count,
+                                sizeof(struct row_pos) * count);
+        if(row->wrap == NULL && count > 0) error("realloc");
+        row->wrap_count = count;
+    }
+    int k = 0;
+    for(struct row_pos s = wrap_next(row, start, cols); s.cx < row->size; s = wrap_next(row, s, cols)){
+        row->wrap[k++] = s;
+    }
+    row->wrap_cols = cols;
+}
+
+// screen lines row r takes (one past the end of the file, where the cursor can be)
+static int row_segments(int r){
+    if(r >= state.num_rows) return 1;
+    wrap_update(&state.row[r]);
+    return state.row[r].wrap_count + 1;
+}
+
+static struct row_pos seg_start(erow* row, int seg){
+    struct row_pos start = { 0, 0, 0 };
+    return seg == 0 ? start : row->wrap[seg - 1];
+}
+
+static struct row_pos seg_end(erow* row, int seg){
+    return seg == row->wrap_count ? editor_row_pos(row, POS_CX, row->size) : row->wrap[seg];
+}
+
+// the segment screen column rx of the row is on
+static int seg_of(erow* row, int rx){
+    wrap_update(row);
+    int lo = 0, hi = row->wrap_count; // the last segment whose start is <= rx
+    while(lo < hi){
+        int mid = (lo + hi + 1) / 2;
+        if(row->wrap[mid - 1].rx <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// call with state.rx up to date. Moves (rowoff, segoff) so the cursor is on screen and rebuilds
+// the screen line index.
+void editor_wrap_scroll(){
+    int cseg = state.cy < state.num_rows ? seg_of(&state.row[state.cy], state.rx) : 0;
+    state.coloff = 0;
+    if(state.segoff >= row_segments(state.rowoff)) state.segoff = row_segments(state.rowoff) - 1;
+
+    if(state.cy < state.rowoff || (state.cy == state.rowoff && cseg < state.segoff)){
+        state.rowoff = state.cy;
+        state.segoff = cseg;
+    }else{
+        // screen lines from the top down to the cursor, stopping once it is clearly off screen
+        int dist = cseg - state.segoff;
+        int r;
+        for(r = state.rowoff; r < state.cy && dist < state.screen_rows; ++r) dist += row_segments(r);
+        if(r < state.cy || dist >= state.screen_rows){
+            // cursor goes on the last line: walk back up a screenful from it
+            int row = state.cy, seg = cseg, n = state.screen_rows - 1;
+            while(n > 0){
+                if(seg >= n){
+                    seg -= n;
+                    break;
+                }
+                if(row == 0){
+                    seg = 0;
+                    break;
+                }
+                n -= seg + 1;
+                --row;
+                seg = row_segments(row) - 1;
+            }
+            state.rowoff = row;
+            state.segoff = seg;
+        }
+    }
+
+    if(lines_len != state.screen_rows){
+        lines = mem_realloc(MEM_WRAP, lines, sizeof(*lines) * lines_len, sizeof(*lines) * state.screen_rows);
+        if(lines == NULL) error("realloc");
+        lines_len = state.screen_rows;
+    }
+    int row = state.rowoff, seg = state.segoff;
+    cursor_y = cursor_x = 0;
+    for(int i = 0; i < lines_len; ++i){
+        lines[i].row = row < state.num_rows ? row : -1;
+        lines[i].seg = seg;
+        if(row == state.cy && seg == cseg){
+            cursor_y = i;
+            cursor_x = state.cy < state.num_rows ? state.rx - seg_start(&state.row[row], seg).rx : 0;
+            if(cursor_x >= state.screen_cols) cursor_x = state.screen_cols - 1;
+        }
+        if(++seg >= row_segments(row)){
+            ++row;
+            seg = 0;
+        }
+    }
+}
+
+// what screen line i shows: row and the [start, start+len) span of its render. 0 past the end of
+// the file.
+int editor_wrap_line(int i, int* row, int* start, int* len){
+    if(i >= lines_len || lines[i].row < 0) return 0;
+    erow* r = &state.row[lines[i].row];
+    int seg = lines[i].seg;
+    *row = lines[i].row;
+    *start = seg_start(r, seg).bx;
+    *len = (seg == r->wrap_count ? r->rsize : r->wrap[seg].bx) - *start;
+    return 1;
+}
+
+// where the cursor is on screen, relative to the text area
+void editor_wrap_cursor(int* y, int* x){
+    *y = cursor_y;
+    *x = cursor_x;
+}
+
+// Ctrl-D/Ctrl-U with wrap on: move n screen lines (up if n < 0), keeping the column on screen
+void editor_wrap_move(int n){
+    if(state.num_rows == 0) return;
+    if(state.cy >= state.num_rows) state.cy = state.num_rows - 1;
+    erow* row = &state.row[state.cy];
+    int rx = editor_row_cx_to_rx(row, state.cx);
+    int seg = seg_of(row, rx);
+    int col = rx - seg_start(row, seg).rx;
+
+    for(; n > 0; --n){
+        if(seg + 1 < row_segments(state.cy)) ++seg;
+        else if(state.cy + 1 < state.num_rows){
+            ++state.cy;
+            seg = 0;
+        }else break;
+    }
+    for(; n < 0; ++n){
+        if(seg > 0) --seg;
+        else if(state.cy > 0){
+            --state.cy;
+            seg = row_segments(state.cy) - 1;
+        }else break;
+    }
+
+    row = &state.row[state.cy];
+    rx = seg_start(row, seg).rx + col;
+    if(rx >= seg_end(row, seg).rx) rx = seg_end(row, seg).rx - 1;
+    if(rx < seg_start(row, seg).rx) rx = seg_start(row, seg).rx;
+    state.cx = editor_row_rx_to_cx(row, rx);
+}
+
+void editor_wrap_toggle(){
+    state.wrap = !state.wrap;
+    state.segoff = 0;
+    state.coloff = 0;
+    editor_set_status_msg("wrap %s", state.wrap ? "on" : "off");
+}
+
+void editor_free_wrap(){
+    mem_free(MEM_WRAP, lines, sizeof(*lines) * lines_len);
+    lines = NULL;
+    lines_len = 0;
+}
@@ -0,0 +1,565 @@
+
+#include "editor.h"
+#include <sys/file.h> /* flock */
+
+/* ------------------------------------ swap-file journal ------------------------------------ */
+// Every change to the rows is appended to ".<name>.swp" next to the file being edited, so an
+// editor that dies without saving can be recovered by replaying the journal over the file on
+// the next editor_open. The swap file is removed again on a normal exit.
+//
+// The editor journaling into a swap file keeps it flock'ed. A second editor on the same file finds
+// it locked and leaves it alone (no recovery, no journal of its own), and a swap file written
+// against another version of the file is left for the user to deal with instead of overwritten.
+//
+// Records are an op byte followed by varint arguments (and raw bytes for text). Runs of typed
+// or deleted characters are coalesced into one record before they reach the buffer, the buffer
+// is written out in batches and fsync'd when the user goes idle (or at least once a second), so
+// a keystroke only costs a few memory writes.
+//
+// Layout: "NPSWP2\n" <varint size> <varint mtime seconds> <varint mtime nanoseconds> <varint inode>
+// of the file the journal applies to, then records.
+
+#define JOURNAL_MAGIC "NPSWP2\n"
+#define JOURNAL_MAGIC_LEN 7
+#define JOURNAL_FLUSH_BYTES (64 * 1024) // write() the buffer once it grows past this
+#define JOURNAL_SYNC_SECS 1             // longest time an edit can sit unsynced while typing
+#define JOURNAL_COMPACT_MIN (1 << 20)   // never compact journals smaller than this
+
+enum journal_op{
+    J_INSERT_ROW = 1, // idx, len, bytes
+    J_DELETE_ROWS,    // idx, n
+    J_INSERT_TEXT,    // idx, col, len, bytes
+    J_DELETE_TEXT,    // idx, col, n
+    J_TRUNCATE_ROW,   // idx, len
+    J_SET_ROW,        // idx, len, bytes
+    J_MOVE_ROWS,      // idx, n, zigzag(delta)
+    J_CLEAR,          // drop every row, start of a compacted journal
+};
+
+struct journal {
+    int fd;             // -1 when journaling is off
+    char* path;
+    char* buf;          // encoded records not yet handed to write()
+    int len, cap;
+    long size;          // bytes in the journal file, including buf
+    long base_size;     // size of the text the journal started from, used to decide on compaction
+    long new_size;      // bytes written to a replacement journal that is being built
+    long save_mark;     // journal size when the running save took its snapshot
+    int unsynced;       // data written since the last fsync
+    time_t last_sync;
+
+    // the record currently being coalesced, J_INSERT_TEXT or J_DELETE_TEXT (0 if none)
+    int pending_op;
+    int pending_idx, pending_col, pending_n;
+    char* pending_text;
+    int pending_cap;
+};
+
+static struct journal journal = { .fd = -1 };
+
+/* ---------------------------------------- encoding ---------------------------------------- */
+static void journal_reserve(int n){
+    if(journal.len + n <= journal.cap) return;
+    journal.cap = (journal.len + n) * 2;
+    journal.buf = realloc(journal.buf, journal.cap);
+    if(journal.buf == NULL) error("realloc");
+}
+
+static void journal_put_byte(int b){
+    journal_reserve(1);
+    journal.buf[journal.len++] = (char) b;
+}
+
+// 7 bits per byte, high bit set on all but the last byte
+static void journal_put_varint(unsigned long v){
+    journal_reserve(10);
+    while(v >= 0x80){
+        journal.buf[journal.len++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    journal.buf[journal.len++] = (char) v;
+}
+
+static void journal_put_bytes(const char* s, int len){
+    journal_put_varint(len);
+    journal_reserve(len);
+    memcpy(journal.buf + journal.len, s, len);
+    journal.len += len;
+}
+
+static int journal_get_varint(const char** p, const char* end, unsigned long* v){
+    *v = 0;
+    int shift = 0;
+    while(*p < end && shift < 64){
+        unsigned char b = *(*p)++;
+        *v |= (unsigned long)(b & 0x7F) << shift;
+        if(!(b & 0x80)) return 1;
+        shift += 7;
+    }
+    return 0;
+}
+
+/* ---------------------------------------- writing ---------------------------------------- */
+// encode the record that is being coalesced
+static void journal_end_pending(){
+    if(!journal.pending_op) return;
+    journal_put_byte(journal.pending_op);
+    journal_put_varint(journal.pending_idx);
+    journal_put_varint(journal.pending_col);
+    if(journal.pending_op == J_INSERT_TEXT){
+        journal_put_bytes(journal.pending_text, journal.pending_n);
+    }else{
+        journal_put_varint(journal.pending_n);
+    }
+    journal.pending_op = 0;
+}
+
+// hand everything encoded so far to the kernel
+static void journal_write_out(){
+    journal_end_pending();
+    if(journal.fd == -1 || journal.len == 0) return;
+    if(write(journal.fd, journal.buf, journal.len) != journal.len){
+        editor_set_status_msg("Swap file write failed: %s", strerror(errno));
+    }
+    journal.size += journal.len;
+    journal.len = 0;
+    journal.unsynced = 1;
+}
+
+void editor_journal_sync(){
+    if(journal.fd == -1) return;
+    journal_write_out();
+    if(journal.unsynced){
+        fsync(journal.fd);
+        journal.unsynced = 0;
+    }
+    journal.last_sync = time(NULL);
+    editor_journal_compact();
+}
+
+// 1 if there are edits that are not yet on disk, the input loop syncs them once the user idles
+int editor_journal_pending(){
+    return journal.fd != -1 && (journal.len || journal.pending_op || journal.unsynced);
+}
+
+// start of every record, also decides whether it is time for a batch to go to disk
+static int journal_begin(){
+    if(journal.fd == -1) return 0;
+    if(journal.len >= JOURNAL_FLUSH_BYTES) journal_write_out();
+    if(journal.unsynced && time(NULL) - journal.last_sync >= JOURNAL_SYNC_SECS) editor_journal_sync();
+    return 1;
+}
+
+static int journal_row_idx(erow* row){
+    return (int)(row - state.row);
+}
+
+void editor_journal_insert_row(int idx, const char* s, int len){
+    if(!journal_begin()) return;
+    journal_end_pending();
+    journal_put_byte(J_INSERT_ROW);
+    journal_put_varint(idx);
+    journal_put_bytes(s, len);
+}
+
+void editor_journal_delete_rows(int idx, int n){
+    if(!journal_begin()) return;
+    journal_end_pending();
+    journal_put_byte(J_DELETE_ROWS);
+    journal_put_varint(idx);
+    journal_put_varint(n);
+}
+
+void editor_journal_insert_text(erow* row, int col, const char* s, int len){
+    if(!journal_begin()) return;
+    int idx = journal_row_idx(row);
+    // typing: keep extending the same record while the text stays contiguous
+    if(journal.pending_op != J_INSERT_TEXT || journal.pending_idx != idx ||
+            journal.pending_col + journal.pending_n != col){
+        journal_end_pending();
+        journal.pending_op = J_INSERT_TEXT;
+        journal.pending_idx = idx;
+        journal.pending_col = col;
+        journal.pending_n = 0;
+    }
+    if(journal.pending_n + len > journal.pending_cap){
+        journal.pending_cap = (journal.pending_n + len) * 2;
+        journal.pending_text = realloc(journal.pending_text, journal.pending_cap);
+        if(journal.pending_text == NULL) error("realloc");
+    }
+    memcpy(journal.pending_text + journal.pending_n, s, len);
+    journal.pending_n += len;
+}
+
+void editor_journal_delete_text(erow* row, int col, int n){
+    if(!journal_begin()) return;
+    int idx = journal_row_idx(row);
+    if(journal.pending_op == J_DELETE_TEXT && journal.pending_idx == idx){
+        if(col == journal.pending_col){ // 'x' repeatedly
+            journal.pending_n += n;
+            return;
+        }
+        if(col + n == journal.pending_col){ // backspace repeatedly
+            journal.pending_col = col;
+            journal.pending_n += n;
+            return;
+        }
+    }
+    journal_end_pending();
+    journal.pending_op = J_DELETE_TEXT;
+    journal.pending_idx = idx;
+    journal.pending_col = col;
+    journal.pending_n = n;
+}
+
+void editor_journal_truncate_row(erow* row, int len){
+    if(!journal_begin()) return;
+    journal_end_pending();
+    journal_put_byte(J_TRUNCATE_ROW);
+    journal_put_varint(journal_row_idx(row));
+    journal_put_varint(len);
+}
+
+void editor_journal_set_row(int idx){
+    if(!journal_begin()) return;
+    journal_end_pending();
+    journal_put_byte(J_SET_ROW);
+    journal_put_varint(idx);
+    journal_put_bytes(state.row[idx].chars, state.row[idx].size);
+}
+
+void editor_journal_move_rows(int idx, int n, int delta){
+    if(!journal_begin()) return;
+    journal_end_pending();
+    journal_put_byte(J_MOVE_ROWS);
+    journal_put_varint(idx);
+    journal_put_varint(n);
+    journal_put_varint(delta < 0 ? ((unsigned long) -delta << 1) - 1 : (unsigned long) delta << 1);
+}
+
+/* ---------------------------------------- replaying ---------------------------------------- */
+// Apply the records in [p, end) to the rows, returns the number of records applied.
+// *stop is left just past the last complete record.
+static int journal_replay(const char* p, const char* end, const char** stop){
+    int applied = 0;
+    unsigned long idx, a, b;
+    *stop = p;
+    while(p < end){
+        int op = (unsigned char) *p++;
+        if(op == J_CLEAR){
+            for(int i = 0; i < state.num_rows; ++i) editor_free_row(&state.row[i]);
+            state.num_rows = 0;
+            ++applied;
+            *stop = p;
+            continue;
+        }
+        if(!journal_get_varint(&p, end, &idx)) break;
+        switch(op){
+            case J_INSERT_ROW:
+            case J_SET_ROW:
+                if(!journal_get_varint(&p, end, &a) || a > (unsigned long)(end - p)) return applied;
+                if(op == J_INSERT_ROW){
+                    editor_insert_row(idx, (char*) p, a);
+                }else if(idx < (unsigned long) state.num_rows){
+                    editor_row_delete_span(&state.row[idx], 0, state.row[idx].size);
+                    editor_row_insert_span(&state.row[idx], 0, p, a);
+                }
+                p += a;
+                break;
+            case J_DELETE_ROWS:
+                if(!journal_get_varint(&p, end, &a)) return applied;
+                editor_delete_rows(idx, a);
+                break;
+            case J_INSERT_TEXT:
+                if(!journal_get_varint(&p, end, &a) || !journal_get_varint(&p, end, &b) ||
+                        b > (unsigned long)(end - p)) return applied;
+                if(idx < (unsigned long) state.num_rows){
+                    editor_row_insert_span(&state.row[idx], a, p, b);
+                }
+                p += b;
+                break;
+            case J_DELETE_TEXT:
+                if(!journal_get_varint(&p, end, &a) || !journal_get_varint(&p, end, &b)) return applied;
+                if(idx < (unsigned long) state.num_rows){
+                    editor_row_delete_span(&state.row[idx], a, b);
+                }
+                break;
+            case J_TRUNCATE_ROW:
+                if(!journal_get_varint(&p, end, &a)) return applied;
+                if(idx < (unsigned long) state.num_rows) editor_row_truncate(&state.row[idx], a);
+                break;
+            case J_MOVE_ROWS:
+                if(!journal_get_varint(&p, end, &a) || !journal_get_varint(&p, end, &b)) return applied;
+                editor_move_rows(idx, a, (b & 1) ? -(long)((b + 1) >> 1) : (long)(b >> 1));
+                break;
+            default:
+                return applied; // torn write at the end of the journal
+        }
+        ++applied;
+        *stop = p;
+    }
+    return applied;
+}
+
+/* ---------------------------------------- lifecycle ---------------------------------------- */
+static char* journal_path_for(const char* filename){
+    const char* slash = strrchr(filename, '/');
+    int dir_len = slash ? (int)(slash - filename) + 1 : 0;
+    char* path = malloc(strlen(filename) + 6);
+    memcpy(path, filename, dir_len);
+    sprintf(path + dir_len, ".%s.swp", filename + dir_len);
+    return path;
+}
+
+// size, mtime and inode of the file on disk that the journal is replayed over
+static void journal_put_header(const char* filename){
+    struct stat st;
+    if(stat(filename, &st) == -1) memset(&st, 0, sizeof(st));
+    journal_reserve(JOURNAL_MAGIC_LEN);
+    memcpy(journal.buf + journal.len, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN);
+    journal.len += JOURNAL_MAGIC_LEN;
+    journal_put_varint(st.st_size);
+    journal_put_varint(st.st_mtim.tv_sec);
+    journal_put_varint(st.st_mtim.tv_nsec);
+    journal_put_varint(st.st_ino);
+    journal.base_size = st.st_size;
+}
+
+// Checks the header at *p against filename as it is on disk now and moves *p past it. The same
+// size written within the same second by something else still has another mtime or inode.
+static int journal_header_matches(const char** p, const char* end, const char* filename){
+    unsigned long size, sec, nsec, ino;
+    struct stat st;
+    if(end - *p < JOURNAL_MAGIC_LEN || memcmp(*p, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN)) return 0;
+    *p += JOURNAL_MAGIC_LEN;
+    return journal_get_varint(p, end, &size) && journal_get_varint(p, end, &sec) &&
+           journal_get_varint(p, end, &nsec) && journal_get_varint(p, end, &ino) &&
+           stat(filename, &st) == 0 && (unsigned long) st.st_size == size &&
+           (unsigned long) st.st_mtim.tv_sec == sec && (unsigned long) st.st_mtim.tv_nsec == nsec &&
+           (unsigned long) st.st_ino == ino;
+}
+
+// Opens the swap file and locks it. Returns its fd, -1 if there is none, or -2 if another editor
+// holds the lock: it is that editor's live journal.
+static int journal_lock_existing(){
+    for(int tries = 0; tries < 10; ++tries){
+        int fd = open(journal.path, O_RDONLY);
+        if(fd == -1) return -1;
+        if(flock(fd, LOCK_EX | LOCK_NB) == -1 && errno == EWOULDBLOCK){
+            close(fd);
+            return -2;
+        }
+        // the owner may have just renamed a new journal over the one that was locked
+        struct stat locked, now;
+        if(fstat(fd, &locked) == 0 && stat(journal.path, &now) == 0 &&
+           locked.st_dev == now.st_dev && locked.st_ino == now.st_ino) return fd;
+        close(fd);
+    }
+    return -2;
+}
+
+// Start writing a replacement journal next to the current one, returns its fd (header already
+// written) or -1. Nothing replaces the live journal until journal_commit_file().
+static int journal_start_file(){
+    char* tmp = malloc(strlen(journal.path) + 5);
+    sprintf(tmp, "%s.tmp", journal.path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    free(tmp);
+    if(fd == -1) return -1;
+    flock(fd, LOCK_EX | LOCK_NB); // the lock goes with the file when it is renamed into place
+
+    int saved_len = journal.len;
+    journal.len = 0;
+    journal_put_header(state.filename);
+    int ok = write(fd, journal.buf, journal.len) == journal.len;
+    journal.new_size = journal.len;
+    journal.len = saved_len;
+    if(!ok){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// make the replacement journal the live one, atomically as far as a crash is concerned
+static int journal_commit_file(int fd){
+    char* tmp = malloc(strlen(journal.path) + 5);
+    sprintf(tmp, "%s.tmp", journal.path);
+    int ok = fsync(fd) == 0 && rename(tmp, journal.path) == 0;
+    free(tmp);
+    if(!ok){
+        close(fd);
+        return -1;
+    }
+    if(journal.fd != -1 && journal.fd != fd) close(journal.fd);
+    journal.fd = fd;
+    journal.size = journal.new_size;
+    journal.unsynced = 0;
+    journal.last_sync = time(NULL);
+    return 0;
+}
+
+// (re)create the journal as a header followed by raw records carried over from an older one
+static int journal_create(const char* tail, long tail_len){
+    int fd = journal_start_file();
+    if(fd == -1) return -1;
+    if(tail_len > 0 && write(fd, tail, tail_len) != tail_len){
+        close(fd);
+        return -1;
+    }
+    journal.new_size += tail_len;
+    return journal_commit_file(fd);
+}
+
+// Called by editor_open once the file is loaded: recovers unsaved edits from a previous
+// session if its swap file is still around, then starts journaling this one.
+void editor_journal_open(const char* filename){
+    editor_journal_close(0);
+    journal.path = journal_path_for(filename);
+
+    int recovered = -1;
+    int fd = journal_lock_existing();
+    if(fd == -2){
+        editor_set_status_msg("Swap file %s is in use by another editor", journal.path);
+        return;
+    }
+    if(fd != -1){
+        struct stat st;
+        char* data = NULL;
+        const char* p = NULL;
+        // only replay over the exact file the journal was written against
+        if(fstat(fd, &st) == 0 && (data = malloc(st.st_size + 1)) && read(fd, data, st.st_size) == st.st_size){
+            p = data;
+            if(!journal_header_matches(&p, data + st.st_size, filename)) p = NULL;
+        }
+        if(p == NULL){
+            free(data);
+            close(fd);
+            editor_set_status_msg("Swap file %s is for another version of the file", journal.path);
+            return;
+        }
+        const char* stop;
+        state.undoing = 1;
+        recovered = journal_replay(p, data + st.st_size, &stop);
+        state.undoing = 0;
+        // keep the recovered records (minus any torn tail) so a second crash doesn't lose them
+        if(journal_create(p, stop - p) == -1) recovered = -1;
+        free(data);
+        close(fd);
+    }
+
+    if(recovered > 0){
+        state.dirty += recovered;
+        editor_set_status_msg("Recovered %d changes from %s", recovered, journal.path);
+    }else if(journal.fd == -1 && journal_create(NULL, 0) == -1){
+        editor_set_status_msg("Could not create swap file %s", journal.path);
+    }
+}
+
+// a save took its snapshot, everything journaled up to here is about to be on disk
+void editor_journal_mark_save(){
+    if(journal.fd == -1) return;
+    journal_write_out();
+    journal.save_mark = journal.size;
+}
+
+// the save finished: restart the journal from the new file, keeping edits made during the save
+void editor_journal_saved(){
+    if(journal.fd == -1) return;
+    journal_write_out();
+    long keep = journal.size - journal.save_mark;
+    char* tail = NULL;
+    if(keep > 0){
+        tail = malloc(keep);
+        if(pread(journal.fd, tail, keep, journal.save_mark) != keep) keep = 0;
+    }
+    journal_create(tail, keep);
+    free(tail);
+}
+
+// Once the journal has grown well past the text it started from, replace it with a single
+// image of the current rows. Each compaction writes at most half the bytes journaled since the
+// previous one, so the cost per edit stays constant.
+void editor_journal_compact(){
+    if(journal.fd == -1 || editor_save_in_progress()) return;
+    long limit = 2 * journal.base_size;
+    if(limit < JOURNAL_COMPACT_MIN) limit = JOURNAL_COMPACT_MIN;
+    if(journal.size <= limit) return;
+
+    long image = 0;
+    for(int i = 0; i < state.num_rows; ++i) image += state.row[i].size + 1;
+    if(image >= journal.size) return;
+
+    editor_cold_thaw_all(); // the image needs every row's text
+    journal_write_out();
+    int fd = journal_start_file();
+    if(fd == -1) return;
+
+    // encode the image straight into the replacement file
+    int live_fd = journal.fd;
+    long written = journal.new_size;
+    journal.fd = fd;
+    journal_put_byte(J_CLEAR);
+    for(int i = 0; i < state.num_rows; ++i){
+        journal_put_byte(J_INSERT_ROW);
+        journal_put_varint(i);
+        journal_put_bytes(state.row[i].chars, state.row[i].size);
+        if(journal.len >= JOURNAL_FLUSH_BYTES){
+            written += journal.len;
+            journal_write_out();
+        }
+    }
+    written += journal.len;
+    journal_write_out();
+    journal.fd = live_fd;
+
+    journal.new_size = written;
+    if(journal_commit_file(fd) == 0) journal.base_size = image;
+}
+
+// stop journaling, removing the swap file if remove is set (a normal exit)
+void editor_journal_close(int remove){
+    if(journal.fd != -1){
+        if(remove){
+            unlink(journal.path);
+        }else{
+            editor_journal_sync();
+        }
+        close(journal.fd);
+        journal.fd = -1;
+    }
+    free(journal.path);
+    journal.path = NULL;
+    journal.len = 0;
+    journal.pending_op = 0;
+}
+
+// The journal of the current buffer, handed over when another buffer becomes current (see
+// buffers.c). Everything coalesced so far is written out first, journaling is off afterwards
+// until editor_journal_attach or editor_journal_open.
+struct journal* editor_journal_detach(){
+    journal_write_out();
+    struct journal* j = malloc(sizeof(struct journal));
+    if(j == NULL) error("malloc");
+    *j = journal;
+    journal = (struct journal){ .fd = -1 };
+    return j;
+}
+
+// make j (from editor_journal_detach) the journal edits go to again, j is freed
+void editor_journal_attach(struct journal* j){
+    editor_journal_close(0);
+    free(journal.buf);
+    free(journal.pending_text);
+    journal = *j;
+    free(j);
+}
+
+// editor_journal_close for a detached journal
+void editor_journal_discard(struct journal* j, int remove){
+    if(j == NULL) return;
+    struct journal* cur = editor_journal_detach();
+    editor_journal_attach(j);
+    editor_journal_close(remove);
+    editor_journal_attach(cur);
+}
@@ -14,30 +14,53 @@ char* C_HL_keywords[] = {
 
 /* ------------------------------------- syntax highlighting ----------------------------------- */
 // moves through erow's render array and hl array, assigning highlight descriptions for each char within render, in hl
-// in charge of filling hl array
-void editor_update_syntax(erow* row){
+// in charge of filling hl array. Only looks at this row: in_comment says whether the row starts inside
+// a multi-line comment, and the return value is whether it ends inside one.
+int editor_highlight_row(erow* row, int in_comment){
+    if(row->chunks) return editor_highlight_chunks(row, in_comment); // only the chunks that changed
+    // an identical row highlighted from the same state already did the work, see line-storage.c
+    int out = line_cache_highlighted(row, in_comment);
+    if(out != -1) return out;
+    line_cache_unshare(row);
+
     // hl points to type uint8_t which is an unsigned char, which is 1 byte
-    row->hl = realloc(row->hl, row->rsize /* * sizeof(unsigned char) */);
-    memset(row->hl, HL_NORMAL, row->rsize);
+    // editor_update_render keeps an existing hl at rsize bytes, so it only has to be made once
+    if(row->hl == NULL) row->hl = mem_alloc(MEM_HL, row->rsize /* * sizeof(unsigned char) */);
+
+    struct hl_state st = { in_comment, 0, 0 };
+    editor_highlight_span(row->render, row->hl, row->rsize, &st);
+    line_cache_donate(row, in_comment, st.in_comment);
+    return st.in_comment;
+}
 
+// Highlight len bytes of render (followed by a '\0') into hl. st is the state the span starts in,
+// and is left at the state it ends in, so a long row can be highlighted one chunk at a time.
+void editor_highlight_span(const char* render, uint8_t* hl, int len, struct hl_state* st){
+    if(st->line_comment){
+        memset(hl, HL_COMMENT, len);
+        return;
+    }
+    memset(hl, HL_NORMAL, len);
+
+    int in_comment = st->in_comment;
     int prev_sep = 1; // start of row should act as a valid separator
-    int in_string = 0; // flag for inside double or single quotes.
+    int in_string = st->in_string; // flag for inside double or single quotes.
                        // it will equal the double or single quote so we can highlight: "jack's"
-    int in_comment = (row->idx > 0 && state.row[row->idx - 1].hl_open_comment);
     int i;
-    for(i=0;i<row->rsize;++i){
-        char c = row->render[i];
-        uint8_t prev_hl = (i > 0) ? row->hl[i-1]:HL_NORMAL;
+    for(i=0;i<len;++i){
+        char c = render[i];
+        uint8_t prev_hl = (i > 0) ? hl[i-1]:HL_NORMAL;
 
-        if(!in_string && !in_comment && !strncmp(&row->render[i], "//", 2)){
-            memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+        if(!in_string && !in_comment && !strncmp(&render[i], "//", 2)){
+            memset(&hl[i], HL_COMMENT, len - i);
+            st->line_comment = 1;
             break; // don't try to color anything else, if it is in a comment line
         }
 
         if (in_comment) {
-            row->hl[i] = HL_MLCOMMENT;
-            if (!strncmp(&row->render[i], "*/", 2)) {
-                memset(&row->hl[i], HL_MLCOMMENT, 2);
+            hl[i] = HL_MLCOMMENT;
+            if (!strncmp(&render[i], "*/", 2)) {
+                memset(&hl[i], HL_MLCOMMENT, 2);
                 ++i;
                 in_comment = 0;
                 prev_sep = 1;
@@ -45,21 +68,21 @@ void editor_update_syntax(erow* row){
             } else {
                 continue;
             }
-        } else if (!strncmp(&row->render[i], "/*", 2)) {
-            memset(&row->hl[i], HL_MLCOMMENT, 2);
+        } else if (!strncmp(&render[i], "/*", 2)) {
+            memset(&hl[i], HL_MLCOMMENT, 2);
             ++i;
             in_comment = 1;
             continue;
         }
 
         if(in_string){
-            row->hl[i] = HL_STRING;
-            if(c == '\\' && i+1 < row->rsize){
+            hl[i] = HL_STRING;
+            if(c == '\\' && i+1 < len){
                 // If there is a backslash, move to the next character
                 // then color the next character as well.
 
                 // Accounts for "hi\"there"
-                row->hl[i+1] = HL_STRING;
+                hl[i+1] = HL_STRING;
                 ++i;
                 continue;
             }
@@ -69,14 +92,14 @@ void editor_update_syntax(erow* row){
         }else{
             if(c == '"' || c == '\''){
                 in_string = c;
-                row->hl[i] = HL_STRING;
+                hl[i] = HL_STRING;
                 continue;
             }
         }
 
         if(isdigit(c) && ((prev_sep || prev_hl == HL_NUMBER) ||
                           (c == '.' && prev_hl == HL_NUMBER))){
-            row->hl[i] = HL_NUMBER;
+            hl[i] = HL_NUMBER;
             prev_sep = 0; // we are currently highlighting the number
             continue;
         }
@@ -88,9 +111,9 @@ void editor_update_syntax(erow* row){
                 int is_kw2 = C_HL_keywords[j][keyword_len - 1] == '|';
                 if (is_kw2) --keyword_len;
 
-                if (!strncmp(&row->render[i], C_HL_keywords[j], keyword_len) &&
-                        is_separator(row->render[i + keyword_len])) {
-                    memset(&row->hl[i], is_kw2 ? HL_KEYWORD2 : HL_KEYWORD1, keyword_len);
+                if (!strncmp(&render[i], C_HL_keywords[j], keyword_len) &&
+                        is_separator(render[i + keyword_len])) {
+                    memset(&hl[i], is_kw2 ? HL_KEYWORD2 : HL_KEYWORD1, keyword_len);
                     i += (keyword_len-1); // outer loop increments
                     break;
                 }
@@ -104,13 +127,28 @@ void editor_update_syntax(erow* row){
 
         prev_sep = is_separator(c);
     }
+    st->in_comment = in_comment;
+    st->in_string = in_string;
+}
 
-    // check if we closed the multi-line comment or not
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    if(changed && row->idx + 1 < state.num_rows){
-        editor_update_syntax(&state.row[row->idx + 1]);
+// highlight a row in place within state.row, carrying multi-line comment state into the rows below
+void editor_update_syntax(erow* row){
+    long long start = editor_perf_now();
+    int rows = 0;
+    while(1){
+        editor_row_touch(row); // the rows below may be frozen, see cold-rows.c
+        int in_comment = (row->idx > 0 && state.row[row->idx - 1].hl_open_comment);
+        in_comment = editor_highlight_row(row, in_comment);
+        ++rows;
+
+        // check if we closed the multi-line comment or not, the rows below change with it
+        int changed = (row->hl_open_comment != in_comment);
+        row->hl_open_comment = in_comment;
+        if(!changed || row->idx + 1 >= state.num_rows) break;
+        row = &state.row[row->idx + 1];
     }
+    editor_perf_count_rows(rows);
+    editor_perf_record(PERF_SYNTAX, start, rows);
 }
 
 // returns the ansi code for integers from editor_highlight
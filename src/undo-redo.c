@@ -1,50 +1,44 @@
 
 #include "editor.h"
 
-// deep copy of a row (for undo-redo)
+// copy of a row for undo-redo. Only the text is kept (shared, so nothing is copied until the row
+// is edited again), render and hl are rebuilt when the row is restored.
 stack_entry editor_deep_copy_row(const erow* src, int action) {
     stack_entry copy;
 
-    copy.row.idx = src->idx;
-    copy.row.hl_open_comment = src->hl_open_comment;
-    copy.row.size = src->size;
-    copy.row.rsize = src->rsize;
-
-    copy.row.chars = malloc(copy.row.size + 1);
-    memcpy(copy.row.chars, src->chars, copy.row.size);
-    copy.row.chars[copy.row.size] = '\0';
-
-    copy.row.render = malloc(copy.row.rsize + 1);
-    memcpy(copy.row.render, src->render, copy.row.rsize);
-    copy.row.render[copy.row.rsize] = '\0';
-
-    copy.row.hl = malloc(copy.row.rsize);
-    memcpy(copy.row.hl, src->hl, copy.row.rsize);
-
+    copy.row = editor_copy_row(src);
+    line_undo_hold(copy.row.chars);
+    copy.block = NULL;
+    copy.block_rows = 0;
+    copy.moved_by = 0;
     copy.cx = state.cx;
     copy.cy = state.cy;
     copy.action = action;
+    copy.group = 0;
 
     return copy;
 }
 
+// text-only copy of a row, call editor_update_row once it is placed back into state.row
 erow editor_copy_row(const erow* src) {
     erow copy;
     copy.idx = src->idx;
     copy.hl_open_comment = src->hl_open_comment;
     copy.size = src->size;
-    copy.rsize = src->rsize;
-
-    copy.chars = malloc(copy.size + 1);
-    memcpy(copy.chars, src->chars, copy.size);
-    copy.chars[copy.size] = '\0';
-
-    copy.render = malloc(copy.rsize + 1);
-    memcpy(copy.render, src->render, copy.rsize);
-    copy.render[copy.rsize] = '\0';
-
-    copy.hl = malloc(copy.rsize);
-    memcpy(copy.hl, src->hl, copy.rsize);
+    copy.rsize = 0;
+
+    copy.chars = line_share(src->chars);
+    copy.render = NULL;
+    copy.hl = NULL;
+    copy.cols = NULL;
+    copy.col_count = 0;
+    copy.wrap = NULL;
+    copy.wrap_count = 0;
+    copy.chunks = NULL;
+    copy.num_chunks = 0;
+    copy.cold = NULL;
+    copy.seen = 0;
+    copy.wrap_cols = 0;
 
     return copy;
 }
@@ -59,10 +53,7 @@ void editor_split_row(int row_idx) {
     editor_insert_row(row_idx + 1, row->chars + split_point, row->size - split_point);
 
     // truncate current row
-    row->size = split_point;
-    row->chars[split_point] = '\0';
-
-    editor_update_row(row);
+    editor_row_truncate(row, split_point);
 }
 
 void editor_merge_row_below(int row_idx) {
@@ -75,27 +66,120 @@ void editor_merge_row_below(int row_idx) {
     editor_delete_row(row_idx+1);
 }
 
-// push a row state to undo/redo stacks
-void editor_push_to_stack(struct stack* s, erow* row, int action) {
+static stack_entry* editor_stack_push_slot(struct stack* s) {
     if (s->stack_size >= s->mem_size) {
-        s->mem_size = (s->stack_size + 1) * 2;
-        s->saves = realloc(s->saves, sizeof(stack_entry) * s->mem_size);
+        int mem_size = (s->stack_size + 1) * 2;
+        s->saves = mem_realloc(MEM_UNDO, s->saves, sizeof(stack_entry) * s->mem_size, sizeof(stack_entry) * mem_size);
+        if (s->saves == NULL) error("realloc");
+        s->mem_size = mem_size;
     }
+    return &s->saves[s->stack_size++];
+}
 
+// push a row state to undo/redo stacks
+void editor_push_to_stack(struct stack* s, erow* row, int action) {
     // push a deep copy of the row onto the stack
-    s->saves[s->stack_size] = editor_deep_copy_row(row, action);
-    ++s->stack_size;
+    editor_row_touch(row); // undo entries never hold frozen rows, see cold-rows.c
+    stack_entry* entry = editor_stack_push_slot(s);
+    *entry = editor_deep_copy_row(row, action);
+    entry->group = state.undo_group;
 }
 
-// pop the last state from the undo stack and revert the row
-void editor_undo() {
-    if (state.undo.stack_size == 0) {
-        editor_set_status_msg("Nothing to undo.");
+// push an entry covering rows [at, at+n). The n erows in rows are moved into the entry as they
+// are (the caller must forget them); rows can be NULL when only the range needs remembering.
+stack_entry* editor_push_rows_to_stack(struct stack* s, int at, erow* rows, int n, int action) {
+    for(int i = 0; rows && i < n; ++i) {
+        editor_row_touch(&rows[i]);
+        line_undo_hold(rows[i].chars);
+        editor_retag_row_cache(&rows[i], 1);
+    }
+    stack_entry* entry = editor_stack_push_slot(s);
+    memset(&entry->row, 0, sizeof(erow));
+    entry->row.idx = at;
+    entry->block = NULL;
+    entry->block_rows = n;
+    entry->moved_by = 0;
+    if (rows) {
+        entry->block = mem_alloc(MEM_UNDO, sizeof(erow) * n);
+        memcpy(entry->block, rows, sizeof(erow) * n);
+    }
+    entry->cx = state.cx;
+    entry->cy = state.cy;
+    entry->action = action;
+    entry->group = state.undo_group;
+    return entry;
+}
+
+// push text-only copies of rows [at, at+n), so an edit across all of them is one entry
+stack_entry* editor_push_row_copies_to_stack(struct stack* s, int at, int n, int action) {
+    stack_entry* entry = editor_push_rows_to_stack(s, at, NULL, n, action);
+    editor_cold_thaw_rows(at, n); // undo entries never hold frozen rows, see cold-rows.c
+    entry->block = mem_alloc(MEM_UNDO, sizeof(erow) * n);
+    for (int i = 0; i < n; ++i) {
+        entry->block[i] = editor_copy_row(&state.row[at + i]);
+        line_undo_hold(entry->block[i].chars);
+    }
+    return entry;
+}
+
+// Put the text of saved back into row idx. A long row keeps its chunks and only the part of it
+// that differs is re-rendered (see long-rows.c), everything else is rebuilt from scratch.
+static void editor_restore_row(int idx, const erow* saved) {
+    erow* row = &state.row[idx];
+    if (row->chunks == NULL) {
+        editor_free_row(row);
+        *row = editor_copy_row(saved);
+        row->idx = idx;
+        editor_update_row(row);
+        editor_journal_set_row(idx);
         return;
     }
+    // what both have in common at the start and the end, a block at a time while it matches
+    int n = row->size < saved->size ? row->size : saved->size;
+    int head = 0, tail = 0;
+    while (head + 4096 <= n && memcmp(row->chars + head, saved->chars + head, 4096) == 0) head += 4096;
+    while (head < n && row->chars[head] == saved->chars[head]) ++head;
+    while (tail + 4096 <= n - head &&
+           memcmp(row->chars + row->size - tail - 4096, saved->chars + saved->size - tail - 4096, 4096) == 0) tail += 4096;
+    while (tail < n - head && row->chars[row->size - tail - 1] == saved->chars[saved->size - tail - 1]) ++tail;
+
+    int old_size = row->size;
+    line_release(row->chars);
+    row->chars = line_share(saved->chars);
+    row->size = saved->size;
+    editor_update_row_span(row, head, old_size - head - tail, saved->size - head - tail);
+    editor_journal_set_row(idx);
+}
+
+// put the text saved in a MODIFY_ROWS entry back into its rows
+static void editor_restore_row_copies(stack_entry* entry) {
+    for (int i = 0; i < entry->block_rows; ++i) {
+        int idx = entry->row.idx + i;
+        if (idx >= state.num_rows) break;
+        editor_restore_row(idx, &entry->block[i]);
+    }
+}
+
+// the rows in an entry's block stop counting as undo, they go back into the table or are freed
+static void editor_take_block(stack_entry* entry) {
+    for (int i = 0; i < entry->block_rows; ++i) {
+        line_undo_unhold(entry->block[i].chars);
+        editor_retag_row_cache(&entry->block[i], 0);
+    }
+}
+
+// The rows an entry reads: its own and the one below it (a split or merge). Only these are thawed,
+// the rest of the file can stay frozen (see cold-rows.c).
+static void editor_thaw_entry(const stack_entry* entry) {
+    editor_cold_thaw_rows(entry->row.idx, (entry->block_rows > 0 ? entry->block_rows : 1) + 1);
+}
 
+// pop the last state from the undo stack and revert the row
+static void editor_undo_entry() {
     stack_entry* undo_entry = &state.undo.saves[state.undo.stack_size - 1];
-    erow redo_row = editor_copy_row(&state.row[state.cy]);
+    editor_thaw_entry(undo_entry);
+    erow redo_row = {0};
+    if (undo_entry->row.idx < state.num_rows) redo_row = editor_copy_row(&state.row[undo_entry->row.idx]);
     int redo_action = -1;
 
     state.undoing = 1;
@@ -103,13 +187,31 @@ void editor_undo() {
     case MODIFY_ROW:
         redo_action = MODIFY_ROW;
         if (undo_entry->row.idx < state.num_rows) {
-            editor_free_row(&state.row[undo_entry->row.idx]);
-            state.row[undo_entry->row.idx] = editor_copy_row(&undo_entry->row);
+            editor_restore_row(undo_entry->row.idx, &undo_entry->row);
         }
         break;
     case DELETE_ROW:
-        //redo_action = DELETE_ROW; // THESE ARE NOT WORKING YET
-        editor_insert_row(undo_entry->row.idx, undo_entry->row.chars, undo_entry->row.size);
+        // the removed rows go back in one move, and redo only has to remember the range
+        editor_take_block(undo_entry);
+        editor_insert_rows(undo_entry->row.idx, undo_entry->block, undo_entry->block_rows);
+        editor_push_rows_to_stack(&state.redo, undo_entry->row.idx, NULL, undo_entry->block_rows, DELETE_ROW);
+        mem_free(MEM_UNDO, undo_entry->block, sizeof(erow) * undo_entry->block_rows);
+        undo_entry->block = NULL;
+        break;
+    case MODIFY_ROWS:
+        editor_push_row_copies_to_stack(&state.redo, undo_entry->row.idx, undo_entry->block_rows, MODIFY_ROWS);
+        editor_restore_row_copies(undo_entry);
+        break;
+    case INSERT_ROWS:
+        // the rows move into the redo entry as they are, redo puts them back in one move
+        editor_push_rows_to_stack(&state.redo, undo_entry->row.idx, &state.row[undo_entry->row.idx],
+                                  undo_entry->block_rows, INSERT_ROWS);
+        editor_remove_rows(undo_entry->row.idx, undo_entry->block_rows);
+        break;
+    case MOVE_ROWS:
+        editor_move_rows(undo_entry->row.idx, undo_entry->block_rows, -undo_entry->moved_by);
+        editor_push_rows_to_stack(&state.redo, undo_entry->row.idx - undo_entry->moved_by, NULL,
+                                  undo_entry->block_rows, MOVE_ROWS)->moved_by = undo_entry->moved_by;
         break;
     case MERGE_ROW_UP:
         //redo_action = MERGE_ROW_UP;
@@ -128,6 +230,7 @@ void editor_undo() {
     if(redo_action != -1){
         editor_push_to_stack(&state.redo, &redo_row, redo_action);
     }
+    editor_free_row(&redo_row);
 
     // restore cursor position
     state.cx = undo_entry->cx;
@@ -136,21 +239,19 @@ void editor_undo() {
     editor_free_stack_entry(undo_entry);
     --state.undo.stack_size;
     editor_set_status_msg("Undo successful.");
-    state.dirty = 1;
+    ++state.dirty;
     state.undoing = 0;
 
 }
 
 // TODO: maybe merge this into one function with editor_undo
-void editor_redo() {
-    if (state.redo.stack_size == 0) {
-        editor_set_status_msg("Nothing to redo.");
-        return;
-    }
+static void editor_redo_entry() {
     state.undoing = 1;
 
     struct stack_entry* redo_entry = &state.redo.saves[state.redo.stack_size-1];
-    erow undo_row = editor_copy_row(&state.row[redo_entry->row.idx]);
+    editor_thaw_entry(redo_entry);
+    erow undo_row = {0};
+    if (redo_entry->row.idx < state.num_rows) undo_row = editor_copy_row(&state.row[redo_entry->row.idx]);
     int undo_action = -1;
 
     // Apply redo action
@@ -159,15 +260,37 @@ void editor_redo() {
         case MODIFY_ROW:
             undo_action = MODIFY_ROW;
             if (redo_entry->row.idx < state.num_rows) {
-                editor_free_row(&state.row[redo_entry->row.idx]);
-                state.row[redo_entry->row.idx] = editor_copy_row(&redo_entry->row);
+                editor_restore_row(redo_entry->row.idx, &redo_entry->row);
             }
             break;
+        case DELETE_ROW:
+            // deleting again records its own undo entry
+            state.undoing = 0;
+            editor_delete_rows(redo_entry->row.idx, redo_entry->block_rows);
+            state.undoing = 1;
+            break;
+        case MODIFY_ROWS:
+            editor_push_row_copies_to_stack(&state.undo, redo_entry->row.idx, redo_entry->block_rows, MODIFY_ROWS);
+            editor_restore_row_copies(redo_entry);
+            break;
+        case INSERT_ROWS:
+            editor_take_block(redo_entry);
+            editor_insert_rows(redo_entry->row.idx, redo_entry->block, redo_entry->block_rows);
+            editor_push_rows_to_stack(&state.undo, redo_entry->row.idx, NULL, redo_entry->block_rows, INSERT_ROWS);
+            mem_free(MEM_UNDO, redo_entry->block, sizeof(erow) * redo_entry->block_rows);
+            redo_entry->block = NULL;
+            break;
+        case MOVE_ROWS:
+            state.undoing = 0;
+            editor_move_rows(redo_entry->row.idx, redo_entry->block_rows, redo_entry->moved_by);
+            state.undoing = 1;
+            break;
     }
 
     if(undo_action != -1){
         editor_push_to_stack(&state.undo, &undo_row, undo_action);
     }
+    editor_free_row(&undo_row);
 
     state.cx = redo_entry->cx;
     state.cy = redo_entry->cy;
@@ -175,26 +298,71 @@ void editor_redo() {
     editor_free_stack_entry(redo_entry);
     --state.redo.stack_size;
     editor_set_status_msg("Redo successful.");
-    state.dirty = 1;
+    ++state.dirty;
     state.undoing = 0;
 }
 
+// Everything pushed between begin and end is undone as one step. Returns 1 if this call opened
+// the group (and so must close it), 0 if it is nested inside a group that is already open.
+int editor_undo_group_begin() {
+    static int next_group = 0;
+    if (state.undo_group) return 0;
+    state.undo_group = ++next_group;
+    return 1;
+}
+
+void editor_undo_group_end() {
+    state.undo_group = 0;
+}
+
+// Undo the top entry, or the whole group it belongs to (everything one macro replay did). The
+// entries pushed onto the other stack meanwhile get the same group, so redo is one step as well.
+static void editor_apply_group(struct stack* s, void (*apply)()) {
+    int group = s->saves[s->stack_size - 1].group;
+    int saved_group = state.undo_group;
+    state.undo_group = group;
+    do {
+        apply();
+    } while (group && s->stack_size > 0 && s->saves[s->stack_size - 1].group == group);
+    state.undo_group = saved_group;
+}
+
+void editor_undo() {
+    if (state.undo.stack_size == 0) {
+        editor_set_status_msg("Nothing to undo.");
+        return;
+    }
+    editor_apply_group(&state.undo, editor_undo_entry);
+}
+
+void editor_redo() {
+    if (state.redo.stack_size == 0) {
+        editor_set_status_msg("Nothing to redo.");
+        return;
+    }
+    editor_apply_group(&state.redo, editor_redo_entry);
+}
+
 // initialize the undo/redo stacks
 void editor_init_undo_redo_stacks() {
     state.undo.stack_size = 0;
     state.undo.mem_size = 16;
-    state.undo.saves = malloc(sizeof(stack_entry) * state.undo.mem_size);
+    state.undo.saves = mem_alloc(MEM_UNDO, sizeof(stack_entry) * state.undo.mem_size);
 
     state.redo.stack_size = 0;
     state.redo.mem_size = 16;
-    state.redo.saves = malloc(sizeof(stack_entry) * state.redo.mem_size);
+    state.redo.saves = mem_alloc(MEM_UNDO, sizeof(stack_entry) * state.redo.mem_size);
 }
 
 void editor_free_stack_entry(stack_entry* entry) {
     if(entry == NULL) return;
-    if(entry->row.chars) free(entry->row.chars);
-    if(entry->row.render) free(entry->row.render);
-    if(entry->row.hl) free(entry->row.hl);
+    if(entry->block){
+        editor_take_block(entry);
+        for(int i = 0; i < entry->block_rows; ++i) editor_free_row(&entry->block[i]);
+        mem_free(MEM_UNDO, entry->block, sizeof(erow) * entry->block_rows);
+    }
+    line_undo_unhold(entry->row.chars);
+    editor_free_row(&entry->row);
 }
 
 // free memory of the stack
@@ -203,6 +371,27 @@ void editor_free_stack(struct stack* s) {
     for (int i = 0; i < s->stack_size; ++i) {
         editor_free_stack_entry(&s->saves[i]);
     }
+    mem_free(MEM_UNDO, s->saves, sizeof(stack_entry) * s->mem_size);
+    s->saves = NULL;
     s->stack_size = 0;
     s->mem_size = 0;
 }
+
+static long editor_stack_memory(struct stack* s) {
+    long bytes = sizeof(stack_entry) * s->mem_size;
+    for (int i = 0; i < s->stack_size; ++i) {
+        stack_entry* e = &s->saves[i];
+        if (e->row.chars) bytes += e->row.size + 1;
+        if (e->block == NULL) continue;
+        bytes += sizeof(erow) * e->block_rows;
+        for (int j = 0; j < e->block_rows; ++j) {
+            bytes += e->block[j].size + 1;
+        }
+    }
+    return bytes;
+}
+
+// bytes held by the undo and redo stacks, counting payloads as if they were not shared
+long editor_undo_memory() {
+    return editor_stack_memory(&state.undo) + editor_stack_memory(&state.redo);
+}
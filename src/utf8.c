@@ -0,0 +1,220 @@
+
+#include "editor.h"
+
+/* ------------------------------------ utf-8 and columns ------------------------------------ */
+// A row has three coordinates: cx is a byte in chars, bx a byte in render (tabs expanded to
+// spaces, everything else copied) and rx the screen column, where a CJK character or an emoji
+// takes two columns and a combining mark none. struct row_pos holds all three for the start of
+// one character, and editor_row_step moves it past that character.
+//
+// Converting between them means walking the row, so editor_update_render leaves a checkpoint
+// every COLUMN_STEP bytes of chars in row->cols, and a lookup walks at most that far from the
+// nearest one, however long the row is.
+
+#define COLUMN_STEP 64
+
+// Decodes the character at s (len bytes available) into *cp and returns its length in bytes.
+// Anything that isn't valid UTF-8 is taken one byte at a time, with *cp = -1.
+int utf8_decode(const char* s, int len, int* cp){
+    const unsigned char* u = (const unsigned char*) s;
+    int n, c;
+    if(u[0] < 0x80){
+        *cp = u[0];
+        return 1;
+    }else if((u[0] & 0xE0) == 0xC0){
+        n = 2;
+        c = u[0] & 0x1F;
+    }else if((u[0] & 0xF0) == 0xE0){
+        n = 3;
+        c = u[0] & 0x0F;
+    }else if((u[0] & 0xF8) == 0xF0){
+        n = 4;
+        c = u[0] & 0x07;
+    }else{
+        *cp = -1;
+        return 1;
+    }
+    if(n > len){
+        *cp = -1;
+        return 1;
+    }
+    for(int i = 1; i < n; ++i){
+        if((u[i] & 0xC0) != 0x80){
+            *cp = -1;
+            return 1;
+        }
+        c = (c << 6) | (u[i] & 0x3F);
+    }
+    // overlong encodings, surrogates and anything past U+10FFFF
+    if((n == 2 && c < 0x80) || (n == 3 && c < 0x800) || (n == 4 && c < 0x10000) ||
+       (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF){
+        *cp = -1;
+        return 1;
+    }
+    *cp = c;
+    return n;
+}
+
+static const struct { int lo, hi; } zero_width[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x0610, 0x061A },
+    { 0x064B, 0x065F }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x1AB0, 0x1AFF },
+    { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x20D0, 0x20FF }, { 0xFE00, 0xFE0F },
+    { 0xFE20, 0xFE2F }, { 0xE0100, 0xE01EF },
+};
+
+static const struct { int lo, hi; } double_width[] = {
+    { 0x1100, 0x115F }, { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF },
+    { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+    { 0xFE30, 0xFE4F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x1F300, 0x1F64F },
+    { 0x1F900, 0x1F9FF }, { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+};
+
+// columns cp takes on screen. Control characters and invalid bytes are drawn as one inverted
+// character, see editor_draw_rows.
+int utf8_width(int cp){
+    if(cp < 0x300) return 1;
+    for(size_t i = 0; i < sizeof(zero_width) / sizeof(zero_width[0]); ++i){
+        if(cp >= zero_width[i].lo && cp <= zero_width[i].hi) return 0;
+    }
+    for(size_t i = 0; i < sizeof(double_width) / sizeof(double_width[0]); ++i){
+        if(cp >= double_width[i].lo && cp <= double_width[i].hi) return 2;
+    }
+    return 1;
+}
+
+// byte index of the character after the one at i
+int utf8_next(const char* s, int len, int i){
+    if(i >= len) return len;
+    int cp;
+    return i + utf8_decode(s + i, len - i, &cp);
+}
+
+// byte index of the character before i
+int utf8_prev(const char* s, int i){
+    if(i <= 0) return 0;
+    int j = i - 1;
+    // at most three continuation bytes, and only if they really belong to one character
+    while(j > 0 && i - j < 4 && (s[j] & 0xC0) == 0x80) --j;
+    int cp;
+    if(j + utf8_decode(s + j, i - j, &cp) == i) return j;
+    return i - 1;
+}
+
+// move p past the character of row starting at p->cx, returns its width in columns
+int editor_row_step(const erow* row, struct row_pos* p){
+    unsigned char c = row->chars[p->cx];
+    if(c == '\t'){
+        int w = TAB_STOP - p->rx % TAB_STOP;
+        p->cx += 1;
+        p->bx += w;
+        p->rx += w;
+        return w;
+    }
+    int n = 1, w = 1;
+    if(c >= 0x80){
+        int cp;
+        n = utf8_decode(row->chars + p->cx, row->size - p->cx, &cp);
+        w = cp < 0 ? 1 : utf8_width(cp);
+    }
+    p->cx += n;
+    p->bx += n;
+    p->rx += w;
+    return w;
+}
+
+static int pos_coord(const struct row_pos* p, int coord){
+    return coord == POS_CX ? p->cx : coord == POS_BX ? p->bx : p->rx;
+}
+
+// Start of the character of row that covers value, in the coord (enum pos_coord) coordinate.
+// Past the end of the row this is the end of the row.
+struct row_pos editor_row_pos(const erow* row, int coord, int value){
+    const struct row_pos* cols = row->cols;
+    int count = row->col_count;
+    struct row_pos base = { 0, 0, 0 }; // what the checkpoints are relative to
+    if(row->chunks){
+        // a long row has its checkpoints in the chunks, find the one value is in first
+        const struct row_chunk* c = &row->chunks[editor_chunk_at(row, coord, value)];
+        cols = c->cols;
+        count = c->col_count;
+        base = c->start;
+    }
+
+    // the last checkpoint at or before value
+    int rel = value - pos_coord(&base, coord);
+    int lo = 0, hi = count;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(pos_coord(&cols[mid], coord) <= rel) lo = mid + 1;
+        else hi = mid;
+    }
+    struct row_pos p = base;
+    if(lo > 0){
+        p.cx += cols[lo - 1].cx;
+        p.bx += cols[lo - 1].bx;
+        p.rx += cols[lo - 1].rx;
+    }
+
+    const unsigned char* chars = (const unsigned char*) row->chars;
+    const int* key = coord == POS_CX ? &p.cx : coord == POS_BX ? &p.bx : &p.rx;
+    while(p.cx < row->size){
+        if(chars[p.cx] < 0x80 && chars[p.cx] != '\t'){ // the common case, every coordinate moves by one
+            if(*key >= value) break;
+            ++p.cx;
+            ++p.bx;
+            ++p.rx;
+            continue;
+        }
+        struct row_pos next = p;
+        editor_row_step(row, &next);
+        if(pos_coord(&next, coord) > value) break;
+        p = next;
+    }
+    return p;
+}
+
+// cx moved back to the start of the character it is in, and to the end of a shorter row. For
+// vertical motions, which keep cx from another row.
+int editor_row_snap_cx(const erow* row, int cx){
+    if(cx >= row->size) return row->size;
+    return editor_row_pos(row, POS_CX, cx).cx;
+}
+
+// Rebuild the checkpoints of row, returns the length of its render. Rows shorter than
+// COLUMN_STEP don't need any.
+int editor_update_columns(erow* row){
+    struct row_pos start = { 0, 0, 0 };
+    return editor_build_columns(row, start, row->size, &row->cols, &row->col_count).bx;
+}
+
+// Checkpoints for the size bytes of row starting at start into *cols (*count of them, resized as
+// needed), relative to start. Returns where the span ends. Used directly for the chunks of long rows.
+struct row_pos editor_build_columns(const erow* row, struct row_pos start, int size,
+                                    struct row_pos** cols, int* count){
+    int n = size > 0 ? (size - 1) / COLUMN_STEP : 0;
+    if(n != *count){
+        *cols = mem_realloc(MEM_RENDER, *cols, sizeof(struct row_pos) * *count, sizeof(struct row_pos) * n);
+        if(*cols == NULL && n > 0) error("realloc");
+        *count = n;
+    }
+    struct row_pos p = start;
+    const unsigned char* chars = (const unsigned char*) row->chars;
+    int end = start.cx + size;
+    int k = 0;
+    while(p.cx < end){
+        if(k < n && p.cx - start.cx >= (k + 1) * COLUMN_STEP){
+            struct row_pos rel = { p.cx - start.cx, p.bx - start.bx, p.rx - start.rx };
+            (*cols)[k++] = rel;
+        }
+        if(chars[p.cx] < 0x80 && chars[p.cx] != '\t'){
+            ++p.cx;
+            ++p.bx;
+            ++p.rx;
+        }else{
+            editor_row_step(row, &p);
+        }
+    }
+    struct row_pos rel = { p.cx - start.cx, p.bx - start.bx, p.rx - start.rx };
+    while(k < n) (*cols)[k++] = rel; // a long last character can cover the last steps
+    return p;
+}
@@ -0,0 +1,389 @@
+
+#include "editor.h"
+
+/* ------------------------------------ split windows ------------------------------------ */
+// :sp and :vs split the current window in two, stacked or side by side. Ctrl-W w/W/h/j/k/l moves
+// between windows, :close and :only get rid of them. A window has its own cursor and scroll
+// position but no text of its own: it shows a buffer (see buffers.c), so two windows on one file
+// share its rows, render and hl, and an edit in one shows up in the other.
+//
+// The current window's position lives in state like the current buffer does, its place on the
+// screen in state.screen_top/left/rows/cols, so motions and scrolling don't know about windows.
+// The other windows are drawn by putting their position (and text, if they show another buffer)
+// in state for a moment. A window is only drawn again when its view changed: its buffer's
+// state.changes, its position and size, or what the status bar shows. Even then it is only
+// written if the bytes come out different, so typing in one window only sends that window.
+//
+// The layout is a tree of splits. With one window there is no tree and the screen is drawn as before.
+
+// everything a window's text and status bar are drawn from
+struct window_view {
+    int buffer;
+    long changes; // the buffer's state.changes
+    int cx, cy, rowoff, coloff, segoff;
+    int top, left, rows, cols, screen_cols, wrap; // the separator column depends on screen_cols
+    int mode, visual_anchor; // the selection is only shown in the current window
+    int recording, saving, indexing, following;
+};
+
+struct window {
+    struct window* parent;
+    struct window* child[2];   // a split: top/left and bottom/right, NULL in a window
+    int vertical;              // a split: side by side (:vs) instead of stacked (:sp)
+    int top, left, rows, cols; // screen area, with the status line and the separator column
+
+    // a window: what it shows, while it is not the current one (state has it then)
+    int buffer;
+    int cx, cy, rowoff, coloff, segoff;
+    struct abuf drawn; // what was written for it last time
+    struct window_view view; // what it was drawn from, valid while drawn.b is set
+};
+
+static struct {
+    struct window* root; // NULL while there is only one window
+    struct window* current;
+    int count;           // windows, not counting the splits
+    int rows, cols;      // the screen without the message bar
+    int overlaid;        // a panel was drawn over the windows last time
+} windows;
+
+int editor_windows_split(){
+    return windows.root != NULL;
+}
+
+static struct window* window_new(struct window* parent){
+    struct window* w = calloc(1, sizeof(struct window));
+    if(w == NULL) error("calloc");
+    w->parent = parent;
+    return w;
+}
+
+static void window_free(struct window* w){
+    if(w == NULL) return;
+    window_free(w->child[0]);
+    window_free(w->child[1]);
+    ab_free(&w->drawn);
+    free(w);
+}
+
+static struct window* window_first(struct window* w){
+    while(w->child[0]) w = w->child[0];
+    return w;
+}
+
+// the window after w, left to right and top to bottom. NULL after the last one
+static struct window* window_next(struct window* w){
+    while(w->parent && w == w->parent->child[1]) w = w->parent;
+    return w->parent ? window_first(w->parent->child[1]) : NULL;
+}
+
+static void window_layout(struct window* w, int top, int left, int rows, int cols){
+    w->top = top;
+    w->left = left;
+    w->rows = rows;
+    w->cols = cols;
+    if(w->child[0] == NULL) return;
+    if(w->vertical){
+        int a = (cols + 1) / 2; // the left one has the separator, this gives both the same text width
+        window_layout(w->child[0], top, left, rows, a);
+        window_layout(w->child[1], top, left + a, rows, cols - a);
+    }else{
+        int a = rows / 2;
+        window_layout(w->child[0], top, left, a, cols);
+        window_layout(w->child[1], top + a, left, rows - a, cols);
+    }
+}
+
+// a window that doesn't reach the right edge of the screen ends with a '|' column
+static int window_separator(const struct window* w){
+    return w->left + w->cols < windows.cols;
+}
+
+// state's screen area becomes w's text area
+static void window_screen(const struct window* w){
+    state.screen_top = w->top;
+    state.screen_left = w->left;
+    state.screen_rows = w->rows - 1;
+    state.screen_cols = w->cols - window_separator(w);
+}
+
+// keep the current window's position in it while another one is current
+static void window_save(struct window* w){
+    w->buffer = editor_buffer_current();
+    w->cx = state.cx;
+    w->cy = state.cy;
+    w->rowoff = state.rowoff;
+    w->coloff = state.coloff;
+    w->segoff = state.segoff;
+}
+
+// w's position into state, which has w's buffer. The buffer may have lost rows meanwhile
+static void window_restore(const struct window* w){
+    state.cx = w->cx;
+    state.cy = w->cy;
+    state.rowoff = w->rowoff;
+    state.coloff = w->coloff;
+    state.segoff = w->segoff;
+    if(state.cy > state.num_rows) state.cy = state.num_rows;
+    if(state.rowoff > state.cy) state.rowoff = state.cy;
+    if(state.cy < state.num_rows) editor_row_touch(&state.row[state.cy]); // may be frozen, see cold-rows.c
+    state.cx = state.cy < state.num_rows ? editor_row_snap_cx(&state.row[state.cy], state.cx) : 0;
+}
+
+// make w the current window, the one that was current must have been saved (or freed)
+static void window_activate(struct window* w){
+    windows.current = w;
+    editor_buffer_show(w->buffer); // nothing to do if it shows the current buffer already
+    window_restore(w);
+    window_screen(w);
+    state.mode = NORMAL_MODE;
+}
+
+static void window_switch(struct window* w){
+    if(w == NULL || w == windows.current) return;
+    window_save(windows.current);
+    window_activate(w);
+}
+
+// back to a single window, the current one, using the whole screen
+static void windows_collapse(){
+    window_free(windows.root);
+    windows.root = windows.current = NULL;
+    windows.count = 1;
+    state.screen_top = 0;
+    state.screen_left = 0;
+    state.screen_rows = windows.rows - 1;
+    state.screen_cols = windows.cols;
+}
+
+// :sp [file] and :vs [file], the new window goes above or to the left and becomes current
+void editor_window_split(int vertical, const char* filename){
+    while(*filename == ' ') ++filename;
+    if(windows.root == NULL){
+        windows.rows = state.screen_rows + 1; // the status bar is the window's, the message bar isn't
+        windows.cols = state.screen_cols;
+        windows.root = windows.current = window_new(NULL);
+        windows.count = 1;
+        window_layout(windows.root, 0, 0, windows.rows, windows.cols);
+    }
+    struct window* w = windows.current;
+    if((vertical ? w->cols : w->rows) < 4){
+        if(windows.count == 1) windows_collapse();
+        editor_set_status_msg("no room for another window");
+        return;
+    }
+    window_save(w);
+    // w becomes the split, both halves start out as copies of it
+    for(int k = 0; k < 2; ++k){
+        struct window* half = window_new(w);
+        half->buffer = w->buffer;
+        half->cx = w->cx;
+        half->cy = w->cy;
+        half->rowoff = w->rowoff;
+        half->coloff = w->coloff;
+        half->segoff = w->segoff;
+        w->child[k] = half;
+    }
+    w->vertical = vertical;
+    ab_free(&w->drawn);
+    w->drawn.b = NULL;
+    w->drawn.len = 0;
+    ++windows.count;
+    window_layout(windows.root, 0, 0, windows.rows, windows.cols);
+    windows.current = w->child[0];
+    window_screen(windows.current);
+    if(*filename) editor_buffer_edit(filename);
+}
+
+// :close, the window beside it takes its place
+void editor_window_close(){
+    if(windows.count < 2){
+        editor_set_status_msg("can't close the last window");
+        return;
+    }
+    struct window* w = windows.current;
+    struct window* split = w->parent;
+    struct window* other = split->child[split->child[0] == w];
+    other->parent = split->parent;
+    if(split->parent == NULL) windows.root = other;
+    else split->parent->child[split->parent->child[1] == split] = other;
+    split->child[0] = split->child[1] = NULL;
+    window_free(split);
+    window_free(w);
+    --windows.count;
+    window_layout(windows.root, 0, 0, windows.rows, windows.cols);
+    window_activate(window_first(other));
+    if(windows.count == 1) windows_collapse();
+}
+
+// :only, closes every window but the current one
+void editor_window_only(){
+    if(windows.root) windows_collapse();
+}
+
+// the window at screen line y, column x, if any
+static struct window* window_at(int y, int x){
+    for(struct window* w = window_first(windows.root); w; w = window_next(w)){
+        if(y >= w->top && y < w->top + w->rows && x >= w->left && x < w->left + w->cols) return w;
+    }
+    return NULL;
+}
+
+// Ctrl-W c: the key after Ctrl-W
+void editor_window_command(int c){
+    if(c == 's' || c == 'v'){
+        editor_window_split(c == 'v', "");
+        return;
+    }
+    if(windows.root == NULL) return;
+    struct window* w = windows.current;
+    // the cursor's place on the screen, the window in that direction is the one beside it
+    int y = state.cy - state.rowoff, x = state.rx - state.coloff;
+    if(y < 0 || y >= state.screen_rows) y = 0;
+    if(x < 0 || x >= state.screen_cols) x = 0;
+    y += w->top;
+    x += w->left;
+    switch(c){
+        case 'w':
+        case CTRL_KEY('w'):
+            window_switch(window_next(w) ? window_next(w) : window_first(windows.root));
+            break;
+        case 'W': {
+            struct window* prev = NULL;
+            for(struct window* v = window_first(windows.root); v; v = window_next(v)){
+                if(v != w) prev = v;
+                else if(prev) break;
+            }
+            window_switch(prev);
+            break;
+        }
+        case 'h':
+            window_switch(window_at(y, w->left - 1));
+            break;
+        case 'l':
+            window_switch(window_at(y, w->left + w->cols));
+            break;
+        case 'k':
+            window_switch(window_at(w->top - 1, x));
+            break;
+        case 'j':
+            window_switch(window_at(w->top + w->rows, x));
+            break;
+        case 'c':
+            editor_window_close();
+            break;
+        case 'o':
+            editor_window_only();
+            break;
+    }
+}
+
+// the buffer is shown in some window, so it has to keep its render and hl
+int editor_window_shows(int buffer){
+    for(struct window* w = windows.root ? window_first(windows.root) : NULL; w; w = window_next(w)){
+        if(w != windows.current && w->buffer == buffer) return 1;
+    }
+    return buffer == editor_buffer_current();
+}
+
+static void window_draw_frame(struct window* w, struct abuf* ab){
+    char pos[32];
+    int plen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", w->top + w->rows, w->left + 1);
+    ab_append(ab, pos, plen);
+    editor_draw_status_bar(ab);
+    if(!window_separator(w)) return;
+    for(int i = 0; i < w->rows; ++i){
+        plen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH|", w->top + i + 1, w->left + w->cols);
+        ab_append(ab, pos, plen);
+    }
+}
+
+static void window_view(const struct window* w, struct window_view* v){
+    memset(v, 0, sizeof(*v)); // they are compared with memcmp
+    v->buffer = w == windows.current ? editor_buffer_current() : w->buffer;
+    v->changes = editor_buffer_changes(v->buffer);
+    if(w == windows.current){
+        v->cx = state.cx;
+        v->cy = state.cy;
+        v->rowoff = state.rowoff;
+        v->coloff = state.coloff;
+        v->segoff = state.segoff;
+        v->mode = state.mode;
+        v->visual_anchor = state.mode == VISUAL_MODE ? state.visual_anchor : 0;
+    }else{
+        v->cx = w->cx;
+        v->cy = w->cy;
+        v->rowoff = w->rowoff;
+        v->coloff = w->coloff;
+        v->segoff = w->segoff;
+    }
+    v->top = w->top;
+    v->left = w->left;
+    v->rows = w->rows;
+    v->cols = w->cols;
+    v->screen_cols = windows.cols;
+    v->wrap = state.wrap;
+    v->recording = editor_macro_recording();
+    v->saving = editor_save_progress();
+    v->indexing = editor_pager_indexing();
+    v->following = editor_following();
+}
+
+// Draw w into a buffer of its own, and into ab only if that isn't what is on the screen already.
+// Nothing is done for a window whose view is what it was drawn from last time.
+static void window_draw(struct window* w, struct abuf* ab){
+    struct window_view view;
+    if(w == windows.current) editor_scroll(); // again: drawing the other windows used the soft wrap screen line index
+    window_view(w, &view);
+    if(w->drawn.b && !windows.overlaid && memcmp(&view, &w->view, sizeof(view)) == 0) return;
+
+    struct abuf out = { NULL, 0 };
+    if(w == windows.current){
+        editor_draw_rows(&out);
+        window_draw_frame(w, &out);
+    }else{
+        struct state saved = state;
+        editor_buffer_exchange(w->buffer);
+        state.mode = NORMAL_MODE; // the visual selection is only shown where it is made
+        window_restore(w);
+        window_screen(w);
+        editor_scroll();
+        editor_draw_rows(&out);
+        window_draw_frame(w, &out);
+        w->cx = state.cx;
+        w->cy = state.cy;
+        w->rowoff = state.rowoff;
+        w->coloff = state.coloff;
+        w->segoff = state.segoff;
+        editor_buffer_exchange(w->buffer);
+        state = saved;
+    }
+    if(windows.overlaid || out.len != w->drawn.len || memcmp(out.b, w->drawn.b, out.len) != 0){
+        ab_append(ab, out.b, out.len);
+    }
+    ab_free(&w->drawn);
+    w->drawn = out;
+    window_view(w, &w->view); // scrolling may have moved it
+}
+
+// every window that changed, the current one last (its soft wrap index is what the cursor uses),
+// then the cursor goes to the message bar
+void editor_draw_windows(struct abuf* ab){
+    for(struct window* w = window_first(windows.root); w; w = window_next(w)){
+        if(w != windows.current) window_draw(w, ab);
+    }
+    window_draw(windows.current, ab);
+    char pos[32];
+    int plen = snprintf(pos, sizeof(pos), "\x1b[%d;1H", windows.rows + 1);
+    ab_append(ab, pos, plen);
+}
+
+// whether an overlay panel was drawn over the windows this time
+void editor_windows_overlaid(int shown){
+    windows.overlaid = shown;
+}
+
+void editor_free_windows(){
+    window_free(windows.root);
+    windows.root = windows.current = NULL;
+}